@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+#include "../profiling.hpp"
+#include "../tuner.hpp"
+#include "../GaussianBlurFilter/convolution.hpp"
+#include "../Histogram/histogram.hpp"
+#include "../Reduction/reduction.hpp"
+#include "../Rotate/warp.hpp"
+#include "../TransposeMatrix/transpose.hpp"
+#include "../VectorAddition/map.hpp"
+
+using Candidates = std::vector<std::vector<size_t>>;
+
+// Shared by every sweep: the device, a profiling queue and the timing policy
+struct Sweep {
+  Runtime &rt;
+  cl::CommandQueue queue;
+  Bench bench;
+  std::vector<size_t> sizes; // work-group sizes worth trying on this device
+
+  /* Median kernel time of step, which enqueues on queue into the events */
+  template <class Step> double time(Step step) const {
+    return bench.run([&](PhaseEvents &ev) { step(&ev.kernel); }).kernel;
+  }
+
+  /* Times every candidate of name and reports the winner */
+  template <class Time> void tune(const std::string &name, const Candidates &candidates, Time t) {
+    std::cout << "[INFO] " << name << ", " << candidates.size() << " candidates\n";
+    std::vector<size_t> best = autotune(rt.tuning(), name, candidates, t, &std::cout);
+    std::cout << "[INFO] " << name << " ->";
+    for (size_t v : best)
+      std::cout << ' ' << v;
+    std::cout << (best.empty() ? " no candidate ran, unchanged\n" : "\n");
+  }
+};
+
+/* The preferred multiple and work-group limit of a trivial kernel stand in
+ * for every primitive's; primitives shrink what their kernels do not take */
+static std::vector<size_t> deviceLocalSizes(Runtime &rt) {
+  cl::Kernel probe(rt.programFromSource("__kernel void probe(__global int *p) {\n"
+                                        "  p[get_global_id(0)] = 0;\n}\n"),
+                   "probe");
+  return localSizes(probe, rt.device());
+}
+
+static cl::Image2D randomImage(Runtime &rt, size_t width, size_t height) {
+  std::vector<cl_uchar> pixels(width * height * 4);
+  std::mt19937 gen(1319);
+  std::generate(pixels.begin(), pixels.end(), [&]() { return (cl_uchar)gen(); });
+  return cl::Image2D(rt.context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                     cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), width, height, 0, pixels.data());
+}
+
+static void tuneTranspose(Sweep &s) {
+  const size_t n = 2048;
+  cl::Buffer src(s.rt.context(), CL_MEM_READ_WRITE, n * n * sizeof(float));
+  cl::Buffer dst(s.rt.context(), CL_MEM_READ_WRITE, n * n * sizeof(float));
+  Candidates candidates;
+  for (size_t tile = 8; tile <= 64; tile *= 2)
+    for (size_t rows = 1; rows <= tile; rows *= 2)
+      if (std::count(s.sizes.begin(), s.sizes.end(), tile * rows))
+        candidates.push_back({tile, rows});
+  s.tune(Transpose::tuningName(), candidates, [&](std::vector<size_t> &values) {
+    Transpose transpose(s.rt);
+    values = transpose.tuning();
+    return s.time([&](std::vector<cl::Event> *ev) { transpose(s.queue, src, dst, n, n, ev); });
+  });
+}
+
+static void tuneHistogram(Sweep &s) {
+  const size_t pixels = 1920 * 1080;
+  std::vector<cl_uchar> data(pixels * 4);
+  std::mt19937 gen(1319);
+  std::generate(data.begin(), data.end(), [&]() { return (cl_uchar)gen(); });
+  cl::Buffer bufData(s.rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, data.size(),
+                     data.data());
+  cl::Buffer bufHist(s.rt.context(), CL_MEM_READ_WRITE, 4 * 256 * sizeof(int));
+  Candidates candidates;
+  for (size_t local : s.sizes)
+    for (size_t replicas = 1; replicas <= std::min<size_t>(local, 32); replicas *= 2)
+      candidates.push_back({local, replicas});
+  s.tune(Histogram::tuningName(), candidates, [&](std::vector<size_t> &values) {
+    Histogram histogram(s.rt, 4);
+    values = histogram.tuning();
+    return s.time(
+        [&](std::vector<cl::Event> *ev) { histogram(s.queue, bufData, pixels, bufHist, ev); });
+  });
+}
+
+static void tuneWarp(Sweep &s) {
+  const size_t width = 1920, height = 1080;
+  cl::Image2D in = randomImage(s.rt, width, height), out = randomImage(s.rt, width, height);
+  Affine map = Affine::rotation(M_PI / 6, width, height, width, height);
+  Candidates candidates;
+  for (auto &shape : tileShapes(s.sizes))
+    if (shape[0] <= 64 && shape[1] <= 64)
+      candidates.push_back(shape);
+  s.tune(Warp::tuningName(), candidates, [&](std::vector<size_t> &values) {
+    Warp warp(s.rt);
+    values = warp.tuning();
+    return s.time([&](std::vector<cl::Event> *ev) { warp(s.queue, in, out, map, ev); });
+  });
+}
+
+// a 5x5 box runs as the separable passes, sharpen as the direct one
+static void tuneConvolution(Sweep &s) {
+  const size_t width = 1920, height = 1080;
+  cl::Image2D in = randomImage(s.rt, width, height), out = randomImage(s.rt, width, height);
+  for (const Filter2D &filter : {Filter2D::box(5), Filter2D::sharpen()}) {
+    bool separable = Convolution(s.rt, filter).separable();
+    Candidates candidates;
+    for (auto &shape : tileShapes(s.sizes))
+      if (shape[0] <= 128 && shape[1] <= 64 && (!separable || shape[0] >= shape[1]))
+        candidates.push_back(shape);
+    s.tune(Convolution::tuningName(separable), candidates, [&](std::vector<size_t> &values) {
+      Convolution convolution(s.rt, filter);
+      values = convolution.tuning();
+      return s.time([&](std::vector<cl::Event> *ev) { convolution(s.queue, in, out, ev); });
+    });
+  }
+}
+
+static void tuneMap(Sweep &s) {
+  const size_t n = 1 << 24;
+  cl::Buffer a(s.rt.context(), CL_MEM_READ_ONLY, n * sizeof(float));
+  cl::Buffer b(s.rt.context(), CL_MEM_READ_ONLY, n * sizeof(float));
+  cl::Buffer c(s.rt.context(), CL_MEM_WRITE_ONLY, n * sizeof(float));
+  Candidates candidates;
+  for (size_t width = 2; width <= 16; width *= 2)
+    for (size_t local : s.sizes)
+      candidates.push_back({width, local});
+  s.tune(Map::tuningName("float"), candidates, [&](std::vector<size_t> &values) {
+    Map add(s.rt, "float", 2);
+    add.then("a + b");
+    values = add.tuning();
+    return s.time([&](std::vector<cl::Event> *ev) { add(s.queue, {a, b}, c, n, ev); });
+  });
+}
+
+// VectorAddition's plain kernel, one element per work-item
+static void tuneVecadd(Sweep &s) {
+  const size_t n = 1 << 24;
+  cl::Buffer a(s.rt.context(), CL_MEM_READ_ONLY, n * sizeof(int));
+  cl::Buffer b(s.rt.context(), CL_MEM_READ_ONLY, n * sizeof(int));
+  cl::Buffer c(s.rt.context(), CL_MEM_WRITE_ONLY, n * sizeof(int));
+  cl::Kernel &kernel = s.rt.kernel("VectorAddition/adder.cl", "vecadd");
+  kernel.setArg(0, a);
+  kernel.setArg(1, b);
+  kernel.setArg(2, c);
+  Candidates candidates;
+  for (size_t local : localSizes(kernel, s.rt.device()))
+    candidates.push_back({local});
+  s.tune("vecadd", candidates, [&](std::vector<size_t> &values) {
+    return s.time([&](std::vector<cl::Event> *ev) {
+      ev->emplace_back();
+      s.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(n), cl::NDRange(values[0]),
+                                   nullptr, &ev->back());
+    });
+  });
+}
+
+static void tuneReduction(Sweep &s) {
+  const size_t n = 1 << 24;
+  cl::Buffer in(s.rt.context(), CL_MEM_READ_WRITE, n * sizeof(float));
+  cl::Buffer result(s.rt.context(), CL_MEM_READ_WRITE, sizeof(float));
+  s.queue.enqueueFillBuffer(in, 1.0f, 0, n * sizeof(float));
+  Candidates candidates;
+  for (size_t local : s.sizes)
+    candidates.push_back({local});
+  s.tune(Reduction<cl_float>::tuningName(), candidates, [&](std::vector<size_t> &values) {
+    Reduction<cl_float> sum(s.rt, ReduceOp::Sum);
+    values = sum.tuning();
+    return s.time([&](std::vector<cl::Event> *ev) { sum(s.queue, in, n, result, ev); });
+  });
+}
+
+int main(int argc, char *argv[]) {
+  const std::map<std::string, std::function<void(Sweep &)>> primitives = {
+      {"transpose", tuneTranspose}, {"histogram", tuneHistogram},
+      {"warp", tuneWarp},           {"convolution", tuneConvolution},
+      {"map", tuneMap},             {"reduction", tuneReduction},
+      {"vecadd", tuneVecadd}};
+
+  std::vector<std::string> selected(argv + 1, argv + argc);
+  if (selected.empty())
+    for (auto &p : primitives)
+      selected.push_back(p.first);
+  for (auto &name : selected)
+    if (!primitives.count(name)) {
+      std::cerr << R"(Correct way to execute this program is:
+./autotune [transpose|histogram|warp|convolution|map|reduction|vecadd ...]
+Every primitive is tuned when none is named. For example: ./autotune warp convolution)";
+      return 1;
+    }
+
+  try {
+    // Shared context, queue and program registry for the selected device
+    Runtime &rt = Runtime::get();
+    rt.printInfo();
+    if (rt.tuning().path().empty())
+      std::cout << "[WARN] no tuning file (CLP_NO_CACHE is set), results are not kept\n";
+
+    Sweep sweep{rt, rt.createQueue(CL_QUEUE_PROFILING_ENABLE), Bench(1, 5), deviceLocalSizes(rt)};
+    for (auto &name : selected)
+      primitives.at(name)(sweep);
+
+    if (rt.tuning().save())
+      std::cout << "[INFO] tuning saved to " << rt.tuning().path() << '\n';
+  } catch (const cl::Error &error) {
+    std::cout << error.what() << "(" << error.err() << ")" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
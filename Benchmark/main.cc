@@ -0,0 +1,860 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../batch.hpp"
+#include "../cpu.hpp"
+#include "../profiling.hpp"
+#include "../runtime.hpp"
+#include "../scheduler.hpp"
+#include "../specialize.hpp"
+#include "../GaussianBlurFilter/blur.hpp"
+#include "../GaussianBlurFilter/convolution.hpp"
+#include "../Histogram/histogram.hpp"
+#include "../MultiCommandQueue/stream.hpp"
+#include "../RadixSort/radix.hpp"
+#include "../Reduction/reduction.hpp"
+#include "../Rotate/warp.hpp"
+#include "../TransposeMatrix/transpose.hpp"
+#include "../VectorAddition/map.hpp"
+
+#define RANDOM_NUMBER_MAX 1000
+
+#ifndef OPENCL_1
+static const char *build_options = "-cl-std=CL2.0 -cl-mad-enable -cl-fast-relaxed-math";
+#else
+static const char *build_options = "-cl-mad-enable  -cl-fast-relaxed-math";
+#endif
+
+struct Config {
+  Bench bench;
+  cl::CommandQueue queue; // profiling enabled
+  BenchReport *report;
+};
+
+static inline auto rand_gen()
+{
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  return mt;
+}
+
+template <class T> static std::vector<T> random_vector(size_t n, int max)
+{
+  std::uniform_int_distribution<> dis(0, max - 1);
+  auto gen = rand_gen();
+  std::vector<T> v(n);
+  std::generate(v.begin(), v.end(), [&](){return (T)dis(gen);});
+  return v;
+}
+
+/* Work-group sizes the kernel cannot run with are skipped, not reported */
+static bool fits(Runtime &rt, const cl::Kernel &kernel, size_t local)
+{
+  return local <= kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt.device());
+}
+
+static void bench_vecadd(Runtime &rt, Config &cfg)
+{
+  auto &kernel = rt.kernel("VectorAddition/adder.cl", "vecadd");
+
+  for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+    size_t datasize = n * sizeof(int);
+    auto A = random_vector<int>(n, RANDOM_NUMBER_MAX), B = A, C = A;
+
+    cl::Buffer bufA(rt.context(), CL_MEM_READ_ONLY, datasize);
+    cl::Buffer bufB(rt.context(), CL_MEM_READ_ONLY, datasize);
+    cl::Buffer bufC(rt.context(), CL_MEM_WRITE_ONLY, datasize);
+
+    for (size_t local : {64, 128, 256}) {
+      if (!fits(rt, kernel, local))
+        continue;
+
+      BenchRecord r;
+      r.primitive = "vecadd"; r.variant = "int";
+      r.size = r.elements = n; r.local = local; r.reps = cfg.bench.reps();
+      r.bytesIn = 2 * datasize; r.bytesOut = datasize; r.bytesKernel = 3 * datasize;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(2); ev.kernel.resize(1); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteBuffer(bufA, CL_FALSE, 0, datasize, A.data(), nullptr, &ev.h2d[0]);
+        cfg.queue.enqueueWriteBuffer(bufB, CL_FALSE, 0, datasize, B.data(), nullptr, &ev.h2d[1]);
+        kernel.setArg(0, bufA);
+        kernel.setArg(1, bufB);
+        kernel.setArg(2, bufC);
+        cfg.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(n), cl::NDRange(local), nullptr, &ev.kernel[0]);
+        cfg.queue.enqueueReadBuffer(bufC, CL_FALSE, 0, datasize, C.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+static void bench_vector_operation(Runtime &rt, Config &cfg)
+{
+  auto &kernel = rt.kernel("MultiCommandQueue/kernel.cl", "vector_operation", build_options);
+
+  for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+    size_t datasize = n * sizeof(int32_t);
+    auto src = random_vector<int32_t>(n, RANDOM_NUMBER_MAX), dst = src;
+
+    cl::Buffer buf_src(rt.context(), CL_MEM_READ_ONLY, datasize);
+    cl::Buffer buf_target(rt.context(), CL_MEM_WRITE_ONLY, datasize);
+
+    for (size_t local : {64, 128, 256, 512}) {
+      if (!fits(rt, kernel, local))
+        continue;
+
+      BenchRecord r;
+      r.primitive = "vector_operation"; r.variant = "int";
+      r.size = r.elements = n; r.local = local; r.reps = cfg.bench.reps();
+      r.bytesIn = r.bytesOut = datasize; r.bytesKernel = 2 * datasize;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(1); ev.kernel.resize(1); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteBuffer(buf_src, CL_FALSE, 0, datasize, src.data(), nullptr, &ev.h2d[0]);
+        kernel.setArg(0, buf_src);
+        kernel.setArg(1, buf_target);
+        cfg.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(n), cl::NDRange(local), nullptr, &ev.kernel[0]);
+        cfg.queue.enqueueReadBuffer(buf_target, CL_FALSE, 0, datasize, dst.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+
+    // end to end through the pinned ring, wall-clock
+    StreamMap stream(rt, kernel, std::min<size_t>(n, 1 << 18), sizeof(int32_t), sizeof(int32_t));
+    BenchRecord r;
+    r.primitive = "vector_operation"; r.variant = "stream";
+    r.size = r.elements = n; r.reps = cfg.bench.reps();
+    r.bytesIn = r.bytesOut = datasize; r.bytesKernel = 2 * datasize;
+    r.time = cfg.bench.runHost([&] { stream(src.data(), dst.data(), n); });
+    cfg.report->add(r);
+  }
+}
+
+/* add -> scale -> sin as three map passes through temporaries against the
+ * same chain fused into one generated kernel */
+static void bench_map(Runtime &rt, Config &cfg)
+{
+  Map add(rt, "float", 2), scale(rt, "float"), sine(rt, "float"), fused(rt, "float", 2);
+  add.then("a + b");
+  scale.then("a * 2.0f");
+  sine.then("sin(a)");
+  fused.then("a + b").then("x * 2.0f").then("sin(x)");
+
+  for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+    size_t datasize = n * sizeof(float);
+    auto A = random_vector<float>(n, RANDOM_NUMBER_MAX), B = A, C = A;
+
+    cl::Buffer bufA(rt.context(), CL_MEM_READ_ONLY, datasize);
+    cl::Buffer bufB(rt.context(), CL_MEM_READ_ONLY, datasize);
+    cl::Buffer bufT(rt.context(), CL_MEM_READ_WRITE, datasize);
+    cl::Buffer bufC(rt.context(), CL_MEM_READ_WRITE, datasize);
+
+    for (bool fuse : {false, true}) {
+      BenchRecord r;
+      r.primitive = "map"; r.variant = fuse ? "fused" : "unfused";
+      r.size = r.elements = n; r.local = fused.width(); r.reps = cfg.bench.reps();
+      r.bytesIn = 2 * datasize; r.bytesOut = datasize;
+      r.bytesKernel = (fuse ? 3 : 7) * datasize;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(2); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteBuffer(bufA, CL_FALSE, 0, datasize, A.data(), nullptr, &ev.h2d[0]);
+        cfg.queue.enqueueWriteBuffer(bufB, CL_FALSE, 0, datasize, B.data(), nullptr, &ev.h2d[1]);
+        if (fuse) {
+          fused(cfg.queue, {bufA, bufB}, bufC, n, &ev.kernel);
+        } else {
+          add(cfg.queue, {bufA, bufB}, bufT, n, &ev.kernel);
+          scale(cfg.queue, {bufT}, bufC, n, &ev.kernel);
+          sine(cfg.queue, {bufC}, bufT, n, &ev.kernel);
+        }
+        cfg.queue.enqueueReadBuffer(fuse ? bufC : bufT, CL_FALSE, 0, datasize, C.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+static void bench_reduce(Runtime &rt, Config &cfg)
+{
+  Reduction<cl_int> sum(rt, ReduceOp::Sum);
+  Reduction<cl_float> argmax(rt, ReduceOp::ArgMax);
+
+  for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+    size_t datasize = n * sizeof(int);
+    auto ints = random_vector<int>(n, RANDOM_NUMBER_MAX);
+    auto floats = random_vector<float>(n, RANDOM_NUMBER_MAX);
+
+    cl::Buffer bufInts(rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, datasize, ints.data());
+    cl::Buffer bufFloats(rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, datasize, floats.data());
+    cl::Buffer bufScan(rt.context(), CL_MEM_READ_WRITE, datasize);
+    cl::Buffer bufResult(rt.context(), CL_MEM_READ_WRITE, sizeof(ArgValue<cl_float>));
+
+    for (std::string variant : {"sum_int", "argmax_float", "scan_int"}) {
+      bool scan = variant == "scan_int";
+      BenchRecord r;
+      r.primitive = scan ? "scan" : "reduce"; r.variant = variant;
+      r.size = r.elements = n; r.local = sum.localSize(); r.reps = cfg.bench.reps();
+      r.bytesKernel = (scan ? 3 : 1) * datasize; // the scan reads twice and writes once
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        if (scan)
+          sum.exclusiveScan(cfg.queue, bufInts, bufScan, n, &ev.kernel);
+        else if (variant == "sum_int")
+          sum(cfg.queue, bufInts, n, bufResult, &ev.kernel);
+        else
+          argmax(cfg.queue, bufFloats, n, bufResult, &ev.kernel);
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+static void bench_sort(Runtime &rt, Config &cfg)
+{
+  RadixSort<cl_uint> sort(rt);
+
+  for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+    size_t datasize = n * sizeof(cl_uint);
+    auto keys = random_vector<cl_uint>(n, RANDOM_NUMBER_MAX * RANDOM_NUMBER_MAX), values = keys;
+
+    cl::Buffer bufKeys(rt.context(), CL_MEM_READ_WRITE, datasize);
+    cl::Buffer bufValues(rt.context(), CL_MEM_READ_WRITE, datasize);
+
+    for (bool pairs : {false, true}) {
+      BenchRecord r;
+      r.primitive = "sort"; r.variant = pairs ? "uint_pairs" : "uint";
+      r.size = r.elements = n; r.local = sort.localSize(); r.reps = cfg.bench.reps();
+      r.bytesIn = (pairs ? 2 : 1) * datasize;
+      r.bytesKernel = 4 * 3 * r.bytesIn; // four passes, each reads twice and writes once
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(pairs ? 2 : 1);
+        cfg.queue.enqueueWriteBuffer(bufKeys, CL_FALSE, 0, datasize, keys.data(), nullptr, &ev.h2d[0]);
+        if (pairs) {
+          cfg.queue.enqueueWriteBuffer(bufValues, CL_FALSE, 0, datasize, values.data(), nullptr, &ev.h2d[1]);
+          sort(cfg.queue, bufKeys, bufValues, n, &ev.kernel);
+        } else {
+          sort(cfg.queue, bufKeys, n, &ev.kernel);
+        }
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+/* vector_operation over a CPU device, kernel only and wall-clock timed:
+ * the whole device against one lane per NUMA sub-device, each with
+ * buffers first touched on its own node */
+static void bench_fission(Runtime &rt, Config &cfg)
+{
+  if (!(rt.device().getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU))
+    return;
+  auto parts = partitionDevice(rt.device());
+  if (parts.size() < 2) {
+    std::cerr << "[WARN] device cannot be split by NUMA node\n";
+    return;
+  }
+
+  std::vector<std::unique_ptr<Runtime>> subs;
+  std::vector<Runtime *> numa;
+  for (auto &part : parts) {
+    subs.emplace_back(new Runtime(part));
+    numa.push_back(subs.back().get());
+  }
+
+  const std::vector<std::pair<std::string, std::vector<Runtime *>>> variants = {
+    {"whole", {&rt}}, {"numa_" + std::to_string(parts.size()), numa}};
+  for (auto &variant : variants) {
+    WorkSplitter splitter(variant.second);
+    std::vector<cl::Kernel> kernels;
+    for (auto &lane : splitter.lanes())
+      kernels.push_back(lane.rt->kernel("MultiCommandQueue/kernel.cl", "vector_operation", build_options));
+    std::vector<cl::Buffer> src(kernels.size()), dst(kernels.size());
+    std::vector<size_t> count(kernels.size(), 0);
+
+    for (size_t n = 1 << 20; n <= (1 << 24); n <<= 2) {
+      BenchRecord r;
+      r.primitive = "vector_operation"; r.variant = variant.first;
+      r.size = r.elements = n; r.reps = cfg.bench.reps();
+      r.bytesKernel = 2 * n * sizeof(int32_t);
+      r.time = cfg.bench.runHost([&] {
+        splitter.run(n, [&](const WorkSplitter::Lane &lane, const WorkSplitter::Chunk &chunk,
+                            std::vector<cl::Event> &events) {
+          size_t i = chunk.lane, bytes = chunk.count * sizeof(int32_t);
+          if (chunk.count > count[i]) {
+            src[i] = cl::Buffer(lane.rt->context(), CL_MEM_READ_ONLY, bytes);
+            dst[i] = cl::Buffer(lane.rt->context(), CL_MEM_WRITE_ONLY, bytes);
+            firstTouch(lane.queue, src[i], bytes);
+            firstTouch(lane.queue, dst[i], bytes);
+            count[i] = chunk.count;
+          }
+          kernels[i].setArg(0, src[i]);
+          kernels[i].setArg(1, dst[i]);
+          events.emplace_back();
+          lane.queue.enqueueNDRangeKernel(kernels[i], cl::NullRange, cl::NDRange(chunk.count),
+                                          cl::NullRange, nullptr, &events.back());
+        });
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+static void bench_histogram(Runtime &rt, Config &cfg)
+{
+  const struct { const char *variant; int channels, bins; } shapes[] = {
+    {"r256", 1, 256}, {"r64", 1, 64}, {"rgbl256", 4, 256},
+  };
+
+  for (auto &shape : shapes) {
+    Histogram histogram(rt, shape.channels, shape.bins);
+
+    for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+      size_t datasize = n * shape.channels, histsize = histogram.resultSize();
+      auto img = random_vector<unsigned char>(datasize, 256);
+      std::vector<int> hist(histsize / sizeof(int));
+
+      cl::Buffer bufInputImage(rt.context(), CL_MEM_READ_ONLY, datasize);
+      cl::Buffer bufOutputHistogram(rt.context(), CL_MEM_READ_WRITE, histsize);
+
+      BenchRecord r;
+      r.primitive = "histogram"; r.variant = shape.variant;
+      r.size = r.elements = n; r.local = histogram.localSize(); r.reps = cfg.bench.reps();
+      r.bytesIn = datasize; r.bytesOut = histsize; r.bytesKernel = datasize + histsize;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(1); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteBuffer(bufInputImage, CL_FALSE, 0, datasize, img.data(), nullptr, &ev.h2d[0]);
+        histogram(cfg.queue, bufInputImage, n, bufOutputHistogram, &ev.kernel);
+        cfg.queue.enqueueReadBuffer(bufOutputHistogram, CL_FALSE, 0, histsize, hist.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+/* Histogram, scan and per pixel pass chained on the queue */
+static void bench_equalize(Runtime &rt, Config &cfg)
+{
+  for (int channels : {1, 4}) {
+    Histogram histogram(rt, channels);
+
+    for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+      size_t datasize = n * channels;
+      auto img = random_vector<unsigned char>(datasize, 256), out = img;
+
+      cl::Buffer bufInputImage(rt.context(), CL_MEM_READ_ONLY, datasize);
+      cl::Buffer bufOutputImage(rt.context(), CL_MEM_WRITE_ONLY, datasize);
+
+      for (bool equalize : {true, false}) {
+        size_t outsize = equalize ? datasize : n;
+
+        BenchRecord r;
+        r.primitive = equalize ? "equalize" : "otsu";
+        r.variant = channels == 4 ? "rgba" : "r";
+        r.size = r.elements = n; r.local = histogram.localSize(); r.reps = cfg.bench.reps();
+        r.bytesIn = datasize; r.bytesOut = outsize; r.bytesKernel = 2 * datasize + outsize;
+        r.time = cfg.bench.run([&](PhaseEvents &ev) {
+          ev.h2d.resize(1); ev.d2h.resize(1);
+          cfg.queue.enqueueWriteBuffer(bufInputImage, CL_FALSE, 0, datasize, img.data(), nullptr, &ev.h2d[0]);
+          if (equalize)
+            histogram.equalize(cfg.queue, bufInputImage, n, bufOutputImage, &ev.kernel);
+          else
+            histogram.threshold(cfg.queue, bufInputImage, n, bufOutputImage, &ev.kernel);
+          cfg.queue.enqueueReadBuffer(bufOutputImage, CL_FALSE, 0, outsize, out.data(), nullptr, &ev.d2h[0]);
+        });
+        cfg.report->add(r);
+      }
+    }
+  }
+}
+
+static void bench_transpose(Runtime &rt, Config &cfg)
+{
+  auto &kernel = rt.kernel("TransposeMatrix/kernel.cl", "transpose_parallel_per_element", build_options);
+  auto &perRow = rt.kernel("TransposeMatrix/kernel.cl", "transpose_parallel_per_row", build_options);
+  KernelVariants<int> perRowBaked(rt, "TransposeMatrix/kernel.cl", "transpose_parallel_per_row",
+                                  {"PER_ROW_N"}, build_options);
+  Transpose transpose(rt, build_options);
+
+  for (size_t n = 256; n <= 4096; n <<= 1) {
+    size_t datasize = n * n * sizeof(float);
+    auto src = random_vector<float>(n * n, RANDOM_NUMBER_MAX), dst = src;
+
+    cl::Buffer buf_src(rt.context(), CL_MEM_READ_WRITE, datasize);
+    cl::Buffer buf_target(rt.context(), CL_MEM_WRITE_ONLY, datasize);
+
+    for (size_t local : {8, 16, 32}) {
+      if (!fits(rt, kernel, local * local))
+        continue;
+
+      BenchRecord r;
+      r.primitive = "transpose"; r.variant = "per_element";
+      r.size = n; r.elements = n * n; r.local = local * local; r.reps = cfg.bench.reps();
+      r.bytesIn = r.bytesOut = datasize; r.bytesKernel = 2 * datasize;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(1); ev.kernel.resize(1); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteBuffer(buf_src, CL_FALSE, 0, datasize, src.data(), nullptr, &ev.h2d[0]);
+        kernel.setArg(0, buf_src);
+        kernel.setArg(1, buf_target);
+        cfg.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(n, n), cl::NDRange(local, local), nullptr, &ev.kernel[0]);
+        cfg.queue.enqueueReadBuffer(buf_target, CL_FALSE, 0, datasize, dst.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+
+    // one work-item per row, n as an argument and compiled in
+    for (const char *variant : {"per_row", "per_row_baked"}) {
+      cl::Kernel &k = std::strcmp(variant, "per_row") ? perRowBaked.get((int)n) : perRow;
+
+      BenchRecord r;
+      r.primitive = "transpose"; r.variant = variant;
+      r.size = n; r.elements = n * n; r.reps = cfg.bench.reps();
+      r.bytesIn = r.bytesOut = datasize; r.bytesKernel = 2 * datasize;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(1); ev.kernel.resize(1); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteBuffer(buf_src, CL_FALSE, 0, datasize, src.data(), nullptr, &ev.h2d[0]);
+        k.setArg(0, buf_src);
+        k.setArg(1, buf_target);
+        k.setArg(2, (int)n);
+        cfg.queue.enqueueNDRangeKernel(k, cl::NullRange, cl::NDRange(n), cl::NullRange, nullptr, &ev.kernel[0]);
+        cfg.queue.enqueueReadBuffer(buf_target, CL_FALSE, 0, datasize, dst.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+
+    // n x n, n x n/2 + 1 (edge tiles) and square in place
+    for (const char *variant : {"tiled", "tiled_rect", "inplace"}) {
+      size_t cols = std::strcmp(variant, "tiled_rect") ? n : n / 2 + 1;
+      size_t bytes = n * cols * sizeof(float);
+
+      BenchRecord r;
+      r.primitive = "transpose"; r.variant = variant;
+      r.size = n; r.elements = n * cols; r.local = transpose.localSize(); r.reps = cfg.bench.reps();
+      r.bytesIn = r.bytesOut = bytes; r.bytesKernel = 2 * bytes;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(1); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteBuffer(buf_src, CL_FALSE, 0, bytes, src.data(), nullptr, &ev.h2d[0]);
+        if (std::strcmp(variant, "inplace") == 0)
+          transpose.inPlace(cfg.queue, buf_src, n, &ev.kernel);
+        else
+          transpose(cfg.queue, buf_src, buf_target, n, cols, &ev.kernel);
+        const cl::Buffer &result = std::strcmp(variant, "inplace") ? buf_target : buf_src;
+        cfg.queue.enqueueReadBuffer(result, CL_FALSE, 0, bytes, dst.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+/* Shared driver for the image primitives, `bind` sets everything but the
+ * input and output images. Both packed 8-bit layouts are swept. */
+static void image_primitive(Runtime &rt, Config &cfg, const char *primitive,
+                            cl::Kernel &kernel,
+                            const std::function<void(cl::Kernel &, int, int)> &bind)
+{
+  struct Layout { const char *name; cl::ImageFormat format; size_t pixel; };
+  const Layout layouts[] = {
+    {"rgba_unorm8", cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), 4},
+    {"r_unorm8", cl::ImageFormat(CL_R, CL_UNORM_INT8), 1},
+  };
+
+  for (auto &layout : layouts) {
+    for (size_t n = 256; n <= 2048; n <<= 1) {
+      size_t datasize = n * n * layout.pixel;
+      auto img = random_vector<unsigned char>(datasize, 256), out = img;
+
+      cl::Image2D bufInputImage(rt.context(), CL_MEM_READ_ONLY, layout.format, n, n);
+      cl::Image2D bufOutputImage(rt.context(), CL_MEM_WRITE_ONLY, layout.format, n, n);
+      cl::array<cl::size_type, 3> origin = {0, 0, 0};
+      cl::array<cl::size_type, 3> region = {n, n, 1};
+
+      for (size_t local : {4, 8, 16}) {
+        if (!fits(rt, kernel, local * local))
+          continue;
+
+        BenchRecord r;
+        r.primitive = primitive; r.variant = layout.name;
+        r.size = n; r.elements = n * n; r.local = local * local; r.reps = cfg.bench.reps();
+        r.bytesIn = r.bytesOut = datasize; r.bytesKernel = 2 * datasize;
+        r.time = cfg.bench.run([&](PhaseEvents &ev) {
+          ev.h2d.resize(1); ev.kernel.resize(1); ev.d2h.resize(1);
+          cfg.queue.enqueueWriteImage(bufInputImage, CL_FALSE, origin, region, 0, 0, img.data(), nullptr, &ev.h2d[0]);
+          kernel.setArg(0, bufInputImage);
+          kernel.setArg(1, bufOutputImage);
+          bind(kernel, (int)n, (int)n);
+          cfg.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(n, n), cl::NDRange(local, local), nullptr, &ev.kernel[0]);
+          cfg.queue.enqueueReadImage(bufOutputImage, CL_FALSE, origin, region, 0, 0, out.data(), nullptr, &ev.d2h[0]);
+        });
+        cfg.report->add(r);
+      }
+    }
+  }
+}
+
+static void bench_blur(Runtime &rt, Config &cfg)
+{
+  const int filterWidth = 5;
+  std::vector<float> filter(filterWidth * filterWidth, 1.0f / (filterWidth * filterWidth));
+  cl::Buffer bufFilter(rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                       filter.size() * sizeof(float), filter.data());
+  cl::Sampler sampler(rt.context(), CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST);
+
+  auto bind = [&](cl::Kernel &k, int cols, int rows) {
+    k.setArg(2, rows);
+    k.setArg(3, cols);
+    k.setArg(4, bufFilter);
+    k.setArg(5, filterWidth);
+    k.setArg(6, sampler);
+  };
+  auto &kernel = rt.kernel("GaussianBlurFilter/blur.cl", "blurConvFilter");
+  image_primitive(rt, cfg, "blur", kernel, bind);
+
+  // the width compiled in, loops unrolled
+  KernelVariants<int> widths(rt, "GaussianBlurFilter/blur.cl", "blurConvFilter", {"FILTER_WIDTH"});
+  image_primitive(rt, cfg, "blur_baked", widths.get<filterWidth>(), bind);
+}
+
+/* Driver for primitives that take (queue, in, out, events) and enqueue
+ * their own kernels */
+template <class Op>
+static void image_op(Runtime &rt, Config &cfg, const char *primitive,
+                     const std::string &variant, size_t local, size_t passes, Op &op)
+{
+  const cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+
+  for (size_t n = 256; n <= 2048; n <<= 1) {
+    size_t datasize = n * n * 4;
+    auto img = random_vector<unsigned char>(datasize, 256), out = img;
+
+    cl::Image2D bufInputImage(rt.context(), CL_MEM_READ_ONLY, format, n, n);
+    cl::Image2D bufOutputImage(rt.context(), CL_MEM_WRITE_ONLY, format, n, n);
+    cl::array<cl::size_type, 3> origin = {0, 0, 0};
+    cl::array<cl::size_type, 3> region = {n, n, 1};
+
+    BenchRecord r;
+    r.primitive = primitive; r.variant = variant;
+    r.size = n; r.elements = n * n; r.local = local; r.reps = cfg.bench.reps();
+    // separable passes write and read a float4 intermediate
+    r.bytesIn = r.bytesOut = datasize;
+    r.bytesKernel = 2 * datasize + (passes - 1) * 2 * n * n * 16;
+    r.time = cfg.bench.run([&](PhaseEvents &ev) {
+      ev.h2d.resize(1); ev.d2h.resize(1);
+      cfg.queue.enqueueWriteImage(bufInputImage, CL_FALSE, origin, region, 0, 0, img.data(), nullptr, &ev.h2d[0]);
+      op(cfg.queue, bufInputImage, bufOutputImage, &ev.kernel);
+      cfg.queue.enqueueReadImage(bufOutputImage, CL_FALSE, origin, region, 0, 0, out.data(), nullptr, &ev.d2h[0]);
+    });
+    cfg.report->add(r);
+  }
+}
+
+static void bench_gaussian(Runtime &rt, Config &cfg)
+{
+  for (float sigma : {1.0f, 4.0f, 16.0f}) {
+    GaussianBlur blur(rt, sigma);
+    image_op(rt, cfg, "gaussian", "sigma" + std::to_string((int)sigma),
+             blur.localSize(), 2, blur);
+  }
+}
+
+static void bench_convolve(Runtime &rt, Config &cfg)
+{
+  auto dense = random_vector<float>(7 * 7, RANDOM_NUMBER_MAX);
+  const std::pair<const char *, Filter2D> filters[] = {
+    {"sharpen3", Filter2D::sharpen()},
+    {"sobel3", Filter2D::sobelX()},
+    {"box9", Filter2D::box(9)},
+    {"dense7", Filter2D(7, 7, dense)},
+  };
+
+  for (auto &f : filters) {
+    Convolution conv(rt, f.second);
+    image_op(rt, cfg, "convolve", std::string(f.first) + (conv.separable() ? "_sep" : "_2d"),
+             conv.localSize(), conv.separable() ? 2 : 1, conv);
+  }
+}
+
+static void bench_rotate(Runtime &rt, Config &cfg)
+{
+  const std::pair<const char *, Interp> filters[] = {
+    {"nearest", Interp::Nearest}, {"bilinear", Interp::Bilinear}, {"bicubic", Interp::Bicubic},
+  };
+  const cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+  const size_t angles = 32;
+
+  for (auto &f : filters) {
+    Warp warp(rt, f.second);
+    auto single = [&](const cl::CommandQueue &queue, const cl::Image2D &in,
+                      const cl::Image2D &out, std::vector<cl::Event> *events) {
+      size_t n = in.getImageInfo<CL_IMAGE_WIDTH>();
+      warp(queue, in, out, Affine::rotation(0.5f, n, n, n, n), events);
+    };
+    image_op(rt, cfg, "rotate", f.first, warp.localSize(), 1, single);
+
+    // one upload, many angles
+    for (size_t n = 256; n <= 1024; n <<= 1) {
+      size_t datasize = n * n * 4;
+      auto img = random_vector<unsigned char>(datasize, 256);
+      std::vector<unsigned char> out(datasize * angles);
+      std::vector<Affine> maps;
+      for (size_t i = 0; i < angles; i++)
+        maps.push_back(Affine::rotation(2 * M_PI * i / angles, n, n, n, n));
+
+      cl::Image2D bufInputImage(rt.context(), CL_MEM_READ_ONLY, format, n, n);
+      cl::Image2DArray bufOutputImages(rt.context(), CL_MEM_WRITE_ONLY, format, angles, n, n);
+      cl::array<cl::size_type, 3> origin = {0, 0, 0};
+      cl::array<cl::size_type, 3> region = {n, n, 1}, regions = {n, n, angles};
+
+      BenchRecord r;
+      r.primitive = "rotate_batch"; r.variant = f.first;
+      r.size = n; r.elements = n * n * angles; r.local = warp.localSize(); r.reps = cfg.bench.reps();
+      r.bytesIn = datasize; r.bytesOut = datasize * angles; r.bytesKernel = datasize * (angles + 1);
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        ev.h2d.resize(1); ev.d2h.resize(1);
+        cfg.queue.enqueueWriteImage(bufInputImage, CL_FALSE, origin, region, 0, 0, img.data(), nullptr, &ev.h2d[0]);
+        warp(cfg.queue, bufInputImage, bufOutputImages, maps, &ev.kernel);
+        cfg.queue.enqueueReadImage(bufOutputImages, CL_FALSE, origin, regions, 0, 0, out.data(), nullptr, &ev.d2h[0]);
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+/* Many small frames: one write, launch and read per frame against one
+ * each per batch (an image array, or frames packed in one buffer) */
+static void bench_batch(Runtime &rt, Config &cfg)
+{
+  const cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+  GaussianBlur blur(rt, 1.0f);
+  Histogram histogram(rt, 4, 256);
+  const size_t histsize = histogram.resultSize();
+
+  for (size_t n = 64; n <= 256; n <<= 1) {
+    size_t datasize = n * n * 4;
+    // input, output and the float intermediate of every frame
+    size_t frames = std::min<size_t>(256, batchCapacity(rt.device(), 6 * datasize, 1));
+    auto img = random_vector<unsigned char>(datasize * frames, 256), out = img;
+    std::vector<int> hist(frames * histsize / sizeof(int));
+
+    cl::Image2D bufInputImage(rt.context(), CL_MEM_READ_ONLY, format, n, n);
+    cl::Image2D bufOutputImage(rt.context(), CL_MEM_WRITE_ONLY, format, n, n);
+    cl::Image2DArray bufInputImages(rt.context(), CL_MEM_READ_ONLY, format, frames, n, n);
+    cl::Image2DArray bufOutputImages(rt.context(), CL_MEM_WRITE_ONLY, format, frames, n, n);
+    cl::Buffer bufFrames(rt.context(), CL_MEM_READ_ONLY, datasize * frames);
+    cl::Buffer bufHist(rt.context(), CL_MEM_READ_WRITE, histsize * frames);
+    cl::array<cl::size_type, 3> origin = {0, 0, 0};
+    cl::array<cl::size_type, 3> region = {n, n, 1}, regions = {n, n, frames};
+
+    for (bool batched : {false, true}) {
+      BenchRecord r;
+      r.primitive = "gaussian_frames"; r.variant = batched ? "batched" : "per_image";
+      r.size = n; r.elements = n * n * frames; r.local = blur.localSize(); r.reps = cfg.bench.reps();
+      r.bytesIn = r.bytesOut = datasize * frames;
+      r.bytesKernel = (2 * datasize + 2 * n * n * 16) * frames;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        if (batched) {
+          ev.h2d.resize(1); ev.d2h.resize(1);
+          cfg.queue.enqueueWriteImage(bufInputImages, CL_FALSE, origin, regions, 0, 0, img.data(), nullptr, &ev.h2d[0]);
+          blur(cfg.queue, bufInputImages, bufOutputImages, &ev.kernel);
+          cfg.queue.enqueueReadImage(bufOutputImages, CL_FALSE, origin, regions, 0, 0, out.data(), nullptr, &ev.d2h[0]);
+          return;
+        }
+        ev.h2d.resize(frames); ev.d2h.resize(frames);
+        for (size_t i = 0; i < frames; i++) {
+          cfg.queue.enqueueWriteImage(bufInputImage, CL_FALSE, origin, region, 0, 0, img.data() + i * datasize, nullptr, &ev.h2d[i]);
+          blur(cfg.queue, bufInputImage, bufOutputImage, &ev.kernel);
+          cfg.queue.enqueueReadImage(bufOutputImage, CL_FALSE, origin, region, 0, 0, out.data() + i * datasize, nullptr, &ev.d2h[i]);
+        }
+      });
+      cfg.report->add(r);
+
+      r.primitive = "histogram_frames"; r.local = histogram.localSize();
+      r.bytesOut = histsize * frames; r.bytesKernel = (datasize + histsize) * frames;
+      r.time = cfg.bench.run([&](PhaseEvents &ev) {
+        if (batched) {
+          ev.h2d.resize(1); ev.d2h.resize(1);
+          cfg.queue.enqueueWriteBuffer(bufFrames, CL_FALSE, 0, datasize * frames, img.data(), nullptr, &ev.h2d[0]);
+          histogram.batch(cfg.queue, bufFrames, n * n, frames, bufHist, &ev.kernel);
+          cfg.queue.enqueueReadBuffer(bufHist, CL_FALSE, 0, histsize * frames, hist.data(), nullptr, &ev.d2h[0]);
+          return;
+        }
+        ev.h2d.resize(frames); ev.d2h.resize(frames);
+        for (size_t i = 0; i < frames; i++) {
+          cfg.queue.enqueueWriteBuffer(bufFrames, CL_FALSE, 0, datasize, img.data() + i * datasize, nullptr, &ev.h2d[i]);
+          histogram(cfg.queue, bufFrames, n * n, bufHist, &ev.kernel);
+          cfg.queue.enqueueReadBuffer(bufHist, CL_FALSE, 0, histsize, hist.data() + i * histsize / sizeof(int), nullptr, &ev.d2h[i]);
+        }
+      });
+      cfg.report->add(r);
+    }
+  }
+}
+
+/* A request as a service sees it: input and output memory, upload, blur,
+ * download. Host wall-clock, so creating and releasing the CL objects
+ * counts, against the same request on memory leased from the pool */
+static void bench_pool(Runtime &rt, Config &cfg)
+{
+  const cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+  GaussianBlur blur(rt, 1.0f);
+
+  for (size_t n = 64; n <= 1024; n <<= 2) {
+    size_t datasize = n * n * 4;
+    auto img = random_vector<unsigned char>(datasize, 256), out = img;
+    cl::array<cl::size_type, 3> origin = {0, 0, 0};
+    cl::array<cl::size_type, 3> region = {n, n, 1};
+
+    auto request = [&](const cl::Image2D &in, const cl::Image2D &result) {
+      cfg.queue.enqueueWriteImage(in, CL_FALSE, origin, region, 0, 0, img.data());
+      blur(cfg.queue, in, result);
+      cfg.queue.enqueueReadImage(result, CL_TRUE, origin, region, 0, 0, out.data());
+    };
+
+    for (bool pooled : {false, true}) {
+      BenchRecord r;
+      r.primitive = "request_gaussian"; r.variant = pooled ? "pooled" : "fresh";
+      r.size = n; r.elements = n * n; r.local = blur.localSize(); r.reps = cfg.bench.reps();
+      r.bytesIn = r.bytesOut = datasize; r.bytesKernel = 2 * datasize + 2 * n * n * 16;
+      r.time = cfg.bench.runHost([&] {
+        if (pooled) {
+          MemoryPool::Image in = rt.pool().image(format, n, n, CL_MEM_READ_ONLY);
+          MemoryPool::Image result = rt.pool().image(format, n, n, CL_MEM_WRITE_ONLY);
+          request(in, result);
+        } else {
+          request(cl::Image2D(rt.context(), CL_MEM_READ_ONLY, format, n, n),
+                  cl::Image2D(rt.context(), CL_MEM_WRITE_ONLY, format, n, n));
+        }
+      });
+      cfg.report->add(r);
+    }
+  }
+  rt.pool().stats().print(std::cerr);
+}
+
+/* The CPU backend on the same problems; runs without any OpenCL device */
+static void bench_cpu(Config &cfg)
+{
+  const std::string variant = std::string("cpu_") + cpuIsaName();
+  auto record = [&](const char *primitive, size_t size, size_t elements, size_t bytes) {
+    BenchRecord r;
+    r.primitive = primitive; r.variant = variant;
+    r.size = size; r.elements = elements; r.local = cpuThreads(); r.reps = cfg.bench.reps();
+    r.bytesKernel = bytes;
+    return r;
+  };
+
+  for (size_t n = 1 << 16; n <= (1 << 24); n <<= 2) {
+    auto A = random_vector<int>(n, RANDOM_NUMBER_MAX), B = A, C = A;
+    BenchRecord r = record("vecadd", n, n, 3 * n * sizeof(int));
+    r.time = cfg.bench.runHost([&] { cpuVecadd(A.data(), B.data(), C.data(), n); });
+    cfg.report->add(r);
+
+    auto img = random_vector<unsigned char>(n * 4, 256);
+    std::vector<int> hist(4 * 256);
+    CpuHistogram histogram(4);
+    r = record("histogram", n, n, n * 4);
+    r.time = cfg.bench.runHost([&] { histogram(img.data(), n, hist.data()); });
+    cfg.report->add(r);
+  }
+
+  for (size_t n = 256; n <= 4096; n <<= 1) {
+    auto src = random_vector<float>(n * n, RANDOM_NUMBER_MAX), dst = src;
+    CpuTranspose transpose;
+    BenchRecord r = record("transpose", n, n * n, 2 * n * n * sizeof(float));
+    r.time = cfg.bench.runHost([&] { transpose(src.data(), dst.data(), n, n); });
+    cfg.report->add(r);
+  }
+
+  for (size_t n = 256; n <= 2048; n <<= 1) {
+    auto img = random_vector<unsigned char>(n * n * 4, 256), out = img;
+    CpuGaussianBlur blur(4.0f);
+    BenchRecord r = record("gaussian", n, n * n, 2 * n * n * 4);
+    r.time = cfg.bench.runHost([&] { blur(img.data(), out.data(), n, n, 4); });
+    cfg.report->add(r);
+
+    CpuWarp warp;
+    r = record("rotate", n, n * n, 2 * n * n * 4);
+    r.time = cfg.bench.runHost([&] {
+      warp(img.data(), n, n, out.data(), n, n, 4, Affine::rotation(0.5f, n, n, n, n));
+    });
+    cfg.report->add(r);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  using namespace std;
+
+  const map<string, function<void(Runtime &, Config &)>> primitives = {
+    {"vecadd", bench_vecadd},       {"vector_operation", bench_vector_operation},
+    {"fission", bench_fission},     {"map", bench_map},
+    {"reduce", bench_reduce},       {"sort", bench_sort},
+    {"histogram", bench_histogram}, {"equalize", bench_equalize},
+    {"transpose", bench_transpose}, {"rotate", bench_rotate},
+    {"blur", bench_blur},           {"batch", bench_batch},
+    {"pool", bench_pool},
+    {"gaussian", bench_gaussian},   {"convolve", bench_convolve},
+  };
+
+  string format = "csv", out_file, only;
+  int warmup = 2, reps = 10;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    string opt = argv[i];
+    if (opt == "-f") format = argv[i + 1];
+    else if (opt == "-o") out_file = argv[i + 1];
+    else if (opt == "-w") warmup = atoi(argv[i + 1]);
+    else if (opt == "-r") reps = atoi(argv[i + 1]);
+    else if (opt == "-p") only = "," + string(argv[i + 1]) + ",";
+    else {
+      cerr << R"(Correct way to execute this program is:
+./bench [-f csv|json] [-o output_file] [-w warmup] [-r repetitions] [-p primitive,...]
+For example: ./bench -f json -o results.json -p transpose,blur,cpu )";
+      return 1;
+    }
+  }
+
+  // without a device only the CPU backend runs
+  Runtime *rt = runtimeOrCpu(cerr);
+  if (rt)
+    rt->printInfo(cerr);
+
+  try {
+    BenchReport report(rt ? rt->device().getInfo<CL_DEVICE_NAME>() : string("cpu"));
+    Config cfg{Bench(warmup, reps), rt ? rt->createQueue(CL_QUEUE_PROFILING_ENABLE) : cl::CommandQueue(), &report};
+
+    for (auto &p : primitives) {
+      if (!rt || (!only.empty() && only.find("," + p.first + ",") == string::npos))
+        continue;
+      cerr << "[INFO] " << p.first << '\n';
+      try {
+        p.second(*rt, cfg);
+      } catch (cl::Error &error) {
+        cerr << "[WARN] " << p.first << " skipped: " << error.what() << "("
+             << error.err() << ")\n";
+      }
+    }
+    if (!rt || only.empty() || only.find(",cpu,") != string::npos) {
+      cerr << "[INFO] cpu (" << cpuIsaName() << ", " << cpuThreads() << " threads)\n";
+      bench_cpu(cfg);
+    }
+
+    ofstream file;
+    if (!out_file.empty())
+      file.open(out_file);
+    ostream &os = out_file.empty() ? cout : file;
+    if (format == "json")
+      report.writeJson(os);
+    else
+      report.writeCsv(os);
+  } catch (cl::Error &error) {
+    cerr << error.what() << "(" << error.err() << ")" << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,28 +1,39 @@
 
-/* filterWidth *must* be odd int */
+/* filterWidth *must* be odd int, images are CL_UNORM_INT8 (RGBA or R).
+ * -D FILTER_WIDTH=w compiles the width in and ignores the argument, so
+ * both loops have constant trip counts and unroll completely */
+#ifdef FILTER_WIDTH
+#define WIDTH FILTER_WIDTH
+#define UNROLL _Pragma("unroll")
+#else
+#define WIDTH filterWidth
+#define UNROLL
+#endif
+
 __kernel void blurConvFilter(__read_only image2d_t inImg,
                              __write_only image2d_t outImg, int rows, int cols,
                              __constant float *filter, int filterWidth,
                              sampler_t sampler) {
   int X = get_global_id(0), Y = get_global_id(1);
-  int halfWidth = filterWidth / 2;
-  int4 sum = {0,0,0,0};
+  const int halfWidth = WIDTH / 2;
+  float4 sum = {0.0f, 0.0f, 0.0f, 0.0f};
   int2 coord;
   int filterIdx = 0;
 
+  UNROLL
   for (int i = -halfWidth; i <= halfWidth; i++) {
     coord.y = Y + i;
+    UNROLL
     for (int j = -halfWidth; j <= halfWidth; j++) {
       coord.x = X + j;
 
-      int4 pixel = read_imagei(inImg, sampler, coord);
-      float intensity = filter[filterIdx];
-      sum.x += pixel.x * intensity;
-      sum.y += pixel.y * intensity;
-      sum.z += pixel.z * intensity;
+      float4 pixel = read_imagef(inImg, sampler, coord);
+      sum += pixel * filter[filterIdx];
       filterIdx++;
     }
   }
 
-  write_imagei(outImg, (int2){X, Y}, sum);
+  sum.w = 1.0f;
+  write_imagef(outImg, (int2){X, Y}, sum);
 }
+
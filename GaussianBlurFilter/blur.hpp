@@ -0,0 +1,49 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <cmath>
+#include <vector>
+
+#include "../runtime.hpp"
+#include "convolution.hpp"
+
+/* Normalized 1D Gaussian taps for offsets -radius..radius, sigma > 0 */
+inline std::vector<float> gaussianWeights(float sigma, int radius) {
+  if (!(sigma > 0.0f) || radius < 0)
+    throw cl::Error(CL_INVALID_VALUE, "gaussianWeights: sigma must be > 0, radius >= 0");
+  std::vector<float> w(2 * radius + 1);
+  float sum = 0.0f;
+  for (int i = -radius; i <= radius; ++i)
+    sum += w[i + radius] = std::exp(-(i * i) / (2.0f * sigma * sigma));
+  for (auto &v : w)
+    v /= sum;
+  return w;
+}
+
+/* radius < 0 picks ceil(3 * sigma) */
+inline int gaussianRadius(float sigma, int radius) {
+  return radius >= 0 ? radius : (int)std::ceil(3.0f * sigma);
+}
+
+/*
+ * Separable Gaussian blur of any sigma: a horizontal and a vertical pass of
+ * 2 * radius + 1 taps each through the convolution engine, one program
+ * build per radius.
+ */
+class GaussianBlur : public Convolution {
+public:
+  GaussianBlur(Runtime &rt, float sigma, int radius = -1,
+               Border border = Border::Clamp)
+      : GaussianBlur(rt, sigma, gaussianWeights(sigma, gaussianRadius(sigma, radius)), border) {}
+
+  float sigma() const { return sigma_; }
+  int radius() const { return radiusX(); }
+
+private:
+  GaussianBlur(Runtime &rt, float sigma, const std::vector<float> &weights, Border border)
+      : Convolution(rt, weights, weights, border), sigma_(sigma) {}
+
+  float sigma_;
+};
+
+#endif
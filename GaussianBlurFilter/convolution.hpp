@@ -0,0 +1,320 @@
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+
+/* Values of BORDER in convolve.cl */
+enum class Border { Zero = 0, Clamp = 1, Wrap = 2, Mirror = 3 };
+
+/* Odd sized, row-major filter; taps[j * width + i] weighs pixel
+ * (x + i - width / 2, y + j - height / 2) */
+struct Filter2D {
+  int width = 1, height = 1;
+  std::vector<float> taps{1.0f};
+
+  Filter2D() = default;
+  Filter2D(int w, int h, std::vector<float> t) : width(w), height(h), taps(std::move(t)) {
+    if (width % 2 == 0 || height % 2 == 0 || (int)taps.size() != width * height)
+      throw cl::Error(CL_INVALID_VALUE, "Filter2D: filter must be odd sized");
+  }
+
+  static Filter2D box(int size) {
+    return Filter2D(size, size, std::vector<float>(size * size, 1.0f / (size * size)));
+  }
+  static Filter2D sharpen() {
+    return Filter2D(3, 3, {0, -1, 0, -1, 5, -1, 0, -1, 0});
+  }
+  static Filter2D sobelX() {
+    return Filter2D(3, 3, {-1, 0, 1, -2, 0, 2, -1, 0, 1});
+  }
+  static Filter2D sobelY() {
+    return Filter2D(3, 3, {-1, -2, -1, 0, 0, 0, 1, 2, 1});
+  }
+};
+
+/*
+ * Rank-1 test: when taps == col * row^T within eps (relative to the largest
+ * tap) fill row (width taps) and col (height taps) and return true.
+ */
+inline bool factorize(const Filter2D &f, std::vector<float> &row,
+                      std::vector<float> &col, float eps = 1e-5f) {
+  auto pivot = std::max_element(f.taps.begin(), f.taps.end(),
+                                [](float a, float b) { return std::fabs(a) < std::fabs(b); });
+  float p = *pivot;
+  if (p == 0.0f)
+    return false;
+  int pj = (pivot - f.taps.begin()) / f.width, pi = (pivot - f.taps.begin()) % f.width;
+
+  row.assign(f.taps.begin() + pj * f.width, f.taps.begin() + (pj + 1) * f.width);
+  col.resize(f.height);
+  for (int j = 0; j < f.height; ++j)
+    col[j] = f.taps[j * f.width + pi] / p;
+
+  for (int j = 0; j < f.height; ++j)
+    for (int i = 0; i < f.width; ++i)
+      if (std::fabs(f.taps[j * f.width + i] - col[j] * row[i]) > eps * std::fabs(p))
+        return false;
+  return true;
+}
+
+/*
+ * Image convolution with any odd sized filter (convolve.cl). Rank-1 filters
+ * run as a horizontal and a vertical pass through a float intermediate
+ * image, everything else as one direct pass; both load each work-group's
+ * tile and halo into __local memory once. Tile shapes are the device's
+ * tuned ones, else picked per device type, and shrunk to the device's
+ * work-group and local memory limits. The batch form convolves every layer
+ * of an image array in the same launches, from a layered build of the
+ * program made on first use.
+ */
+class Convolution {
+public:
+  Convolution(Runtime &rt, const Filter2D &filter, Border border = Border::Clamp)
+      : rt_(rt), border_(border), rx_(filter.width / 2), ry_(filter.height / 2) {
+    std::vector<float> row, col;
+    separable_ = factorize(filter, row, col);
+    if (separable_)
+      setTaps(row, col);
+    else
+      taps_ = cl::Buffer(rt_.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         filter.taps.size() * sizeof(float),
+                         const_cast<float *>(filter.taps.data()));
+    build();
+  }
+
+  /* Explicitly separable filter, row taps run horizontally */
+  Convolution(Runtime &rt, const std::vector<float> &row, const std::vector<float> &col,
+              Border border = Border::Clamp)
+      : rt_(rt), border_(border), rx_((int)row.size() / 2), ry_((int)col.size() / 2),
+        separable_(true) {
+    if (row.size() % 2 == 0 || col.size() % 2 == 0)
+      throw cl::Error(CL_INVALID_VALUE, "Convolution: filter must be odd sized");
+    setTaps(row, col);
+    build();
+  }
+
+  bool separable() const { return separable_; }
+  int radiusX() const { return rx_; }
+  int radiusY() const { return ry_; }
+  size_t localSize() const {
+    return separable_ ? sepLong_ * sepShort_ : tileX_ * tileY_;
+  }
+
+  /* Tuning entries: long and short side of the separable passes' tile, or
+   * width and height of the direct pass' tile */
+  static std::string tuningName(bool separable) {
+    return separable ? "Convolution.separable" : "Convolution.direct";
+  }
+  std::vector<size_t> tuning() const {
+    return separable_ ? std::vector<size_t>{sepLong_, sepShort_}
+                      : std::vector<size_t>{tileX_, tileY_};
+  }
+
+  /* Convolve in into out (same size and channel order). The event of every
+   * pass is appended to events when given. */
+  void operator()(const cl::CommandQueue &queue, const cl::Image2D &in,
+                  const cl::Image2D &out, std::vector<cl::Event> *events = nullptr) {
+    Shape shape(in, 1);
+    if (separable_ && !(tmpShape_ == shape)) {
+      tmp_ = cl::Image2D(rt_.context(), CL_MEM_READ_WRITE, shape.format(), shape.width,
+                         shape.height);
+      tmpShape_ = shape;
+    }
+    run(queue, direct_, rows_, cols_, in, tmp_, out, shape, events);
+  }
+
+  /* Every layer of in into the same layer of out, one launch per pass for
+   * the whole batch */
+  void operator()(const cl::CommandQueue &queue, const cl::Image2DArray &in,
+                  const cl::Image2DArray &out, std::vector<cl::Event> *events = nullptr) {
+    Shape shape(in, in.getImageInfo<CL_IMAGE_ARRAY_SIZE>());
+    if (!(separable_ ? rowsLayered_() : directLayered_())) {
+      compile(true);
+      fitKernels(true);
+    }
+    if (separable_ && !(tmpArrayShape_ == shape)) {
+      tmpArray_ = cl::Image2DArray(rt_.context(), CL_MEM_READ_WRITE, shape.format(),
+                                   shape.layers, shape.width, shape.height);
+      tmpArrayShape_ = shape;
+    }
+    run(queue, directLayered_, rowsLayered_, colsLayered_, in, tmpArray_, out, shape, events);
+  }
+
+  static size_t roundUp(size_t n, size_t m) { return (n + m - 1) / m * m; }
+
+private:
+  void setTaps(const std::vector<float> &row, const std::vector<float> &col) {
+    taps_ = cl::Buffer(rt_.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                       row.size() * sizeof(float), const_cast<float *>(row.data()));
+    colTaps_ = cl::Buffer(rt_.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                          col.size() * sizeof(float), const_cast<float *>(col.data()));
+  }
+
+  /* Halve (x, y), y first, until the tile fits maxWG, then until it plus a
+   * (hx, hy) halo of float4 fits local memory. When not even a 1x1 tile
+   * does, the kernel reads the image directly and keeps the maxWG tile;
+   * false then. */
+  static bool fitTile(size_t &x, size_t &y, size_t hx, size_t hy, size_t maxWG,
+                      size_t localMem) {
+    const size_t pixel = 4 * sizeof(float);
+    while (x * y > maxWG)
+      (y > 1 ? y : x) /= 2;
+    size_t lx = x, ly = y;
+    while ((lx + 2 * hx) * (ly + 2 * hy) * pixel > localMem && lx * ly > 1)
+      (ly > 1 ? ly : lx) /= 2;
+    if ((lx + 2 * hx) * (ly + 2 * hy) * pixel > localMem)
+      return false;
+    x = lx;
+    y = ly;
+    return true;
+  }
+
+  /* GPUs like square tiles, CPUs long rows that stay in cache lines,
+   * unless the device has tuned ones */
+  void chooseTiles(size_t maxWG) {
+    size_t localMem = rt_.device().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    bool gpu = rt_.device().getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_GPU;
+    std::vector<size_t> tuned;
+    bool haveTuned = tunedValues(rt_.tuning(), tuningName(separable_), 2, tuned);
+
+    if (separable_) {
+      sepLong_ = haveTuned ? tuned[0] : gpu ? 32 : 64;
+      sepShort_ = haveTuned ? tuned[1] : gpu ? 8 : 4;
+      useLocal_ = fitTile(sepLong_, sepShort_, std::max(rx_, ry_), 0, maxWG, localMem);
+    } else {
+      tileX_ = haveTuned ? tuned[0] : gpu ? 16 : 64;
+      tileY_ = haveTuned ? tuned[1] : gpu ? 16 : 4;
+      useLocal_ = fitTile(tileX_, tileY_, rx_, ry_, maxWG, localMem);
+    }
+  }
+
+  void build() {
+    chooseTiles(rt_.device().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+    compile();
+    fitKernels(false);
+  }
+
+  /* Kernels may take less than the device maximum, retry once smaller. The
+   * tile is compiled in, so a smaller one rebuilds the single image
+   * kernels, and the layered ones when they are the reason. */
+  void fitKernels(bool layered) {
+    auto limitOf = [&](const cl::Kernel &k) {
+      return (size_t)k.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device());
+    };
+    size_t limit = separable_ ? std::min(limitOf(layered ? rowsLayered_ : rows_),
+                                         limitOf(layered ? colsLayered_ : cols_))
+                              : limitOf(layered ? directLayered_ : direct_);
+    if (localSize() > limit) {
+      chooseTiles(limit);
+      compile();
+      if (layered)
+        compile(true);
+    }
+  }
+
+  /* Private kernel objects, so instances sharing a program can set their
+   * own arguments */
+  void compile(bool layered = false) {
+    std::string options = "-D RADIUS_X=" + std::to_string(rx_) +
+                          " -D RADIUS_Y=" + std::to_string(ry_) +
+                          " -D BORDER=" + std::to_string((int)border_) +
+                          " -D USE_LOCAL=" + std::to_string(useLocal_);
+    if (separable_)
+      options += " -D SEP_LONG=" + std::to_string(sepLong_) +
+                 " -D SEP_SHORT=" + std::to_string(sepShort_);
+    else
+      options += " -D TILE_X=" + std::to_string(tileX_) +
+                 " -D TILE_Y=" + std::to_string(tileY_);
+
+    if (layered)
+      options += " -D LAYERED=1";
+
+    cl::Program &program = rt_.program("GaussianBlurFilter/convolve.cl", options);
+    if (separable_) {
+      (layered ? rowsLayered_ : rows_) = cl::Kernel(program, "convolveRows");
+      (layered ? colsLayered_ : cols_) = cl::Kernel(program, "convolveCols");
+    } else {
+      (layered ? directLayered_ : direct_) = cl::Kernel(program, "convolve2D");
+    }
+  }
+
+  /* Size, layers and channel order of an input, which the float
+   * intermediate of the separable passes follows */
+  struct Shape {
+    size_t width = 0, height = 0, layers = 0;
+    cl_channel_order order = 0;
+
+    Shape() = default;
+    Shape(const cl::Image &in, size_t layers)
+        : width(in.getImageInfo<CL_IMAGE_WIDTH>()), height(in.getImageInfo<CL_IMAGE_HEIGHT>()),
+          layers(layers), order(in.getImageInfo<CL_IMAGE_FORMAT>().image_channel_order) {}
+
+    cl::ImageFormat format() const { return cl::ImageFormat(order, CL_FLOAT); }
+    bool operator==(const Shape &o) const {
+      return width == o.width && height == o.height && layers == o.layers && order == o.order;
+    }
+  };
+
+  void run(const cl::CommandQueue &queue, cl::Kernel &direct, cl::Kernel &rows, cl::Kernel &cols,
+           const cl::Image &in, const cl::Image &tmp, const cl::Image &out, const Shape &shape,
+           std::vector<cl::Event> *events) {
+    const size_t width = shape.width, height = shape.height, layers = shape.layers;
+    cl::Event ev;
+
+    if (!separable_) {
+      direct.setArg(0, in);
+      direct.setArg(1, out);
+      direct.setArg(2, taps_);
+      queue.enqueueNDRangeKernel(direct, cl::NullRange,
+                                 range(roundUp(width, tileX_), roundUp(height, tileY_), layers),
+                                 range(tileX_, tileY_, 1), nullptr, &ev);
+      if (events)
+        events->push_back(ev);
+      return;
+    }
+
+    rows.setArg(0, in);
+    rows.setArg(1, tmp);
+    rows.setArg(2, taps_);
+    queue.enqueueNDRangeKernel(rows, cl::NullRange,
+                               range(roundUp(width, sepLong_), roundUp(height, sepShort_), layers),
+                               range(sepLong_, sepShort_, 1), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+
+    cols.setArg(0, tmp);
+    cols.setArg(1, out);
+    cols.setArg(2, colTaps_);
+    queue.enqueueNDRangeKernel(cols, cl::NullRange,
+                               range(roundUp(width, sepShort_), roundUp(height, sepLong_), layers),
+                               range(sepShort_, sepLong_, 1), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  /* 2D for single images, so those launches stay as they were */
+  static cl::NDRange range(size_t x, size_t y, size_t z) {
+    return z > 1 ? cl::NDRange(x, y, z) : cl::NDRange(x, y);
+  }
+
+  Runtime &rt_;
+  Border border_;
+  int rx_, ry_;
+  bool separable_ = false;
+  size_t tileX_ = 16, tileY_ = 16, sepLong_ = 32, sepShort_ = 8;
+  int useLocal_ = 1;
+
+  cl::Buffer taps_, colTaps_;
+  cl::Kernel direct_, rows_, cols_;
+  cl::Kernel directLayered_, rowsLayered_, colsLayered_;
+  cl::Image2D tmp_;
+  cl::Image2DArray tmpArray_;
+  Shape tmpShape_, tmpArrayShape_;
+};
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Tiled 2D convolution (correlation, like blurConvFilter: tap (i, j) weighs
+ * pixel (X + i - RADIUS_X, Y + j - RADIUS_Y)). Everything fixed per filter
+ * is baked in with -D:
+ *   RADIUS_X, RADIUS_Y  half width/height of the (odd sized) filter
+ *   TILE_X, TILE_Y      local size of convolve2D
+ *   SEP_LONG, SEP_SHORT local size of the separable passes, long side along
+ *                       the filter: (SEP_LONG, SEP_SHORT) for convolveRows,
+ *                       (SEP_SHORT, SEP_LONG) for convolveCols
+ *   BORDER              one of the BORDER_* modes below
+ *   USE_LOCAL           0 reads every tap from the image (halo too large
+ *                       for local memory)
+ *   LAYERED             1 builds the same kernels over image2d_array_t,
+ *                       global id 2 picking the layer, so a whole batch of
+ *                       equal sized images is one launch
+ * Every work-group stages its tile plus halo in __local memory once. The
+ * alpha channel is copied from the centre pixel, not filtered.
+ */
+#define BORDER_ZERO 0
+#define BORDER_CLAMP 1
+#define BORDER_WRAP 2
+#define BORDER_MIRROR 3
+
+#ifndef RADIUS_X
+#define RADIUS_X 1
+#endif
+#ifndef RADIUS_Y
+#define RADIUS_Y 1
+#endif
+#ifndef TILE_X
+#define TILE_X 16
+#endif
+#ifndef TILE_Y
+#define TILE_Y 16
+#endif
+#ifndef SEP_LONG
+#define SEP_LONG 32
+#endif
+#ifndef SEP_SHORT
+#define SEP_SHORT 8
+#endif
+#ifndef BORDER
+#define BORDER BORDER_CLAMP
+#endif
+#ifndef USE_LOCAL
+#define USE_LOCAL 1
+#endif
+#ifndef LAYERED
+#define LAYERED 0
+#endif
+
+#if LAYERED
+#define IMAGE_T image2d_array_t
+#define AT(x, y, z) (int4)((x), (y), (z), 0)
+#else
+#define IMAGE_T image2d_t
+#define AT(x, y, z) (int2)((x), (y))
+#endif
+
+#define FILTER_W (2 * RADIUS_X + 1)
+#define FILTER_H (2 * RADIUS_Y + 1)
+
+/* Out of range reads return (0, 0, 0, 0), which is what BORDER_ZERO wants;
+ * every other mode remaps the coordinate into the image first */
+__constant sampler_t convSampler =
+    CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
+
+inline int remap(int i, int n) {
+#if BORDER == BORDER_CLAMP
+  return clamp(i, 0, n - 1);
+#elif BORDER == BORDER_WRAP
+  i %= n;
+  return i < 0 ? i + n : i;
+#elif BORDER == BORDER_MIRROR
+  /* reflect without repeating the edge pixel: -1 -> 1, n -> n - 2 */
+  if (n == 1)
+    return 0;
+  int period = 2 * (n - 1);
+  i %= period;
+  if (i < 0)
+    i += period;
+  return i < n ? i : period - i;
+#else
+  return i;
+#endif
+}
+
+inline float4 fetch(__read_only IMAGE_T img, int2 size, int x, int y, int z) {
+  return read_imagef(img, convSampler, AT(remap(x, size.x), remap(y, size.y), z));
+}
+
+__kernel void convolve2D(__read_only IMAGE_T inImg,
+                         __write_only IMAGE_T outImg,
+                         __constant float *filter) {
+  int X = get_global_id(0), Y = get_global_id(1), Z = get_global_id(2);
+  int2 size = get_image_dim(inImg);
+  float4 sum = (float4)(0.0f);
+  float alpha;
+
+#if USE_LOCAL
+  __local float4 tile[TILE_Y + 2 * RADIUS_Y][TILE_X + 2 * RADIUS_X];
+  int lx = get_local_id(0), ly = get_local_id(1);
+  int x0 = get_group_id(0) * TILE_X - RADIUS_X;
+  int y0 = get_group_id(1) * TILE_Y - RADIUS_Y;
+
+  for (int j = ly; j < TILE_Y + 2 * RADIUS_Y; j += TILE_Y)
+    for (int i = lx; i < TILE_X + 2 * RADIUS_X; i += TILE_X)
+      tile[j][i] = fetch(inImg, size, x0 + i, y0 + j, Z);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int j = 0; j < FILTER_H; j++)
+    for (int i = 0; i < FILTER_W; i++)
+      sum += filter[j * FILTER_W + i] * tile[ly + j][lx + i];
+  alpha = tile[ly + RADIUS_Y][lx + RADIUS_X].w;
+#else
+  for (int j = 0; j < FILTER_H; j++)
+    for (int i = 0; i < FILTER_W; i++)
+      sum += filter[j * FILTER_W + i] *
+             fetch(inImg, size, X + i - RADIUS_X, Y + j - RADIUS_Y, Z);
+  alpha = fetch(inImg, size, X, Y, Z).w;
+#endif
+
+  if (X < size.x && Y < size.y) {
+    sum.w = alpha;
+    write_imagef(outImg, AT(X, Y, Z), sum);
+  }
+}
+
+/* Horizontal pass of a separable filter, FILTER_W taps */
+__kernel void convolveRows(__read_only IMAGE_T inImg,
+                           __write_only IMAGE_T outImg,
+                           __constant float *taps) {
+  int X = get_global_id(0), Y = get_global_id(1), Z = get_global_id(2);
+  int2 size = get_image_dim(inImg);
+  float4 sum = (float4)(0.0f);
+  float alpha;
+
+#if USE_LOCAL
+  __local float4 tile[SEP_SHORT][SEP_LONG + 2 * RADIUS_X];
+  int lx = get_local_id(0), ly = get_local_id(1);
+  int x0 = get_group_id(0) * SEP_LONG - RADIUS_X;
+
+  for (int i = lx; i < SEP_LONG + 2 * RADIUS_X; i += SEP_LONG)
+    tile[ly][i] = fetch(inImg, size, x0 + i, Y, Z);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int k = 0; k < FILTER_W; k++)
+    sum += taps[k] * tile[ly][lx + k];
+  alpha = tile[ly][lx + RADIUS_X].w;
+#else
+  for (int k = 0; k < FILTER_W; k++)
+    sum += taps[k] * fetch(inImg, size, X + k - RADIUS_X, Y, Z);
+  alpha = fetch(inImg, size, X, Y, Z).w;
+#endif
+
+  if (X < size.x && Y < size.y) {
+    sum.w = alpha;
+    write_imagef(outImg, AT(X, Y, Z), sum);
+  }
+}
+
+/* Vertical pass of a separable filter, FILTER_H taps */
+__kernel void convolveCols(__read_only IMAGE_T inImg,
+                           __write_only IMAGE_T outImg,
+                           __constant float *taps) {
+  int X = get_global_id(0), Y = get_global_id(1), Z = get_global_id(2);
+  int2 size = get_image_dim(inImg);
+  float4 sum = (float4)(0.0f);
+  float alpha;
+
+#if USE_LOCAL
+  __local float4 tile[SEP_LONG + 2 * RADIUS_Y][SEP_SHORT];
+  int lx = get_local_id(0), ly = get_local_id(1);
+  int y0 = get_group_id(1) * SEP_LONG - RADIUS_Y;
+
+  for (int i = ly; i < SEP_LONG + 2 * RADIUS_Y; i += SEP_LONG)
+    tile[i][lx] = fetch(inImg, size, X, y0 + i, Z);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int k = 0; k < FILTER_H; k++)
+    sum += taps[k] * tile[ly + k][lx];
+  alpha = tile[ly + RADIUS_Y][lx].w;
+#else
+  for (int k = 0; k < FILTER_H; k++)
+    sum += taps[k] * fetch(inImg, size, X, Y + k - RADIUS_Y, Z);
+  alpha = fetch(inImg, size, X, Y, Z).w;
+#endif
+
+  if (X < size.x && Y < size.y) {
+    sum.w = alpha;
+    write_imagef(outImg, AT(X, Y, Z), sum);
+  }
+}
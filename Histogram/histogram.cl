@@ -1,28 +1,287 @@
-#define HIS_BINS 256
+/*
+ * Histogram of 8-bit pixels, specialized with -D:
+ *   CHANNELS   bytes per pixel, 1 (CL_R layout) or 4 (CL_RGBA layout)
+ *   BINS       bins per histogram
+ *   LO, HI     values in [LO, HI) are counted, anything else is dropped
+ *   REPLICAS   sub-histograms per work-group, work-item i counts into
+ *              replica i % REPLICAS so equal values rarely collide
+ *   USE_LOCAL  0 counts straight into global memory (bins too large for
+ *              local memory)
+ *   SCAN_LOCAL work-group size of cdf and otsu, a power of two
+ * A 4 channel input produces four histograms one after the other in hist:
+ * R, G, B and Rec. 601 luma. Launch any number of work-groups, every
+ * work-item strides over the whole input. histogramBatch does the same for
+ * equal sized images packed into one buffer, one row of groups per image.
+ *
+ * cdf, applyLut, otsu and applyThreshold consume those histograms on the
+ * device, so equalization and thresholding never read bins back to the
+ * host.
+ */
+#ifndef CHANNELS
+#define CHANNELS 1
+#endif
+#ifndef BINS
+#define BINS 256
+#endif
+#ifndef LO
+#define LO 0
+#endif
+#ifndef HI
+#define HI 256
+#endif
+#ifndef REPLICAS
+#define REPLICAS 1
+#endif
+#ifndef USE_LOCAL
+#define USE_LOCAL 1
+#endif
+#ifndef SCAN_LOCAL
+#define SCAN_LOCAL 256
+#endif
 
-__kernel void histogram(__global int *data, int numData,
-                        __global int *histogram) {
-  __local int localHistogram[HIS_BINS];
-  int lid = get_local_id(0);
+#if CHANNELS == 4
+#define HISTS 4
+typedef uchar4 pixel_t;
+#else
+#define HISTS 1
+typedef uchar pixel_t;
+#endif
+
+#define BIN(v) (((v) - LO) * BINS / (HI - LO))
+#define LUMA(r, g, b) ((77 * (r) + 150 * (g) + 29 * (b)) >> 8)
+
+/* Bin k * BINS + bin(v) of h lives at h[(k * BINS + bin(v)) * stride] */
+#define COUNT(h, stride, k, v)                                                 \
+  if ((v) >= LO && (v) < HI)                                                   \
+    atomic_inc(&(h)[((k) * BINS + BIN(v)) * (stride)])
+
+#if CHANNELS == 4
+#define COUNT_PIXEL(h, stride, p)                                              \
+  {                                                                            \
+    int r = (p).x, g = (p).y, b = (p).z;                                       \
+    COUNT(h, stride, 0, r);                                                    \
+    COUNT(h, stride, 1, g);                                                    \
+    COUNT(h, stride, 2, b);                                                    \
+    COUNT(h, stride, 3, LUMA(r, g, b));                                        \
+  }
+#else
+#define COUNT_PIXEL(h, stride, p)                                              \
+  {                                                                            \
+    int v = (p);                                                               \
+    COUNT(h, stride, 0, v);                                                    \
+  }
+#endif
+
+/* Counts data[0, numData) into hist, striding over dimension 0; sub is the
+ * group's HISTS * BINS * REPLICAS local bins (unused without USE_LOCAL) */
+void countPixels(__global const pixel_t *data, int numData, __global int *hist,
+                 __local int *sub) {
   int gid = get_global_id(0);
+  int gsize = get_global_size(0);
 
+#if USE_LOCAL
+  /* replicas of a bin are adjacent, so they sit in different banks */
+  int lid = get_local_id(0);
   int lsize = get_local_size(0);
-  int gsize = get_global_size(0);
+  __local int *mine = sub + lid % REPLICAS;
 
-  /* Initialize the histogram */
-  for (int i = lid; i < HIS_BINS; i += lsize)
-    localHistogram[i] = 0;
+  for (int i = lid; i < HISTS * BINS * REPLICAS; i += lsize)
+    sub[i] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
 
-  /* Wait until all work-items within work-group have completed their store */
+  for (int i = gid; i < numData; i += gsize)
+    COUNT_PIXEL(mine, REPLICAS, data[i])
   barrier(CLK_LOCAL_MEM_FENCE);
 
-  /* Compute local histogram */
+  /* Merge the replicas, one global atomic per non-empty bin and group */
+  for (int i = lid; i < HISTS * BINS; i += lsize) {
+    int sum = 0;
+    for (int r = 0; r < REPLICAS; r++)
+      sum += sub[i * REPLICAS + r];
+    if (sum)
+      atomic_add(&hist[i], sum);
+  }
+#else
   for (int i = gid; i < numData; i += gsize)
-    atomic_add(&localHistogram[data[i]], 1);
+    COUNT_PIXEL(hist, 1, data[i])
+#endif
+}
+
+__kernel void histogram(__global const pixel_t *data, int numData,
+                        __global int *hist) {
+  __local int sub[USE_LOCAL ? HISTS * BINS * REPLICAS : 1];
+  countPixels(data, numData, hist, sub);
+}
+
+/* Image get_global_id(1) of a batch packed back to back, numData pixels
+ * each, into its own HISTS * BINS histograms */
+__kernel void histogramBatch(__global const pixel_t *data, int numData,
+                             __global int *hist) {
+  __local int sub[USE_LOCAL ? HISTS * BINS * REPLICAS : 1];
+  size_t image = get_global_id(1);
+  countPixels(data + image * numData, numData, hist + image * HISTS * BINS, sub);
+}
+
+/* Inclusive Hillis-Steele scan of s[0..SCAN_LOCAL) */
+inline void scanInt(__local int *s, int lid) {
+  for (int off = 1; off < SCAN_LOCAL; off <<= 1) {
+    int v = lid >= off ? s[lid - off] : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    s[lid] += v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
+
+inline void scanFloat2(__local float2 *s, int lid) {
+  for (int off = 1; off < SCAN_LOCAL; off <<= 1) {
+    float2 v = lid >= off ? s[lid - off] : (float2)(0.0f);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    s[lid] += v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
 
+/*
+ * One work-group of SCAN_LOCAL per histogram. Writes the exclusive scan of
+ * histogram k to scan[k * BINS..] and its equalization table, mapping every
+ * 8-bit value to 0..255, to lut[k * 256..]. Values outside [LO, HI) map to
+ * themselves.
+ */
+__kernel void cdf(__global const int *hist, __global int *scan,
+                  __global uchar *lut) {
+  __local int part[SCAN_LOCAL];
+  __local int firstBin;
+  int k = get_group_id(0), lid = get_local_id(0);
+  hist += k * BINS;
+  scan += k * BINS;
+  lut += k * 256;
+
+  /* every work-item owns a run of consecutive bins */
+  int per = (BINS + SCAN_LOCAL - 1) / SCAN_LOCAL;
+  int first = min(lid * per, BINS), last = min(first + per, BINS);
+  int sum = 0;
+  for (int i = first; i < last; i++)
+    sum += hist[i];
+  part[lid] = sum;
+  if (lid == 0)
+    firstBin = BINS;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  scanInt(part, lid);
+
+  int run = lid ? part[lid - 1] : 0;
+  for (int i = first; i < last; i++) {
+    scan[i] = run;
+    if (hist[i])
+      atomic_min(&firstBin, i);
+    run += hist[i];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+  /* classic equalization on the inclusive cdf, the first non-empty bin
+   * goes to 0 */
+  int total = part[SCAN_LOCAL - 1];
+  int cdfMin = firstBin < BINS ? hist[firstBin] : 0;
+  float scale = total > cdfMin ? 255.0f / (total - cdfMin) : 0.0f;
+  for (int v = lid; v < 256; v += SCAN_LOCAL) {
+    if (v >= LO && v < HI && total > cdfMin) {
+      int b = BIN(v);
+      lut[v] = convert_uchar_sat_rte((scan[b] + hist[b] - cdfMin) * scale);
+    } else {
+      lut[v] = v;
+    }
+  }
+}
+
+/* out = lut(in) per channel, alpha is kept. Grid-stride like histogram. */
+__kernel void applyLut(__global const pixel_t *in, __global pixel_t *out,
+                       int numData, __global const uchar *lut) {
+  __local uchar table[HISTS * 256];
+  for (int i = get_local_id(0); i < HISTS * 256; i += get_local_size(0))
+    table[i] = lut[i];
   barrier(CLK_LOCAL_MEM_FENCE);
 
-  /* Write the local histogram out to the global histogram */
-  for (int i = lid; i < HIS_BINS; i += lsize)
-    atomic_add(&histogram[i], localHistogram[i]);
+  for (int i = get_global_id(0); i < numData; i += get_global_size(0)) {
+#if CHANNELS == 4
+    pixel_t p = in[i];
+    out[i] = (uchar4)(table[p.x], table[256 + p.y], table[512 + p.z], p.w);
+#else
+    out[i] = table[in[i]];
+#endif
+  }
+}
+
+/*
+ * Otsu's method on the last histogram (luma for 4 channels), one
+ * work-group of SCAN_LOCAL. threshold[0] is the first 8-bit value of the
+ * upper class, threshold[1] the last bin of the lower one.
+ */
+__kernel void otsu(__global const int *hist, __global int *threshold) {
+  __local float2 part[SCAN_LOCAL]; /* (pixels, sum of bin * pixels) */
+  __local float best[SCAN_LOCAL];
+  __local int bestBin[SCAN_LOCAL];
+  int lid = get_local_id(0);
+  hist += (HISTS - 1) * BINS;
+
+  int per = (BINS + SCAN_LOCAL - 1) / SCAN_LOCAL;
+  int first = min(lid * per, BINS), last = min(first + per, BINS);
+  float2 sum = (float2)(0.0f);
+  for (int i = first; i < last; i++)
+    sum += (float2)(hist[i], (float)i * hist[i]);
+  part[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  scanFloat2(part, lid);
+
+  /* between-class variance of every split, the best one of each run */
+  float2 total = part[SCAN_LOCAL - 1];
+  float2 run = lid ? part[lid - 1] : (float2)(0.0f);
+  float myBest = -1.0f;
+  int myBin = 0;
+  for (int i = first; i < last; i++) {
+    run += (float2)(hist[i], (float)i * hist[i]);
+    float w0 = run.x, w1 = total.x - run.x;
+    if (w0 > 0.0f && w1 > 0.0f) {
+      float d = run.y / w0 - (total.y - run.y) / w1;
+      float v = w0 * w1 * d * d;
+      if (v > myBest) {
+        myBest = v;
+        myBin = i;
+      }
+    }
+  }
+  best[lid] = myBest;
+  bestBin[lid] = myBin;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  /* argmax, ties go to the lower bin */
+  for (int s = SCAN_LOCAL / 2; s > 0; s >>= 1) {
+    if (lid < s && (best[lid + s] > best[lid] ||
+                    (best[lid + s] == best[lid] && bestBin[lid + s] < bestBin[lid]))) {
+      best[lid] = best[lid + s];
+      bestBin[lid] = bestBin[lid + s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid == 0) {
+    threshold[0] = LO + ((bestBin[0] + 1) * (HI - LO) + BINS - 1) / BINS;
+    threshold[1] = bestBin[0];
+  }
+}
+
+/* out (one byte per pixel) = 255 where the value (luma for 4 channels) is
+ * at least threshold[0], 0 elsewhere */
+__kernel void applyThreshold(__global const pixel_t *in, __global uchar *out,
+                             int numData, __global const int *threshold) {
+  int t = threshold[0];
+  for (int i = get_global_id(0); i < numData; i += get_global_size(0)) {
+#if CHANNELS == 4
+    pixel_t p = in[i];
+    int v = LUMA(p.x, p.y, p.z);
+#else
+    int v = in[i];
+#endif
+    out[i] = v >= t ? 255 : 0;
+  }
 }
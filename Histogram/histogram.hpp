@@ -0,0 +1,228 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+
+/*
+ * Histogram of an 8-bit pixel buffer (histogram.cl). channels = 1 reads the
+ * CL_R layout and produces one histogram, channels = 4 reads CL_RGBA and
+ * produces R, G, B and luma in the same pass. bins bins split [lo, hi)
+ * evenly. Each work-group counts into replicated sub-histograms in local
+ * memory, and only as many work-groups as keep every compute unit busy are
+ * launched. The work-group size and replica count are the device's tuned
+ * ones when it has some.
+ *
+ * equalize and threshold chain the histogram, a single work-group scan
+ * (cdf / Otsu) and a per pixel pass on one queue; the intermediate
+ * histogram, cdf, tables and threshold stay on the device.
+ *
+ * batch counts equal sized images packed back to back in one buffer in a
+ * single launch, each into its own histograms.
+ */
+class Histogram {
+public:
+  Histogram(Runtime &rt, int channels = 1, int bins = 256, int lo = 0, int hi = 256)
+      : rt_(rt), channels_(channels), bins_(bins), lo_(lo), hi_(hi) {
+    if (channels != 1 && channels != 4)
+      throw cl::Error(CL_INVALID_VALUE, "Histogram: channels must be 1 or 4");
+    if (bins < 1 || lo < 0 || hi > 256 || lo >= hi)
+      throw cl::Error(CL_INVALID_VALUE, "Histogram: bad bins or range");
+    build();
+  }
+
+  int channels() const { return channels_; }
+  int bins() const { return bins_; }
+  int histograms() const { return channels_ == 4 ? 4 : 1; }
+  int replicas() const { return replicas_; }
+  size_t localSize() const { return local_; }
+  size_t groups() const { return groups_; }
+
+  /* Tuning entry: local size, replicas */
+  static const char *tuningName() { return "Histogram"; }
+  std::vector<size_t> tuning() const { return {local_, (size_t)replicas_}; }
+
+  /* Bytes of the result buffer: histograms() * bins() ints */
+  size_t resultSize() const { return histograms() * bins_ * sizeof(int); }
+
+  /* Histogram of pixels pixels in data into hist (resultSize() bytes, it is
+   * cleared first). The clear and kernel events are appended to events. */
+  void operator()(const cl::CommandQueue &queue, const cl::Buffer &data, size_t pixels,
+                  const cl::Buffer &hist, std::vector<cl::Event> *events = nullptr) {
+    cl::Event fill, ev;
+    queue.enqueueFillBuffer(hist, 0, 0, resultSize(), nullptr, &fill);
+
+    kernel_.setArg(0, data);
+    kernel_.setArg(1, (int)pixels);
+    kernel_.setArg(2, hist);
+    queue.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(launchGroups(pixels) * local_),
+                               cl::NDRange(local_), nullptr, &ev);
+    if (events) {
+      events->push_back(fill);
+      events->push_back(ev);
+    }
+  }
+
+  /* Histograms of images images of pixels pixels each, packed back to back
+   * in data, into hist (images * resultSize() bytes, cleared first); image
+   * i's start at byte i * resultSize() */
+  void batch(const cl::CommandQueue &queue, const cl::Buffer &data, size_t pixels,
+             size_t images, const cl::Buffer &hist, std::vector<cl::Event> *events = nullptr) {
+    cl::Event fill, ev;
+    queue.enqueueFillBuffer(hist, 0, 0, images * resultSize(), nullptr, &fill);
+
+    // the resident groups shared out between the images
+    size_t perImage = std::min(launchGroups(pixels), std::max<size_t>(1, groups_ / images));
+    batch_.setArg(0, data);
+    batch_.setArg(1, (int)pixels);
+    batch_.setArg(2, hist);
+    queue.enqueueNDRangeKernel(batch_, cl::NullRange, cl::NDRange(perImage * local_, images),
+                               cl::NDRange(local_, 1), nullptr, &ev);
+    if (events) {
+      events->push_back(fill);
+      events->push_back(ev);
+    }
+  }
+
+  /* Exclusive scans of hist into cdfBuffer() (resultSize() bytes) and an
+   * equalization table per histogram into lutBuffer() */
+  void cdf(const cl::CommandQueue &queue, const cl::Buffer &hist,
+           std::vector<cl::Event> *events = nullptr) {
+    cl::Event ev;
+    cdf_.setArg(0, hist);
+    cdf_.setArg(1, scan_);
+    cdf_.setArg(2, lut_);
+    queue.enqueueNDRangeKernel(cdf_, cl::NullRange, cl::NDRange(histograms() * scanLocal_),
+                               cl::NDRange(scanLocal_), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  /* Otsu threshold of the last histogram (luma for 4 channels) into
+   * thresholdBuffer(): the first value of the upper class, then its bin */
+  void otsu(const cl::CommandQueue &queue, const cl::Buffer &hist,
+            std::vector<cl::Event> *events = nullptr) {
+    cl::Event ev;
+    otsu_.setArg(0, hist);
+    otsu_.setArg(1, threshold_);
+    queue.enqueueNDRangeKernel(otsu_, cl::NullRange, cl::NDRange(scanLocal_),
+                               cl::NDRange(scanLocal_), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  /* Histogram equalization of data into out (same layout, alpha kept) */
+  void equalize(const cl::CommandQueue &queue, const cl::Buffer &data, size_t pixels,
+                const cl::Buffer &out, std::vector<cl::Event> *events = nullptr) {
+    (*this)(queue, data, pixels, hist_, events);
+    cdf(queue, hist_, events);
+    pixelPass(queue, applyLut_, data, pixels, out, lut_, events);
+  }
+
+  /* One byte per pixel into out, 255 at and above the Otsu threshold */
+  void threshold(const cl::CommandQueue &queue, const cl::Buffer &data, size_t pixels,
+                 const cl::Buffer &out, std::vector<cl::Event> *events = nullptr) {
+    (*this)(queue, data, pixels, hist_, events);
+    otsu(queue, hist_, events);
+    pixelPass(queue, applyThreshold_, data, pixels, out, threshold_, events);
+  }
+
+  /* Last results of the above, for reading back */
+  const cl::Buffer &histogramBuffer() const { return hist_; }
+  const cl::Buffer &cdfBuffer() const { return scan_; }
+  const cl::Buffer &lutBuffer() const { return lut_; }   // histograms() * 256 bytes
+  const cl::Buffer &thresholdBuffer() const { return threshold_; } // 2 ints
+
+private:
+  size_t launchGroups(size_t pixels) const {
+    // never more groups than there is work for
+    return std::max<size_t>(1, std::min(groups_, (pixels + local_ - 1) / local_));
+  }
+
+  void pixelPass(const cl::CommandQueue &queue, cl::Kernel &kernel, const cl::Buffer &data,
+                 size_t pixels, const cl::Buffer &out, const cl::Buffer &table,
+                 std::vector<cl::Event> *events) {
+    cl::Event ev;
+    kernel.setArg(0, data);
+    kernel.setArg(1, out);
+    kernel.setArg(2, (int)pixels);
+    kernel.setArg(3, table);
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(launchGroups(pixels) * local_),
+                               cl::NDRange(local_), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  void build() {
+    const cl::Device &device = rt_.device();
+    bool gpu = device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_GPU;
+    size_t localMem = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    size_t units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+    // CPUs run a work-group on one thread, replicas only cost cache there
+    local_ = std::min<size_t>(256, device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+    replicas_ = gpu ? (int)std::min<size_t>(32, local_) : 1;
+    std::vector<size_t> tuned;
+    if (tunedValues(rt_.tuning(), tuningName(), 2, tuned)) {
+      local_ = std::min<size_t>(tuned[0], device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+      replicas_ = (int)std::min(tuned[1], local_);
+    }
+    size_t bytes = histograms() * bins_ * sizeof(int);
+    while (replicas_ > 1 && replicas_ * bytes > localMem / 2)
+      replicas_ /= 2;
+    useLocal_ = bytes <= localMem;
+
+    compile();
+    size_t limit = kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    for (const cl::Kernel *k : {&batch_, &cdf_, &applyLut_, &otsu_, &applyThreshold_})
+      limit = std::min(limit, k->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+    if (local_ > limit) {
+      local_ = limit;
+      replicas_ = std::min<size_t>(replicas_, local_);
+      compile();
+    }
+
+    // a few resident groups per compute unit hide the atomics' latency
+    groups_ = units * (gpu ? 4 : 1);
+
+    const cl::Context &context = rt_.context();
+    hist_ = cl::Buffer(context, CL_MEM_READ_WRITE, resultSize());
+    scan_ = cl::Buffer(context, CL_MEM_READ_WRITE, resultSize());
+    lut_ = cl::Buffer(context, CL_MEM_READ_WRITE, histograms() * 256);
+    threshold_ = cl::Buffer(context, CL_MEM_READ_WRITE, 2 * sizeof(int));
+  }
+
+  void compile() {
+    // the scans need a power of two
+    scanLocal_ = 1;
+    while (scanLocal_ * 2 <= local_)
+      scanLocal_ *= 2;
+
+    std::string options = "-D CHANNELS=" + std::to_string(channels_) +
+                          " -D BINS=" + std::to_string(bins_) +
+                          " -D LO=" + std::to_string(lo_) +
+                          " -D HI=" + std::to_string(hi_) +
+                          " -D REPLICAS=" + std::to_string(replicas_) +
+                          " -D USE_LOCAL=" + std::to_string(useLocal_) +
+                          " -D SCAN_LOCAL=" + std::to_string(scanLocal_);
+    cl::Program &program = rt_.program("Histogram/histogram.cl", options);
+    kernel_ = cl::Kernel(program, "histogram");
+    batch_ = cl::Kernel(program, "histogramBatch");
+    cdf_ = cl::Kernel(program, "cdf");
+    applyLut_ = cl::Kernel(program, "applyLut");
+    otsu_ = cl::Kernel(program, "otsu");
+    applyThreshold_ = cl::Kernel(program, "applyThreshold");
+  }
+
+  Runtime &rt_;
+  int channels_, bins_, lo_, hi_;
+  int replicas_ = 1, useLocal_ = 1;
+  size_t local_ = 256, groups_ = 1, scanLocal_ = 256;
+  cl::Kernel kernel_, batch_, cdf_, applyLut_, otsu_, applyThreshold_;
+  cl::Buffer hist_, scan_, lut_, threshold_;
+};
+
+#endif
@@ -1,113 +1,139 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
-#define __CL_ENABLE_EXCEPTIONS
-#include <CL/cl.hpp>
-
 #include <boost/gil/extension/io/jpeg_io.hpp>
 
-#include "../utils.hpp"
+#include "../batch.hpp"
+#include "../cpu.hpp"
+#include "../runtime.hpp"
+#include "histogram.hpp"
 
 namespace gil = boost::gil;
 
-#define HIST_BINS 256
-
-int main() {
-  // auto beg = std::chrono::high_resolution_clock::now();
+int main(int argc, char *argv[]) {
+  // ./hist [bins [lo hi [frames]]], bins split [lo, hi) evenly
+  const int bins = argc > 1 ? atoi(argv[1]) : 256;
+  const int lo = argc > 3 ? atoi(argv[2]) : 0;
+  const int hi = argc > 3 ? atoi(argv[3]) : 256;
+  const size_t frames = argc > 4 ? atol(argv[4]) : 64;
 
   gil::rgb8_image_t gilImage;
   gil::jpeg_read_image("../lena.small.jpg", gilImage);
 
   const int imageElements = gilImage.width() * gilImage.height();
-  const size_t imageSize = imageElements * sizeof(int);
-  const int histogramSize = HIST_BINS * sizeof(int);
-  int *img = new int[imageElements];
-
-  for (int x = 0, i = 0; x < gilImage.width(); ++x) {
-    auto it = gilImage._view.col_begin(x);
-    for (int y = 0; y < gilImage.height(); ++y)
-      img[i++] = boost::gil::at_c<0>(it[y]);
-  }
-  // auto end = std::chrono::high_resolution_clock::now();
-  /* std::cout << "time : "
-	    << std::chrono::duration_cast<std::chrono::milliseconds>(end -
-     beg) .count()
-	    << "milli sec" << std::endl; */
+  const size_t imageSize = imageElements * 4 * sizeof(unsigned char);
+  // rgba, four bytes per pixel
+  unsigned char *img = readImage(gilImage, new unsigned char[imageSize]); // utils
 
-  int *hOutputHistogram = new int[histogramSize];
+  std::vector<int> hOutputHistogram;
+  int hThreshold[2] = {0, 0};
+  unsigned char *equalized = new unsigned char[imageSize];
 
   try {
-    // Query for platforms
-    std::vector<cl::Platform> platform;
-    cl::Platform::get(&platform);
-
-    // Get a list of devices on this platform
-    std::vector<cl::Device> devices;
-    platform[0].getDevices(CL_DEVICE_TYPE_ALL, &devices);
-
-    // Create a context for the devices
-    cl::Context context(devices);
-
-    // Create a command-queue for the first device
-    cl::CommandQueue queue = cl::CommandQueue(context, devices[0]);
-
-    // Cerate the device memory buffers
-    cl::Buffer bufInputImage = cl::Buffer(context, CL_MEM_READ_ONLY, imageSize);
-    cl::Buffer bufOutputHistogram =
-	cl::Buffer(context, CL_MEM_WRITE_ONLY, imageSize);
-
-    // Copy the input data to the input buffers using command-queue for first
-    // deivce
-    queue.enqueueWriteBuffer(bufInputImage, CL_TRUE, 0, imageSize, img);
-    queue.enqueueFillBuffer(bufOutputHistogram, 0, 0, imageSize);
-
-    // Read the program source
-    std::string sourceCode = ReadTextFile("./histogram.cl");
-    cl::Program::Sources source(
-	1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
-
-    // Create the program from the source code
-    cl::Program program = cl::Program(context, source);
-
-    // Build the program for the devices
-    try {
-      program.build(devices);
-    } catch (cl::Error error) {
-      cl::STRING_CLASS buildlog;
-      program.getBuildInfo(devices[0], CL_PROGRAM_BUILD_LOG, &buildlog);
-      std::cout << buildlog << std::endl;
+    // Shared context, queue and program registry for the selected device,
+    // without one the CPU backend runs the same chain
+    Runtime *runtime = runtimeOrCpu();
+    if (!runtime) {
+      CpuHistogram histogram(4, bins, lo, hi);
+      hOutputHistogram.resize(histogram.resultSize() / sizeof(int));
+      histogram(img, imageElements, hOutputHistogram.data());
+      histogram.equalize(img, imageElements, equalized);
+      histogram.otsu(hOutputHistogram.data());
+      std::copy(histogram.thresholdData(), histogram.thresholdData() + 2, hThreshold);
+    } else {
+      Runtime &rt = *runtime;
+      cl::Context context = rt.context();
+      cl::CommandQueue &queue = rt.queue();
+
+      // R, G, B and luma in one pass
+      Histogram histogram(rt, 4, bins, lo, hi);
+      hOutputHistogram.resize(histogram.resultSize() / sizeof(int));
+      std::cout << "[INFO] " << histogram.groups() << " groups of "
+                << histogram.localSize() << ", " << histogram.replicas()
+                << " sub-histograms each\n";
+
+      // Cerate the device memory buffers
+      cl::Buffer bufInputImage = cl::Buffer(context, CL_MEM_READ_ONLY, imageSize);
+      cl::Buffer bufOutputHistogram =
+          cl::Buffer(context, CL_MEM_READ_WRITE, histogram.resultSize());
+
+      // Copy the input data to the input buffers using command-queue for first
+      // deivce
+      queue.enqueueWriteBuffer(bufInputImage, CL_FALSE, 0, imageSize, img);
+
+      // Clear the output and count
+      histogram(queue, bufInputImage, imageElements, bufOutputHistogram);
+
+      // Copy the output data back to the host
+      queue.enqueueReadBuffer(bufOutputHistogram, CL_FALSE, 0,
+                              histogram.resultSize(), hOutputHistogram.data());
+
+      // Equalize and pick the Otsu threshold, the histogram, cdf and tables
+      // never leave the device
+      cl::Buffer bufEqualized = cl::Buffer(context, CL_MEM_WRITE_ONLY, imageSize);
+      histogram.equalize(queue, bufInputImage, imageElements, bufEqualized);
+      histogram.otsu(queue, bufOutputHistogram);
+      queue.enqueueReadBuffer(bufEqualized, CL_FALSE, 0, imageSize, equalized);
+      queue.enqueueReadBuffer(histogram.thresholdBuffer(), CL_TRUE, 0,
+                              sizeof(hThreshold), hThreshold);
+
+      // A stream of frames packed back to back, one launch per batch, every
+      // frame's histograms checked against the single image run
+      const size_t perFrame = imageSize + histogram.resultSize();
+      const size_t count = std::max<size_t>(
+          1, std::min(batchCapacity(rt.device(), perFrame, 1, false), frames)); // batch
+      cl::Buffer bufFrames(context, CL_MEM_READ_ONLY, count * imageSize);
+      cl::Buffer bufFrameHists(context, CL_MEM_READ_WRITE, count * histogram.resultSize());
+      for (size_t i = 0; i < count; i++)
+        queue.enqueueWriteBuffer(bufFrames, CL_FALSE, i * imageSize, imageSize, img);
+      std::vector<int> frameHists(count * hOutputHistogram.size());
+      bool same = true;
+      size_t batches = 0;
+
+      auto t1 = std::chrono::high_resolution_clock::now();
+      forEachBatch(frames, count, [&](size_t, size_t n) { // batch
+        histogram.batch(queue, bufFrames, imageElements, n, bufFrameHists);
+        queue.enqueueReadBuffer(bufFrameHists, CL_TRUE, 0, n * histogram.resultSize(),
+                                frameHists.data());
+        for (size_t i = 0; i < n; i++)
+          same = same && std::equal(hOutputHistogram.begin(), hOutputHistogram.end(),
+                                    frameHists.begin() + i * hOutputHistogram.size());
+        ++batches;
+      });
+      auto t2 = std::chrono::high_resolution_clock::now();
+      std::cout << "[INFO] " << frames << " frames in " << batches << " batches of up to "
+                << count << ": "
+                << std::chrono::duration<double, std::milli>(t2 - t1).count() << "ms "
+                << (same ? "Ok" : "Error") << '\n';
     }
 
-    // Create the kernel
-    cl::Kernel vecadd_kernel(program, "histogram");
-
-    // Set the kernel arguments
-    vecadd_kernel.setArg(0, bufInputImage);
-    vecadd_kernel.setArg(1, imageElements);
-    vecadd_kernel.setArg(2, bufOutputHistogram);
-
-    // Execute the kernel
-    cl::NDRange global(imageElements);
-    cl::NDRange local(256);
-    queue.enqueueNDRangeKernel(vecadd_kernel, cl::NullRange, global, local);
-    // Copy the output data back to the host
-    queue.enqueueReadBuffer(bufOutputHistogram, CL_TRUE, 0, histogramSize,
-			    hOutputHistogram);
-    queue.flush();
-
     std::cout.flush();
   } catch (cl::Error error) {
     std::cout << error.what() << "(" << error.err() << ")" << std::endl;
+    delete[] img;
+    delete[] equalized;
+    return 1;
   }
 
-  for (size_t i = 0; i < histogramSize / sizeof(int); i++)
-    std::cout << i << ": " << hOutputHistogram[i] << '\n';
+  writeImage(gilImage, equalized); // utils
+  gil::jpeg_write_view("./result.jpg", const_view(gilImage));
+  std::cout << "[INFO] otsu threshold (luma) " << hThreshold[0] << '\n';
+
+  std::cout << "bin\tR\tG\tB\tluma\n";
+  for (int i = 0; i < bins; i++) {
+    std::cout << i;
+    for (int c = 0; c < 4; c++)
+      std::cout << '\t' << hOutputHistogram[c * bins + i];
+    std::cout << '\n';
+  }
 
-  delete[] hOutputHistogram;
   delete[] img;
+  delete[] equalized;
 
   return 0;
 }
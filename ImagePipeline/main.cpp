@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+#include "../GaussianBlurFilter/blur.hpp"
+#include "../Histogram/histogram.hpp"
+#include "../Rotate/warp.hpp"
+#include "pipeline.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 7) {
+    cerr << R"(Correct way to execute this program is:
+./pipeline blur|rotate|equalize input_dir [output_dir [decoders [encoders [depth]]]]
+For example: ./pipeline blur ../frames ./out 4 2 3)";
+    return 1;
+  }
+  const string op = argv[1], inDir = argv[2];
+  const string outDir = argc > 3 ? argv[3] : "./out";
+  const size_t decoders = argc > 4 ? max(atoi(argv[4]), 1) : 2,
+               encoders = argc > 5 ? max(atoi(argv[5]), 1) : 2,
+               depth = argc > 6 ? max(atoi(argv[6]), 1) : 3;
+
+  // a missing or unreadable input_dir, or an output_dir that cannot be made
+  vector<string> inputs;
+  try {
+    for (auto &entry : fs::directory_iterator(inDir)) {
+      string ext = entry.path().extension().string();
+      transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+      if (entry.is_regular_file() && (ext == ".jpg" || ext == ".jpeg"))
+        inputs.push_back(entry.path().string());
+    }
+    fs::create_directories(outDir);
+  } catch (fs::filesystem_error &error) {
+    cerr << "[ERROR] " << error.what() << '\n';
+    return 1;
+  }
+  sort(inputs.begin(), inputs.end());
+
+  try {
+    // Shared context, queue and program registry for the selected device
+    Runtime &rt = Runtime::get();
+    rt.printInfo();
+
+    // Every primitive built before the first frame arrives
+    GaussianBlur blur(rt, 2.0f);
+    Warp warp(rt);
+    Histogram histogram(rt, 4);
+
+    ImagePipeline::Op frameOp;
+    if (op == "blur") {
+      frameOp = [&](const cl::CommandQueue &queue, const cl::Image2D &in, const cl::Image2D &out,
+		    vector<cl::Event> *events) { blur(queue, in, out, events); };
+    } else if (op == "rotate") {
+      frameOp = [&](const cl::CommandQueue &queue, const cl::Image2D &in, const cl::Image2D &out,
+		    vector<cl::Event> *events) {
+	size_t cols = in.getImageInfo<CL_IMAGE_WIDTH>(), rows = in.getImageInfo<CL_IMAGE_HEIGHT>();
+	// every frame of a size shares one compiled-in matrix
+	warp.fixed(queue, in, out, Affine::rotation(M_PI / 6, cols, rows, cols, rows), events);
+      };
+    } else if (op == "equalize") {
+      // the histogram primitives take packed pixels, so the frame goes
+      // through a buffer and back on the device
+      frameOp = [&](const cl::CommandQueue &queue, const cl::Image2D &in, const cl::Image2D &out,
+		    vector<cl::Event> *events) {
+	size_t cols = in.getImageInfo<CL_IMAGE_WIDTH>(), rows = in.getImageInfo<CL_IMAGE_HEIGHT>();
+	// pooled scratch, handed back on return; only this in-order queue uses it
+	MemoryPool::Buffer bufPixels = rt.pool().buffer(cols * rows * 4);
+	MemoryPool::Buffer bufEqualized = rt.pool().buffer(cols * rows * 4);
+	cl::array<cl::size_type, 3> origin = {0, 0, 0};
+	cl::array<cl::size_type, 3> region = {cols, rows, 1};
+	cl::Event copyIn, copyOut;
+	queue.enqueueCopyImageToBuffer(in, bufPixels, origin, region, 0, nullptr, &copyIn);
+	if (events)
+	  events->push_back(copyIn);
+	histogram.equalize(queue, bufPixels, cols * rows, bufEqualized, events);
+	queue.enqueueCopyBufferToImage(bufEqualized, out, 0, origin, region, nullptr, &copyOut);
+	if (events)
+	  events->push_back(copyOut);
+      };
+    } else {
+      cerr << "[ERROR] unknown operation " << op << '\n';
+      return 1;
+    }
+
+    ImagePipeline pipeline(rt, frameOp, decoders, encoders, depth);
+    cout << "[INFO] " << inputs.size() << " images, " << decoders << " decoders, " << encoders
+	 << " encoders, " << depth << " frames in flight\n";
+    pipeline.run(inputs, outDir).print();
+    rt.pool().stats().print(cout);
+  } catch (const cl::Error &error) {
+    std::cout << error.what() << "(" << error.err() << ")" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
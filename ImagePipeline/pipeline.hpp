@@ -0,0 +1,359 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/gil/extension/io/jpeg_io.hpp>
+
+#include "../profiling.hpp"
+#include "../runtime.hpp"
+
+/* FIFO of at most capacity items between two stages. push blocks while it
+ * is full, pop while it is empty and still open; pop returns false once the
+ * queue is closed and drained. */
+template <class T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+  void push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notFull_.wait(lock, [&] { return items_.size() < capacity_; });
+    items_.push_back(std::move(item));
+    notEmpty_.notify_one();
+  }
+
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    notEmpty_.wait(lock, [&] { return !items_.empty() || closed_; });
+    if (items_.empty())
+      return false;
+    item = std::move(items_.front());
+    items_.pop_front();
+    notFull_.notify_one();
+    return true;
+  }
+
+  /* No more pushes; poppers drain what is left */
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    notEmpty_.notify_all();
+  }
+
+private:
+  size_t capacity_;
+  bool closed_ = false;
+  std::deque<T> items_;
+  std::mutex mutex_;
+  std::condition_variable notEmpty_, notFull_;
+};
+
+/* Busy time of one stage, summed over its workers; occupancy is the share
+ * of the run the stage's workers spent working, so the bottleneck is the
+ * stage closest to 1 */
+struct StageStats {
+  std::string name;
+  size_t workers = 1;
+  double busy = 0; // milli seconds
+
+  double occupancy(double wall) const { return wall > 0 ? busy / (workers * wall) : 0; }
+};
+
+struct PipelineStats {
+  size_t frames = 0, failed = 0;
+  double wall = 0; // milli seconds
+  std::vector<StageStats> stages;
+
+  void print(std::ostream &os = std::cout) const {
+    os << "[INFO] " << frames << " frames (" << failed << " failed) in " << wall << "ms, "
+       << (wall > 0 ? frames * 1e3 / wall : 0) << " frames/s\n";
+    const StageStats *bottleneck = nullptr;
+    for (auto &s : stages) {
+      os << "[INFO]   " << std::left << std::setw(10) << s.name << std::right << std::setw(3)
+         << s.workers << " x " << std::fixed << std::setprecision(1) << std::setw(6)
+         << 100 * s.occupancy(wall) << "% busy\n"
+         << std::defaultfloat;
+      if (!bottleneck || s.occupancy(wall) > bottleneck->occupancy(wall))
+        bottleneck = &s;
+    }
+    if (bottleneck)
+      os << "[INFO]   bottleneck: " << bottleneck->name << '\n';
+  }
+};
+
+/*
+ * Streams JPEG files through a device image operation: a pool of decode
+ * threads, then upload, op and download on three queues chained by events,
+ * then a pool of encode threads. Stages hand frames over through bounded
+ * queues of `depth` frames, so a slow stage stalls the ones before it
+ * instead of piling up decoded images, and at most `depth` frames are on
+ * the device, each in its own slot of input and output images. Frames may
+ * have any size (slot images go back to the runtime's pool when it
+ * changes) and finish in any order.
+ *
+ * op gets (queue, in, out, events) like the Convolution and Warp calls,
+ * enqueues on queue and appends its events; out has in's size and format
+ * (CL_RGBA / CL_UNORM_INT8).
+ */
+class ImagePipeline {
+public:
+  using Op = std::function<void(const cl::CommandQueue &, const cl::Image2D &,
+                                const cl::Image2D &, std::vector<cl::Event> *)>;
+
+  ImagePipeline(Runtime &rt, Op op, size_t decoders = 2, size_t encoders = 2, size_t depth = 3)
+      : rt_(rt), op_(std::move(op)), decoders_(std::max<size_t>(decoders, 1)),
+        encoders_(std::max<size_t>(encoders, 1)), depth_(std::max<size_t>(depth, 1)),
+        upload_(rt.createQueue(CL_QUEUE_PROFILING_ENABLE)),
+        compute_(rt.createQueue(CL_QUEUE_PROFILING_ENABLE)),
+        download_(rt.createQueue(CL_QUEUE_PROFILING_ENABLE)), slots_(depth_) {}
+
+  /* Every input file processed and written to outDir under its own name.
+   * Files that fail to decode or encode are counted and skipped; a device
+   * error stops the run and is rethrown once every thread and every
+   * enqueued command has finished. */
+  PipelineStats run(const std::vector<std::string> &inputs, const std::string &outDir) {
+    BoundedQueue<std::string> paths(inputs.size());
+    BoundedQueue<FramePtr> decoded(depth_), inflight(depth_), done(depth_);
+    for (auto &path : inputs)
+      paths.push(path);
+    paths.close();
+
+    stats_ = PipelineStats();
+    stats_.stages = {{"decode", decoders_}, {"submit", 1}, {"upload", 1},
+                     {"kernel", 1},         {"download", 1}, {"encode", encoders_}};
+    error_ = nullptr;
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> decoders, encoders;
+    for (size_t i = 0; i < decoders_; ++i)
+      decoders.emplace_back([&] { decode(paths, decoded); });
+    std::thread submitter([&] { submit(decoded, inflight); });
+    std::thread retirer([&] { retire(inflight, done); });
+    for (size_t i = 0; i < encoders_; ++i)
+      encoders.emplace_back([&] { encode(done, outDir); });
+
+    // close every queue once all of its producers are gone
+    for (auto &t : decoders)
+      t.join();
+    decoded.close();
+    submitter.join();
+    inflight.close();
+    retirer.join();
+    done.close();
+    for (auto &t : encoders)
+      t.join();
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    stats_.wall = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    if (error_) {
+      drain();
+      std::rethrow_exception(error_);
+    }
+    return stats_;
+  }
+
+private:
+  enum { Decode, Submit, Upload, Kernel, Download, Encode };
+
+  struct Frame {
+    std::string path;
+    boost::gil::rgba8_image_t image, result;
+    cl::Event uploaded, downloaded;
+    std::vector<cl::Event> kernels;
+  };
+  using FramePtr = std::unique_ptr<Frame>;
+
+  /* Device images one frame in flight uses, leased from the runtime's pool,
+   * and the events the next frame in the slot must wait for before
+   * overwriting them */
+  struct Slot {
+    MemoryPool::Image in, out;
+    size_t width = 0, height = 0;
+    cl::Event computed, downloaded;
+  };
+
+  static double since(std::chrono::high_resolution_clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t)
+        .count();
+  }
+
+  void addBusy(int stage, double ms, size_t frames = 0, size_t failed = 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.stages[stage].busy += ms;
+    stats_.frames += frames;
+    stats_.failed += failed;
+  }
+
+  void fail(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_)
+      error_ = error;
+  }
+
+  bool failed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_ != nullptr;
+  }
+
+  /* Waits for everything enqueued so far, failed commands included, so
+   * the frames they read or write can be released */
+  void drain() {
+    for (cl::CommandQueue *queue : {&upload_, &compute_, &download_})
+      try {
+        queue->finish();
+      } catch (cl::Error &) {
+      }
+  }
+
+  void decode(BoundedQueue<std::string> &paths, BoundedQueue<FramePtr> &decoded) {
+    std::string path;
+    double busy = 0;
+    size_t failed = 0;
+    while (paths.pop(path)) {
+      auto t = std::chrono::high_resolution_clock::now();
+      FramePtr frame(new Frame);
+      frame->path = path;
+      try {
+        boost::gil::jpeg_read_and_convert_image(path, frame->image);
+      } catch (std::exception &e) {
+        std::cerr << "[WARN] cannot decode " << path << ": " << e.what() << '\n';
+        frame.reset();
+        ++failed;
+      }
+      busy += since(t);
+      if (frame)
+        decoded.push(std::move(frame));
+    }
+    addBusy(Decode, busy, 0, failed);
+  }
+
+  /* Enqueues upload, op and download of every frame; after a device error
+   * the remaining frames are only drained, so no stage blocks forever */
+  void submit(BoundedQueue<FramePtr> &decoded, BoundedQueue<FramePtr> &inflight) {
+    const cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+    FramePtr frame;
+    size_t next = 0;
+    double busy = 0;
+    while (decoded.pop(frame)) {
+      if (failed())
+        continue;
+      auto t = std::chrono::high_resolution_clock::now();
+      try {
+        Slot &slot = slots_[next];
+        next = (next + 1) % slots_.size();
+
+        auto src = boost::gil::const_view(frame->image);
+        size_t width = src.width(), height = src.height();
+        if (slot.width != width || slot.height != height) {
+          if (slot.downloaded())
+            slot.downloaded.wait(); // the slot's last frame is done with them
+          // a size seen before comes back out of the pool
+          slot.in = rt_.pool().image(format, width, height, CL_MEM_READ_ONLY);
+          slot.out = rt_.pool().image(format, width, height, CL_MEM_WRITE_ONLY);
+          slot.width = width;
+          slot.height = height;
+        }
+        frame->result = boost::gil::rgba8_image_t(width, height);
+        auto dst = boost::gil::view(frame->result);
+        cl::array<cl::size_type, 3> origin = {0, 0, 0};
+        cl::array<cl::size_type, 3> region = {width, height, 1};
+
+        // in is free once the slot's last op ran, out once it was read
+        std::vector<cl::Event> waits;
+        if (slot.computed())
+          waits.push_back(slot.computed);
+        upload_.enqueueWriteImage(slot.in, CL_FALSE, origin, region, src.pixels().row_size(), 0,
+                                  boost::gil::interleaved_view_get_raw_data(src),
+                                  waits.empty() ? nullptr : &waits, &frame->uploaded);
+        waits = {frame->uploaded};
+        if (slot.downloaded())
+          waits.push_back(slot.downloaded);
+        compute_.enqueueBarrierWithWaitList(&waits);
+        op_(compute_, slot.in, slot.out, &frame->kernels);
+        if (frame->kernels.empty())
+          throw cl::Error(CL_INVALID_OPERATION, "ImagePipeline: op enqueued nothing");
+        waits = {frame->kernels.back()};
+        download_.enqueueReadImage(slot.out, CL_FALSE, origin, region, dst.pixels().row_size(), 0,
+                                   boost::gil::interleaved_view_get_raw_data(dst), &waits,
+                                   &frame->downloaded);
+        upload_.flush();
+        compute_.flush();
+        download_.flush();
+        slot.computed = frame->kernels.back();
+        slot.downloaded = frame->downloaded;
+      } catch (...) {
+        // the upload and download may be queued already, frame must outlive them
+        fail(std::current_exception());
+        drain();
+        continue;
+      }
+      busy += since(t);
+      inflight.push(std::move(frame));
+    }
+    addBusy(Submit, busy);
+  }
+
+  /* Waits for each frame's download in submission order and files the
+   * device time of its commands */
+  void retire(BoundedQueue<FramePtr> &inflight, BoundedQueue<FramePtr> &done) {
+    FramePtr frame;
+    while (inflight.pop(frame)) {
+      try {
+        frame->downloaded.wait();
+        addBusy(Upload, eventMillis(frame->uploaded));
+        addBusy(Kernel, eventsMillis(frame->kernels));
+        addBusy(Download, eventMillis(frame->downloaded));
+      } catch (...) {
+        fail(std::current_exception());
+        drain();
+        continue;
+      }
+      done.push(std::move(frame));
+    }
+  }
+
+  void encode(BoundedQueue<FramePtr> &done, const std::string &outDir) {
+    FramePtr frame;
+    double busy = 0;
+    size_t frames = 0, failed = 0;
+    while (done.pop(frame)) {
+      auto t = std::chrono::high_resolution_clock::now();
+      std::string name = frame->path.substr(frame->path.find_last_of('/') + 1);
+      try {
+        boost::gil::jpeg_write_view(outDir + "/" + name,
+                                    boost::gil::color_converted_view<boost::gil::rgb8_pixel_t>(
+                                        boost::gil::const_view(frame->result)));
+        ++frames;
+      } catch (std::exception &e) {
+        std::cerr << "[WARN] cannot encode " << name << ": " << e.what() << '\n';
+        ++failed;
+      }
+      busy += since(t);
+    }
+    addBusy(Encode, busy, frames, failed);
+  }
+
+  Runtime &rt_;
+  Op op_;
+  size_t decoders_, encoders_, depth_;
+  cl::CommandQueue upload_, compute_, download_;
+  std::vector<Slot> slots_;
+
+  std::mutex mutex_;
+  PipelineStats stats_;
+  std::exception_ptr error_;
+};
+
+#endif
@@ -1,6 +1,3 @@
-#define CL_HPP_ENABLE_EXCEPTIONS
-#define CL_HPP_TARGET_OPENCL_VERSION 200
-
 #include <algorithm>
 #include <cassert>
 #include <chrono>
@@ -12,22 +9,17 @@
 #include <string>
 #include <vector>
 
-#include <CL/cl2.hpp>
+#include "../cpu.hpp"
+#include "../host_buffer.hpp"
+#include "../runtime.hpp"
+#include "../scheduler.hpp"
+#include "stream.hpp"
 
 // #include "./h/ocl.err.h"
 // #include "./h/ocl.query.h"
 
 #define RANDOM_NUMBER_MAX 1000
 
-static inline auto ReadTextFile(const char *s)
-{
-  std::ifstream mfile(s);
-  std::string content((std::istreambuf_iterator<char>(mfile)),
-                      (std::istreambuf_iterator<char>()));
-  mfile.close();
-  return content;
-}
-
 static inline auto rand_gen()
 {
   std::random_device rd;
@@ -42,9 +34,10 @@ int main(int argc, char* argv[])
 
   ios_base::sync_with_stdio(false);
 
-  if (argc != 5) {
+  if (argc < 5 || argc > 7) {
     cerr << R"(Correct way to execute this program is:
-./multi_cq platform-num data_size workgroup_size command_queue_count
+./multi_cq platform-num data_size workgroup_size command_queue_count [rounds [stream_chunk]]
+platform-num -1 spreads the work over every device, command_queue_count is per device
 For example: ./multi_cq 0 10000 512 4 )";
     return 1;
   }
@@ -54,11 +47,14 @@ For example: ./multi_cq 0 10000 512 4 )";
   int platform_num    {atoi(argv[1])},
       n_elem          {atoi(argv[2])},
       local_work_size {atoi(argv[3])},
-      cq_count        {atoi(argv[4])}; // cq == command_queue
+      cq_count        {atoi(argv[4])}, // cq == command_queue
+      rounds          {argc > 5 ? max(atoi(argv[5]), 1) : 3},
+      stream_chunk    {argc > 6 ? max(atoi(argv[6]), 1) : 1 << 18};
 
   vector<int32_t> h_data(n_elem); // host, data
   vector<int32_t> h_output(n_elem); // host, output
   vector<int32_t> d_output(n_elem); // device, output
+  vector<int32_t> s_output(n_elem); // streamed, output
 
   // fill A with random doubles
   uniform_int_distribution<> dis(0, RANDOM_NUMBER_MAX);
@@ -70,97 +66,170 @@ For example: ./multi_cq 0 10000 512 4 )";
   transform(h_data.begin(), h_data.end(), h_output.begin(), OPERATION);  // cpp = GOD
   auto t2_serial = chrono::high_resolution_clock::now();
 
+  // same thing on every core, the fair baseline
+  vector<int32_t> c_output(n_elem); // cpu backend, output
+  auto t1_cpu = chrono::high_resolution_clock::now();
+  cpuVectorOperation(h_data.data(), c_output.data(), n_elem);
+  auto t2_cpu = chrono::high_resolution_clock::now();
 
-  // Initialize OpenCL
-  std::vector<cl::Platform> platforms;
-  cl::Platform::get(&platforms);
-  assert((size_t)platform_num < platforms.size());
-  auto platform = platforms[platform_num]; // here you can select between Intel, AMD or Nvidia
-  std::vector<cl::Device> devices;
-  platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-  auto device = devices.front(); // here you can select between different Accelerators
-  auto context = cl::Context(device);
 
-  // Read the program source
-  cl::Program program = cl::Program(context, ReadTextFile("./kernel.cl"), CL_FALSE);
+  // One runtime per device; -1 takes every platform, CLP_DEVICE_TYPE filters
+  DeviceSelector selector = DeviceSelector::fromEnv();
+  vector<cl::Device> devices;
   try {
+    devices = listDevices(platform_num, selector.type, selector.name);
+    if (devices.empty()) {
+      selector.platform = platform_num;
+      devices.push_back(selectDevice(selector));
+    }
+  } catch (cl::Error &error) {
+    cout << "[WARN] no OpenCL device (" << error.what() << "), CPU backend only\n";
+  }
+
+  double serial_time = chrono::duration<double, milli>(t2_serial - t1_serial).count(),
+         cpu_time    = chrono::duration<double, milli>(t2_cpu - t1_cpu).count();
+  bool cpu_ok = equal(h_output.begin(), h_output.end(), c_output.begin());
+  if (devices.empty()) {
+    cout << fixed << showpoint;
+    cout.precision(6);
+    cout << "[INFO] Serial time:\t" << serial_time << "ms"
+         << "\n[INFO] CPU time:\t"  << cpu_time    << "ms (" << cpuThreads() << " threads) "
+         << (cpu_ok ? "Ok" : "Error") << endl;
+    return cpu_ok ? 0 : 1;
+  }
+  // CPU devices spanning several NUMA nodes become one sub-device per node
+  vector<unique_ptr<Runtime>> runtimes;
+  vector<Runtime *> lanes_rt;
+  for (auto &device : devices)
+    for (auto &part : partitionFromEnv(device)) {
+      runtimes.emplace_back(new Runtime(part));
+      runtimes.back()->printInfo();
+      lanes_rt.push_back(runtimes.back().get());
+    }
+
+  // Build the program
 #ifndef OPENCL_1
-    program.build("-cl-std=CL2.0 -cl-mad-enable -cl-fast-relaxed-math");
+  const char *build_options = "-cl-std=CL2.0 -cl-mad-enable -cl-fast-relaxed-math";
 #else
-    cout << "[WARN] Compling kernel in opencl 1.x mode\n";
-    program.build("-cl-mad-enable  -cl-fast-relaxed-math");
+  cout << "[WARN] Compling kernel in opencl 1.x mode\n";
+  const char *build_options = "-cl-mad-enable  -cl-fast-relaxed-math";
 #endif
+  try {
+    for (auto *rt : lanes_rt)
+      rt->program("./kernel.cl", build_options);
   } catch (...) {
-#ifndef OPENCL_1
-    // Print build info for all devices
-    cl_int buildErr = CL_SUCCESS;
-    auto buildInfo = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(&buildErr);
-    for (auto &pair : buildInfo) {
-      cerr << pair.second << endl << endl;
-    }
-#else
     cerr << "building program failed" << endl;
-#endif
     return 1;
   }
 
-  // Select kernel
-  auto kernel = cl::Kernel(program, "vector_operation");
-
-  // Cerate the device memory buffers
-  auto buf_src = cl::Buffer
-    (context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, h_data.size() * sizeof(h_data[0]));
-  auto buf_target = cl::Buffer
-    (context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, d_output.size() * sizeof(d_output[0]));
-
-  // Set the kernel arguments
-  kernel.setArg(0, buf_src);
-  kernel.setArg(1, buf_target);
-
-  vector<cl::CommandQueue> queues(cq_count);
-  generate(queues.begin(), queues.end(), [&](){return cl::CommandQueue(context, device);}); // cpp = 2xGOD
-
-  auto t1_ocl = chrono::high_resolution_clock::now();
-
-  cl_int ocl_err {CL_SUCCESS};
-  int cq_elem_count = n_elem / cq_count;
-  int cq_elem_size = cq_elem_count * sizeof(h_data[0]);
-  for (int i = 0; i < cq_count; ++i) {
-    int offset = i * cq_elem_count;
-    int offset_with_size = i * cq_elem_size;
-
-    cl::NDRange global(cq_elem_count);
-    cl::NDRange local(local_work_size);
-    cl::NDRange offset_ndrange(offset);
-    vector<cl::Event> ndrange_deps(1), read_deps(1);
-
-    // 3rd(offset) param is on device, 4th(amount) and 5th(start void ptr) are on host
-    ocl_err |= queues[i].enqueueWriteBuffer
-      (buf_src, CL_FALSE, offset_with_size, cq_elem_size, h_data.data() + offset, nullptr, ndrange_deps.data());
-    ocl_err |= queues[i].enqueueNDRangeKernel
-      (kernel, offset_ndrange, global, local, &ndrange_deps, read_deps.data());
-    ocl_err |= queues[i].enqueueReadBuffer
-      (buf_target, CL_FALSE, offset_with_size, cq_elem_size, d_output.data() + offset, &read_deps, nullptr);
+  // cq_count queues per device, 0 = one; shares start from compute units
+  WorkSplitter splitter(lanes_rt, max(cq_count, 1));
+  const size_t lane_count = splitter.lanes().size();
+
+  // Per-lane kernel and chunk-sized buffers, grown when a lane's share grows
+  // and first touched by the lane's own (sub-)device
+  vector<cl::Kernel> kernels;
+  for (auto &lane : splitter.lanes())
+    kernels.push_back(lane.rt->kernel("./kernel.cl", "vector_operation", build_options));
+  vector<cl::Buffer> buf_src(lane_count), buf_target(lane_count);
+  vector<size_t> buf_count(lane_count, 0);
+
+  // The chunk lands at offset 0 of its lane's buffers, the kernel needs no offset
+  auto enqueue = [&](const WorkSplitter::Lane &lane, const WorkSplitter::Chunk &chunk,
+                     vector<cl::Event> &events) {
+    size_t i = chunk.lane, bytes = chunk.count * sizeof(h_data[0]);
+    if (chunk.count > buf_count[i]) {
+      const cl::Context &context = lane.rt->context();
+      buf_src[i] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, bytes);
+      buf_target[i] = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, bytes);
+      buf_count[i] = chunk.count;
+      firstTouch(lane.queue, buf_src[i], bytes);
+      firstTouch(lane.queue, buf_target[i], bytes);
+    }
+    kernels[i].setArg(0, buf_src[i]);
+    kernels[i].setArg(1, buf_target[i]);
+
+    // the kernel has no bounds check, so an uneven chunk runs with the
+    // largest local size that divides it, or the runtime's when that is small
+    size_t fit = fitLocal(chunk.count, max(local_work_size, 0));
+    cl::NDRange local = fit ? cl::NDRange(fit) : cl::NullRange;
+    cl::Event write, run, read;
+    lane.queue.enqueueWriteBuffer(buf_src[i], CL_FALSE, 0, bytes,
+                                  h_data.data() + chunk.offset, nullptr, &write);
+    lane.queue.enqueueNDRangeKernel(kernels[i], cl::NullRange, cl::NDRange(chunk.count), local,
+                                    nullptr, &run);
+    lane.queue.enqueueReadBuffer(buf_target[i], CL_FALSE, 0, bytes,
+                                 d_output.data() + chunk.offset, nullptr, &read);
+    events.insert(events.end(), {write, run, read});
+  };
+
+  // Every round rebalances from the throughput the lanes reached in the last one
+  chrono::high_resolution_clock::time_point t1_ocl, t2_ocl;
+  for (int round = 0; round < rounds; ++round) {
+    t1_ocl = chrono::high_resolution_clock::now();
+    splitter.run(n_elem, enqueue, max(local_work_size, 1));
+    t2_ocl = chrono::high_resolution_clock::now();
+
+    cout << "[INFO] Round " << round << ':';
+    for (auto &lane : splitter.lanes())
+      cout << "  " << lane.rt->device().getInfo<CL_DEVICE_NAME>() << ' ' << lane.millis
+           << "ms (next share " << lane.share * 100 << "%)";
+    cout << '\n';
   }
-  for_each(queues.begin(), queues.end(), [&](auto& q){ocl_err |= q.finish();});
-
-  auto t2_ocl = chrono::high_resolution_clock::now();
 
+  // The same map as a stream of chunks through a pinned ring on the first device
+  StreamMap stream(*lanes_rt.front(), kernels.front(), min(stream_chunk, max(n_elem, 1)),
+                   sizeof(int32_t), sizeof(int32_t));
+  auto t1_stream = chrono::high_resolution_clock::now();
+  stream(h_data.data(), s_output.data(), n_elem);
+  auto t2_stream = chrono::high_resolution_clock::now();
+
+  // One launch straight on host-visible memory of the first device, in
+  // every memory mode it runs
+  Runtime &first = *lanes_rt.front();
+  struct SharedRun { MemMode mode; double ms; bool ok; };
+  vector<SharedRun> shared_runs;
+  for (MemMode mode : memModes(first.device())) {
+    HostBuffer<int32_t> shared_src(first, n_elem, mode, CL_MEM_READ_ONLY);
+    HostBuffer<int32_t> shared_dst(first, n_elem, mode, CL_MEM_WRITE_ONLY);
+    copy(h_data.begin(), h_data.end(), shared_src.data());
+    auto t1_shared = chrono::high_resolution_clock::now();
+    shared_src.toDevice(first.queue());
+    shared_dst.toDevice(first.queue());
+    kernels.front().setArg(0, shared_src.buffer());
+    kernels.front().setArg(1, shared_dst.buffer());
+    first.queue().enqueueNDRangeKernel(kernels.front(), cl::NullRange, cl::NDRange(n_elem));
+    shared_dst.toHost(first.queue());
+    auto t2_shared = chrono::high_resolution_clock::now();
+    shared_runs.push_back({mode, chrono::duration<double, milli>(t2_shared - t1_shared).count(),
+                           equal(h_output.begin(), h_output.end(), shared_dst.data())});
+  }
 
-  double serial_time = chrono::duration<double, milli>(t2_serial - t1_serial).count() * 10,
-         ocl_time    = chrono::duration<double, milli>(t2_ocl - t1_ocl).count() * 10;
+  double ocl_time    = chrono::duration<double, milli>(t2_ocl - t1_ocl).count(),
+         stream_time = chrono::duration<double, milli>(t2_stream - t1_stream).count();
   cout << fixed << showpoint;
   cout.precision(6);
   cout << "[INFO] Serial time:\t"   << serial_time << "ms"
-       << "\n[INFO] OpenCL time:\t" << ocl_time    << "ms" <<  '\n';
+       << "\n[INFO] CPU time:\t"    << cpu_time    << "ms (" << cpuThreads() << " threads) "
+       << (cpu_ok ? "Ok" : "Error")
+       << "\n[INFO] OpenCL time:\t" << ocl_time    << "ms (last round, " << lane_count << " queues)"
+       << "\n[INFO] Stream time:\t" << stream_time << "ms (" << stream.chunk() << " element chunks, "
+       << stream.depth() << " in flight)\n";
+  for (auto &shared : shared_runs)
+    cout << "[INFO] Shared time:\t" << shared.ms << "ms (" << memModeName(shared.mode) << ") "
+         << (shared.ok ? "Ok" : "Error") << '\n';
+
+  if (!cpu_ok)
+    cout << "[FAIL]  CPU backend output differs from the host\n";
+  if (!equal(h_output.begin(), h_output.end(), s_output.begin()))
+    cout << "[FAIL]  Streamed output differs from the host\n";
 
   auto location = mismatch(h_output.begin(), h_output.end(), d_output.begin());  // cpp = GOD
-  // TODO: ooutput oclerr
-  cout << "ocl_err status = " << ocl_err << '\n';
   if (location.first == h_output.end()) {
     cout.precision(2);
     cout << "[INFO] Test PASS! No mismatch found!\n" << "[INFO] Achived speedup of "
-         << serial_time / ocl_time << "x" << endl;
+         << serial_time / ocl_time << "x over serial, "
+         << cpu_time / ocl_time << "x over the CPU backend" << endl;
   }
   else
     cout << "[FAIL]  There is a mismatch at location " << (location.first - h_output.begin())
@@ -0,0 +1,126 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "../runtime.hpp"
+
+/*
+ * Streaming map: pushes a stream of chunks through kernel(src, dst), one
+ * work-item per element, with a ring of `depth` slots. Every slot owns a
+ * pinned (CL_MEM_ALLOC_HOST_PTR, mapped once) staging pair and a device
+ * buffer pair. Uploads, kernels and downloads go to three queues chained
+ * by events, so chunk k+1 uploads while chunk k computes and chunk k-1
+ * downloads. A push that finds every slot in flight first waits for the
+ * oldest one and hands its output to that chunk's sink, so at most
+ * `depth` chunks are ever queued. Slot memory is leased from the runtime's
+ * pool, so a new StreamMap of the same shape allocates nothing.
+ */
+class StreamMap {
+public:
+  /* Receives a finished chunk; out is pinned memory that is reused after
+   * the call returns */
+  using Sink = std::function<void(const void *out, size_t count)>;
+
+  StreamMap(Runtime &rt, const cl::Kernel &kernel, size_t chunk, size_t inSize, size_t outSize,
+            size_t depth = 3)
+      : kernel_(kernel), chunk_(chunk), inSize_(inSize), outSize_(outSize),
+        upload_(rt.createQueue()), compute_(rt.createQueue()), download_(rt.createQueue()) {
+    for (size_t i = 0; i < std::max<size_t>(depth, 1); ++i) {
+      Slot slot;
+      slot.pinnedIn = rt.pool().pinned(chunk_ * inSize_);
+      slot.pinnedOut = rt.pool().pinned(chunk_ * outSize_);
+      slot.in = rt.pool().buffer(chunk_ * inSize_, CL_MEM_READ_ONLY);
+      slot.out = rt.pool().buffer(chunk_ * outSize_, CL_MEM_WRITE_ONLY);
+      slots_.push_back(std::move(slot));
+    }
+  }
+
+  /* The slots' memory goes back to the pool once nothing uses it */
+  ~StreamMap() {
+    try {
+      drain();
+    } catch (cl::Error &) { // nothing sensible to do while unwinding
+    }
+  }
+
+  StreamMap(const StreamMap &) = delete;
+  StreamMap &operator=(const StreamMap &) = delete;
+
+  size_t chunk() const { return chunk_; }
+  size_t depth() const { return slots_.size(); }
+
+  /* Queues count (<= chunk()) elements of in; returns as soon as in may be
+   * reused, blocking only while the ring is full */
+  void push(const void *in, size_t count, Sink sink) {
+    if (count > chunk_)
+      throw cl::Error(CL_INVALID_VALUE, "StreamMap: chunk too large");
+    Slot &slot = slots_[next_];
+    retire(slot);
+    next_ = (next_ + 1) % slots_.size();
+    if (count == 0)
+      return;
+
+    std::memcpy(slot.pinnedIn.data(), in, count * inSize_);
+    std::vector<cl::Event> uploaded(1), computed(1);
+    upload_.enqueueWriteBuffer(slot.in, CL_FALSE, 0, count * inSize_, slot.pinnedIn.data(), nullptr,
+                               &uploaded[0]);
+    kernel_.setArg(0, slot.in.get());
+    kernel_.setArg(1, slot.out.get());
+    compute_.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(count), cl::NullRange,
+                                  &uploaded, &computed[0]);
+    download_.enqueueReadBuffer(slot.out, CL_FALSE, 0, count * outSize_, slot.pinnedOut.data(),
+                                &computed, &slot.done);
+    for (auto *queue : {&upload_, &compute_, &download_})
+      queue->flush();
+
+    slot.count = count;
+    slot.sink = std::move(sink);
+  }
+
+  /* Waits for every queued chunk, oldest first */
+  void drain() {
+    for (size_t i = 0; i < slots_.size(); ++i)
+      retire(slots_[(next_ + i) % slots_.size()]);
+  }
+
+  /* out[0, n) = map of in[0, n), streamed chunk by chunk */
+  void operator()(const void *in, void *out, size_t n) {
+    auto src = static_cast<const char *>(in);
+    auto dst = static_cast<char *>(out);
+    for (size_t offset = 0; offset < n; offset += chunk_) {
+      char *to = dst + offset * outSize_;
+      push(src + offset * inSize_, std::min(chunk_, n - offset),
+           [this, to](const void *data, size_t count) { std::memcpy(to, data, count * outSize_); });
+    }
+    drain();
+  }
+
+private:
+  struct Slot {
+    MemoryPool::Buffer pinnedIn, pinnedOut, in, out;
+    cl::Event done;
+    size_t count = 0;
+    Sink sink;
+  };
+
+  void retire(Slot &slot) {
+    if (!slot.count)
+      return;
+    slot.done.wait();
+    size_t count = slot.count;
+    slot.count = 0;
+    slot.sink(slot.pinnedOut.data(), count);
+  }
+
+  cl::Kernel kernel_;
+  size_t chunk_, inSize_, outSize_;
+  cl::CommandQueue upload_, compute_, download_;
+  std::vector<Slot> slots_;
+  size_t next_ = 0;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+#include "radix.hpp"
+
+// stable, so the carried indices are comparable too
+template <class K> void sort_Host(std::vector<K> &keys, std::vector<cl_uint> &values) {
+  std::vector<cl_uint> order(keys.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](cl_uint a, cl_uint b) { return keys[a] < keys[b]; });
+  std::vector<K> k(keys.size());
+  std::vector<cl_uint> v(keys.size());
+  for (size_t i = 0; i < order.size(); i++)
+    k[i] = keys[order[i]], v[i] = values[order[i]];
+  keys.swap(k);
+  values.swap(v);
+}
+
+static double millis(std::chrono::high_resolution_clock::time_point t1,
+                     std::chrono::high_resolution_clock::time_point t2) {
+  return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+static const char *verdict(bool ok) { return ok ? "Ok" : "Error"; }
+
+/* Key-value sort of n random keys, checked against the host */
+template <class K, class Gen>
+static void check(Runtime &rt, const char *name, size_t n, Gen gen) {
+  std::vector<K> keys(n), dKeys(n);
+  std::vector<cl_uint> values(n), dValues(n);
+  std::generate(keys.begin(), keys.end(), gen);
+  std::iota(values.begin(), values.end(), 0);
+
+  cl::CommandQueue &queue = rt.queue();
+  cl::Buffer bufKeys(rt.context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, n * sizeof(K), keys.data());
+  cl::Buffer bufValues(rt.context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, n * sizeof(cl_uint),
+                       values.data());
+
+  RadixSort<K> sort(rt);
+  sort(queue, bufKeys, bufValues, n); // builds and warms up, then sort again from the copy
+  queue.enqueueWriteBuffer(bufKeys, CL_TRUE, 0, n * sizeof(K), keys.data());
+  queue.enqueueWriteBuffer(bufValues, CL_TRUE, 0, n * sizeof(cl_uint), values.data());
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  sort(queue, bufKeys, bufValues, n);
+  queue.finish();
+  auto t2 = std::chrono::high_resolution_clock::now();
+  queue.enqueueReadBuffer(bufKeys, CL_TRUE, 0, n * sizeof(K), dKeys.data());
+  queue.enqueueReadBuffer(bufValues, CL_TRUE, 0, n * sizeof(cl_uint), dValues.data());
+
+  auto t3 = std::chrono::high_resolution_clock::now();
+  sort_Host(keys, values);
+  auto t4 = std::chrono::high_resolution_clock::now();
+
+  std::cout << "[INFO] " << name << ": device " << millis(t1, t2) << "ms, host "
+            << millis(t3, t4) << "ms " << verdict(dKeys == keys && dValues == values) << '\n';
+}
+
+int main(int argc, char *argv[]) {
+  // ./radix [elements [segments]]
+  const size_t n = argc > 1 ? atol(argv[1]) : 1 << 20;
+  const size_t segments = argc > 2 ? atol(argv[2]) : 64;
+  if (segments == 0) {
+    std::cerr << R"(Correct way to execute this program is:
+./radix [elements [segments]]
+segments must be at least 1. For example: ./radix 1000000 64)";
+    return 1;
+  }
+
+  std::mt19937_64 gen(1317);
+  try {
+    // Shared context, queue and program registry for the selected device
+    Runtime &rt = Runtime::get();
+    rt.printInfo();
+
+    check<cl_uint>(rt, "uint", n, [&]() { return (cl_uint)gen(); });
+    check<cl_ulong>(rt, "ulong", n, [&]() { return (cl_ulong)gen(); });
+    check<cl_int>(rt, "int (few distinct)", n, [&]() { return (cl_int)(gen() % 100) - 50; });
+    check<cl_float>(rt, "float", n, [&]() { return (cl_float)((cl_int)gen() / 1e6); });
+
+    // segmented: every segment sorted on its own
+    std::vector<cl_uint> keys(n), offsets(segments + 1);
+    std::generate(keys.begin(), keys.end(), [&]() { return (cl_uint)gen(); });
+    for (size_t s = 0; s <= segments; s++)
+      offsets[s] = (cl_uint)(n * s / segments);
+    cl::Buffer bufKeys(rt.context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, n * sizeof(cl_uint),
+                       keys.data());
+    cl::Buffer bufOffsets(rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                          offsets.size() * sizeof(cl_uint), offsets.data());
+
+    RadixSort<cl_uint> sort(rt);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    sort.segmented(rt.queue(), bufKeys, nullptr, n, bufOffsets, segments);
+    rt.queue().finish();
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    std::vector<cl_uint> dKeys(n);
+    rt.queue().enqueueReadBuffer(bufKeys, CL_TRUE, 0, n * sizeof(cl_uint), dKeys.data());
+    for (size_t s = 0; s < segments; s++)
+      std::sort(keys.begin() + offsets[s], keys.begin() + offsets[s + 1]);
+    std::cout << "[INFO] segmented (" << segments << "): device " << millis(t1, t2) << "ms "
+              << verdict(dKeys == keys) << '\n';
+  } catch (const cl::Error &error) {
+    std::cout << error.what() << "(" << error.err() << ")" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * LSD radix sort, RADIX_BITS per pass. The host prepends:
+ *   K            key type
+ *   ORDERED(k)   unsigned integer whose order is the order of k
+ *   WG           work-group size, a power of two
+ *   ITEMS        WG-sized chunks per group; a group owns TILE keys
+ * A pass counts the digits of every tile (countDigits), the host scans
+ * the digit-major counts, and scatter moves each tile's keys to the
+ * scanned offsets. Within a chunk the keys are ordered by a stable split
+ * on every digit bit, so equal digits keep their input order.
+ */
+
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+#define TILE (WG * ITEMS)
+#define DIGIT(k, shift) ((uint)((ORDERED(k) >> (shift)) & (RADIX - 1)))
+
+/* hist[d * groups + g] = keys of tile g with digit d */
+__kernel void countDigits(__global const K *keys, ulong n, uint shift, __global uint *hist) {
+  __local uint counts[RADIX];
+  const uint lid = get_local_id(0), g = get_group_id(0), groups = get_num_groups(0);
+
+  for (uint d = lid; d < RADIX; d += WG)
+    counts[d] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const size_t base = g * (size_t)TILE;
+  for (uint c = 0; c < ITEMS; ++c) {
+    size_t i = base + c * WG + lid;
+    if (i < n)
+      atomic_inc(&counts[DIGIT(keys[i], shift)]);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint d = lid; d < RADIX; d += WG)
+    hist[d * groups + g] = counts[d];
+}
+
+/* Exclusive sum of f over the group, *total gets the whole sum */
+uint scanFlags(uint f, __local uint *scratch, uint *total) {
+  const uint lid = get_local_id(0);
+  uint out = 0, in;
+  scratch[lid] = f;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint s = 1; s < WG; s <<= 1) {
+    out = 1 - out;
+    in = 1 - out;
+    scratch[out * WG + lid] =
+        lid >= s ? scratch[in * WG + lid - s] + scratch[in * WG + lid] : scratch[in * WG + lid];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  *total = scratch[out * WG + WG - 1];
+  uint excl = scratch[out * WG + lid] - f;
+  barrier(CLK_LOCAL_MEM_FENCE); // scratch is reused by the next call
+  return excl;
+}
+
+/*
+ * keysOut[offsets[d * groups + g] + rank] = key, rank counting the keys of
+ * digit d before it in tile g. Keys past n sort last in the final chunk
+ * (digit RADIX - 1, stable) and are dropped.
+ */
+__kernel void scatter(__global const K *keys, __global const uint *values, __global K *keysOut,
+                      __global uint *valuesOut, ulong n, uint shift,
+                      __global const uint *offsets, uint hasValues) {
+  __local K lkeys[WG];
+  __local uint lvalues[WG], ldigits[WG];
+  __local uint running[RADIX], start[RADIX];
+  __local uint scratch[2 * WG];
+  const uint lid = get_local_id(0), g = get_group_id(0), groups = get_num_groups(0);
+
+  for (uint d = lid; d < RADIX; d += WG)
+    running[d] = offsets[d * groups + g];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint c = 0; c < ITEMS; ++c) {
+    const size_t chunk = g * (size_t)TILE + c * WG;
+    if (chunk >= n)
+      break; // uniform over the group
+    const uint valid = (uint)min((ulong)WG, n - chunk);
+
+    K key = 0;
+    uint value = 0, digit = RADIX - 1;
+    if (lid < valid) {
+      key = keys[chunk + lid];
+      value = hasValues ? values[chunk + lid] : 0;
+      digit = DIGIT(key, shift);
+    }
+
+    // stable split on each digit bit, low bit first
+    for (uint b = 0; b < RADIX_BITS; ++b) {
+      uint zero = ((digit >> b) & 1) == 0, zeros;
+      uint pos = scanFlags(zero, scratch, &zeros);
+      pos = zero ? pos : zeros + lid - pos;
+      lkeys[pos] = key;
+      lvalues[pos] = value;
+      ldigits[pos] = digit;
+      barrier(CLK_LOCAL_MEM_FENCE);
+      key = lkeys[lid];
+      value = lvalues[lid];
+      digit = ldigits[lid];
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0 || ldigits[lid - 1] != digit)
+      start[digit] = lid;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid < valid) {
+      uint dst = running[digit] + lid - start[digit];
+      keysOut[dst] = key;
+      if (hasValues)
+        valuesOut[dst] = value;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // the last key of every digit run advances that digit
+    if (lid == WG - 1 || ldigits[lid + 1] != digit)
+      running[digit] += lid + 1 - start[digit];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
+
+/* Segmented sorts: sort by key carrying the index, map indices to their
+ * segment, sort by segment carrying the index, gather */
+__kernel void iota(__global uint *out, ulong n) {
+  size_t i = get_global_id(0);
+  if (i < n)
+    out[i] = (uint)i;
+}
+
+/* seg[i] = s with offsets[s] <= idx[i] < offsets[s + 1] */
+__kernel void segmentOf(__global const uint *idx, ulong n, __global const uint *offsets,
+                        uint segments, __global uint *seg) {
+  size_t i = get_global_id(0);
+  if (i >= n)
+    return;
+  uint x = idx[i], lo = 0, hi = segments;
+  while (hi - lo > 1) {
+    uint mid = (lo + hi) / 2;
+    if (offsets[mid] <= x)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  seg[i] = lo;
+}
+
+__kernel void gather(__global const K *keys, __global const uint *values,
+                     __global const uint *idx, __global K *keysOut, __global uint *valuesOut,
+                     ulong n, uint hasValues) {
+  size_t i = get_global_id(0);
+  if (i >= n)
+    return;
+  keysOut[i] = keys[idx[i]];
+  if (hasValues)
+    valuesOut[i] = values[idx[i]];
+}
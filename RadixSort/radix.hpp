@@ -0,0 +1,233 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "../runtime.hpp"
+#include "../Reduction/reduction.hpp"
+
+/* Key types radix.cl sorts, with the bit pattern that orders them */
+template <class K> struct RadixKey;
+template <> struct RadixKey<cl_uint> {
+  static const char *name() { return "uint"; }
+  static const char *ordered() { return "(k)"; }
+};
+template <> struct RadixKey<cl_ulong> {
+  static const char *name() { return "ulong"; }
+  static const char *ordered() { return "(k)"; }
+};
+template <> struct RadixKey<cl_int> {
+  static const char *name() { return "int"; }
+  static const char *ordered() { return "(as_uint(k) ^ 0x80000000u)"; }
+};
+template <> struct RadixKey<cl_long> {
+  static const char *name() { return "long"; }
+  static const char *ordered() { return "(as_ulong(k) ^ 0x8000000000000000ul)"; }
+};
+// negative floats flip every bit, positive ones only the sign
+template <> struct RadixKey<cl_float> {
+  static const char *name() { return "float"; }
+  static const char *ordered() {
+    return "(as_uint(k) ^ ((as_uint(k) >> 31) ? 0xffffffffu : 0x80000000u))";
+  }
+};
+template <> struct RadixKey<cl_double> {
+  static const char *name() { return "double"; }
+  static const char *ordered() {
+    return "(as_ulong(k) ^ ((as_ulong(k) >> 63) ? 0xfffffffffffffffful : 0x8000000000000000ul))";
+  }
+};
+
+/*
+ * Stable LSD radix sort (radix.cl) of 32 and 64 bit keys, ascending, with
+ * optional cl_uint values carried along (indices, or any 4 byte payload).
+ * Every 8 bit pass counts per-tile digit histograms, scans them with the
+ * Reduction scan and scatters stably, ping-ponging through scratch
+ * buffers kept between calls. The segmented form sorts each
+ * [offsets[s], offsets[s + 1]) on its own.
+ */
+template <class K> class RadixSort {
+public:
+  explicit RadixSort(Runtime &rt) : rt_(rt), scan_(rt, ReduceOp::Sum) {
+    compile();
+    size_t limit = std::min(count_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()),
+                            scatter_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()));
+    if (wg_ > limit) {
+      while (wg_ > limit)
+        wg_ /= 2;
+      compile();
+    }
+  }
+
+  size_t localSize() const { return wg_; }
+  size_t tile() const { return wg_ * ITEMS; }
+
+  /* keys[0, n) sorted in place */
+  void operator()(const cl::CommandQueue &queue, const cl::Buffer &keys, size_t n,
+                  std::vector<cl::Event> *events = nullptr) {
+    sortBits(queue, keys, nullptr, n, 8 * sizeof(K), events);
+  }
+
+  /* Same, values[i] follows keys[i] */
+  void operator()(const cl::CommandQueue &queue, const cl::Buffer &keys, const cl::Buffer &values,
+                  size_t n, std::vector<cl::Event> *events = nullptr) {
+    sortBits(queue, keys, &values, n, 8 * sizeof(K), events);
+  }
+
+  /* Only the low `bits` of the ordered keys, for keys known to be small */
+  void sortBits(const cl::CommandQueue &queue, const cl::Buffer &keys, const cl::Buffer *values,
+                size_t n, unsigned bits, std::vector<cl::Event> *events = nullptr) {
+    if (n < 2)
+      return;
+    size_t groups = (n + tile() - 1) / tile();
+    grow(keysTmp_, keysTmpSize_, n * sizeof(K));
+    grow(hist_, histSize_, RADIX * groups * sizeof(cl_uint));
+    if (values)
+      grow(valuesTmp_, valuesTmpSize_, n * sizeof(cl_uint));
+
+    cl::Buffer a = keys, b = keysTmp_;
+    cl::Buffer va = values ? *values : keys, vb = values ? valuesTmp_ : keys;
+    for (unsigned shift = 0; shift < bits; shift += RADIX_BITS) {
+      count_.setArg(0, a);
+      count_.setArg(1, (cl_ulong)n);
+      count_.setArg(2, (cl_uint)shift);
+      count_.setArg(3, hist_);
+      launch(queue, count_, groups * wg_, cl::NDRange(wg_), events);
+
+      // digit-major, so tile g's keys of digit d land after tile g - 1's
+      scan_.exclusiveScan(queue, hist_, hist_, RADIX * groups, events);
+
+      scatter_.setArg(0, a);
+      scatter_.setArg(1, va);
+      scatter_.setArg(2, b);
+      scatter_.setArg(3, vb);
+      scatter_.setArg(4, (cl_ulong)n);
+      scatter_.setArg(5, (cl_uint)shift);
+      scatter_.setArg(6, hist_);
+      scatter_.setArg(7, (cl_uint)(values != nullptr));
+      launch(queue, scatter_, groups * wg_, cl::NDRange(wg_), events);
+
+      std::swap(a, b);
+      std::swap(va, vb);
+    }
+
+    // an odd number of passes leaves the result in the scratch buffers
+    if (a() != keys()) {
+      copy(queue, a, keys, n * sizeof(K), events);
+      if (values)
+        copy(queue, va, *values, n * sizeof(cl_uint), events);
+    }
+  }
+
+  /* Each segment sorted on its own; offsets holds segments + 1 cl_uint
+   * boundaries, offsets[0] = 0 and offsets[segments] = n */
+  void segmented(const cl::CommandQueue &queue, const cl::Buffer &keys, const cl::Buffer *values,
+                 size_t n, const cl::Buffer &offsets, size_t segments,
+                 std::vector<cl::Event> *events = nullptr) {
+    if (n < 2 || segments == 0)
+      return;
+    if (!segmentSort_)
+      segmentSort_.reset(new RadixSort<cl_uint>(rt_));
+    grow(segKeys_, segKeysSize_, n * sizeof(K));
+    grow(segIndex_, segIndexSize_, n * sizeof(cl_uint));
+    grow(segIds_, segIdsSize_, n * sizeof(cl_uint));
+    const size_t global = roundUp(n, wg_);
+
+    // sort a copy of the keys carrying their positions
+    iota_.setArg(0, segIndex_);
+    iota_.setArg(1, (cl_ulong)n);
+    launch(queue, iota_, global, cl::NullRange, events);
+    copy(queue, keys, segKeys_, n * sizeof(K), events);
+    sortBits(queue, segKeys_, &segIndex_, n, 8 * sizeof(K), events);
+
+    // stable by segment, only the bits segment ids use
+    segmentOf_.setArg(0, segIndex_);
+    segmentOf_.setArg(1, (cl_ulong)n);
+    segmentOf_.setArg(2, offsets);
+    segmentOf_.setArg(3, (cl_uint)segments);
+    segmentOf_.setArg(4, segIds_);
+    launch(queue, segmentOf_, global, cl::NullRange, events);
+    unsigned bits = 1;
+    while (bits < 32 && (size_t(1) << bits) < segments)
+      ++bits;
+    segmentSort_->sortBits(queue, segIds_, &segIndex_, n, bits, events);
+
+    // segIds_ is free again and takes the gathered values
+    gather_.setArg(0, keys);
+    gather_.setArg(1, values ? *values : keys);
+    gather_.setArg(2, segIndex_);
+    gather_.setArg(3, segKeys_);
+    gather_.setArg(4, segIds_);
+    gather_.setArg(5, (cl_ulong)n);
+    gather_.setArg(6, (cl_uint)(values != nullptr));
+    launch(queue, gather_, global, cl::NullRange, events);
+    copy(queue, segKeys_, keys, n * sizeof(K), events);
+    if (values)
+      copy(queue, segIds_, *values, n * sizeof(cl_uint), events);
+  }
+
+private:
+  static constexpr unsigned RADIX_BITS = 8, RADIX = 1 << RADIX_BITS;
+  static constexpr size_t ITEMS = 16;
+
+  static size_t roundUp(size_t n, size_t m) { return (n + m - 1) / m * m; }
+
+  void compile() {
+    std::string source = ReadTextFile(Runtime::findKernelFile("RadixSort/radix.cl").c_str());
+    if (source.empty()) {
+      std::cerr << "[ERROR] cannot read kernel source RadixSort/radix.cl\n";
+      throw cl::Error(CL_INVALID_PROGRAM, "RadixSort");
+    }
+    std::string config = std::string(std::is_same<K, cl_double>::value
+                                         ? "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+                                         : "") +
+                         "#define K " + RadixKey<K>::name() + "\n#define ORDERED(k) " +
+                         RadixKey<K>::ordered() + "\n#define WG " + std::to_string(wg_) +
+                         "\n#define ITEMS " + std::to_string(ITEMS) + "\n";
+    cl::Program &program = rt_.programFromSource(config + source);
+    count_ = cl::Kernel(program, "countDigits");
+    scatter_ = cl::Kernel(program, "scatter");
+    iota_ = cl::Kernel(program, "iota");
+    segmentOf_ = cl::Kernel(program, "segmentOf");
+    gather_ = cl::Kernel(program, "gather");
+  }
+
+  void launch(const cl::CommandQueue &queue, cl::Kernel &kernel, size_t global,
+              const cl::NDRange &local, std::vector<cl::Event> *events) {
+    cl::Event ev;
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global), local, nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  void copy(const cl::CommandQueue &queue, const cl::Buffer &from, const cl::Buffer &to,
+            size_t bytes, std::vector<cl::Event> *events) {
+    cl::Event ev;
+    queue.enqueueCopyBuffer(from, to, 0, 0, bytes, nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  void grow(cl::Buffer &buffer, size_t &size, size_t bytes) {
+    if (size < bytes) {
+      buffer = cl::Buffer(rt_.context(), CL_MEM_READ_WRITE, bytes);
+      size = bytes;
+    }
+  }
+
+  Runtime &rt_;
+  Reduction<cl_uint> scan_;
+  size_t wg_ = 256;
+  cl::Kernel count_, scatter_, iota_, segmentOf_, gather_;
+  cl::Buffer keysTmp_, valuesTmp_, hist_, segKeys_, segIndex_, segIds_;
+  size_t keysTmpSize_ = 0, valuesTmpSize_ = 0, histSize_ = 0;
+  size_t segKeysSize_ = 0, segIndexSize_ = 0, segIdsSize_ = 0;
+  std::unique_ptr<RadixSort<cl_uint>> segmentSort_;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+#include "reduction.hpp"
+
+// OP over in[0, n)
+template <class T, class Op> T reduce_Host(const T in[], size_t n, T identity, Op op) {
+  T acc = identity;
+  for (size_t i = 0; i < n; i++)
+    acc = op(acc, in[i]);
+  return acc;
+}
+
+// out[i] = OP over in[0, i)
+template <class T, class Op> void scan_Host(const T in[], T out[], size_t n, T identity, Op op) {
+  T acc = identity;
+  for (size_t i = 0; i < n; i++) {
+    out[i] = acc;
+    acc = op(acc, in[i]);
+  }
+}
+
+static const char *verdict(bool ok) { return ok ? "Ok" : "Error"; }
+
+int main(int argc, char *argv[]) {
+  // ./reduce [elements]
+  const size_t n = argc > 1 ? atol(argv[1]) : 1 << 20;
+
+  std::mt19937 gen(1319);
+  std::uniform_int_distribution<int> dis(-1000, 1000);
+  std::vector<int> ints(n);
+  std::vector<float> floats(n);
+  std::generate(ints.begin(), ints.end(), [&]() { return dis(gen); });
+  std::transform(ints.begin(), ints.end(), floats.begin(), [](int x) { return x / 7.0f; });
+
+  try {
+    // Shared context, queue and program registry for the selected device
+    Runtime &rt = Runtime::get();
+    rt.printInfo();
+    cl::CommandQueue &queue = rt.queue();
+
+    cl::Buffer bufInts(rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(int),
+                       ints.data());
+    cl::Buffer bufFloats(rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         n * sizeof(float), floats.data());
+    cl::Buffer bufScan(rt.context(), CL_MEM_READ_WRITE, n * sizeof(int));
+
+    // int sum, device against host
+    Reduction<cl_int> sum(rt, ReduceOp::Sum);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    int dSum = sum.reduce(queue, bufInts, n);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    int hSum = reduce_Host(ints.data(), n, 0, [](int a, int b) { return a + b; });
+    std::cout << "[INFO] sum " << dSum << " in "
+              << std::chrono::duration<double, std::milli>(t2 - t1).count() << "ms ("
+              << sum.localSize() << " x " << sum.tile() / sum.localSize() << " per group) "
+              << verdict(dSum == hSum) << '\n';
+
+    // float max and its position
+    Reduction<cl_float> maximum(rt, ReduceOp::Max), argmax(rt, ReduceOp::ArgMax);
+    float dMax = maximum.reduce(queue, bufFloats, n);
+    ArgValue<cl_float> dArg = argmax.argReduce(queue, bufFloats, n);
+    size_t hArg = std::max_element(floats.begin(), floats.end()) - floats.begin();
+    std::cout << "[INFO] max " << dMax << " at " << dArg.index << ' '
+              << verdict(dMax == floats[hArg] && dArg.index == hArg) << '\n';
+
+    // user operator in OpenCL C, associative but not commutative: last non-zero
+    Reduction<cl_int> last(rt, "b != 0 ? b : a", 0);
+    int dLast = last.reduce(queue, bufInts, n);
+    int hLast = reduce_Host(ints.data(), n, 0, [](int a, int b) { return b != 0 ? b : a; });
+    std::cout << "[INFO] last non-zero " << dLast << ' ' << verdict(dLast == hLast) << '\n';
+
+    // exclusive scan
+    std::vector<int> dScan(n), hScan(n);
+    t1 = std::chrono::high_resolution_clock::now();
+    sum.exclusiveScan(queue, bufInts, bufScan, n);
+    queue.enqueueReadBuffer(bufScan, CL_TRUE, 0, n * sizeof(int), dScan.data());
+    t2 = std::chrono::high_resolution_clock::now();
+    scan_Host(ints.data(), hScan.data(), n, 0, [](int a, int b) { return a + b; });
+    std::cout << "[INFO] exclusive scan in "
+              << std::chrono::duration<double, std::milli>(t2 - t1).count() << "ms "
+              << verdict(dScan == hScan) << '\n';
+
+    // double, where the device has it
+    if (rt.device().getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_fp64") != std::string::npos) {
+      std::vector<double> doubles(floats.begin(), floats.end());
+      cl::Buffer bufDoubles(rt.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                            n * sizeof(double), doubles.data());
+      double dDouble = Reduction<cl_double>(rt, ReduceOp::Sum).reduce(queue, bufDoubles, n);
+      double hDouble = reduce_Host(doubles.data(), n, 0.0, [](double a, double b) { return a + b; });
+      std::cout << "[INFO] double sum " << dDouble << ' '
+                << verdict(std::abs(dDouble - hDouble) <= 1e-9 * n) << '\n';
+    }
+  } catch (const cl::Error &error) {
+    std::cout << error.what() << "(" << error.err() << ")" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
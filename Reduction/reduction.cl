@@ -0,0 +1,154 @@
+/*
+ * Reduction and exclusive scan over an associative operator. The host
+ * prepends the configuration:
+ *   T            element type of the input
+ *   R            reduced type, T or ArgValue (ARGMIN / ARGMAX)
+ *   OP(a, b)     associative, a holds the earlier elements
+ *   IDENTITY     OP(IDENTITY, x) == x
+ *   LOWEST, HIGHEST  value range of T, for ARGMIN / ARGMAX
+ *   WG           work-group size, a power of two
+ *   ITEMS        consecutive elements per work-item
+ *   SUBGROUP_OP  add, min or max when a cl_khr_subgroups builtin is OP
+ * A group covers TILE elements, staged through local memory so global
+ * accesses stay coalesced while each item works on a consecutive run.
+ */
+
+#define TILE (WG * ITEMS)
+
+#ifdef SUBGROUP_OP
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#define CONCAT(a, b) a##b
+#define SUBGROUP_REDUCE(op, v) CONCAT(sub_group_reduce_, op)(v)
+#endif
+
+#if defined(ARGMIN) || defined(ARGMAX)
+typedef struct {
+  T value;
+  uint index;
+} ArgValue;
+
+/* ties go to the lower index, whatever the order */
+#ifdef ARGMAX
+#define BETTER(x, y) ((x).value > (y).value)
+#define IDENTITY ((R){LOWEST, UINT_MAX})
+#else
+#define BETTER(x, y) ((x).value < (y).value)
+#define IDENTITY ((R){HIGHEST, UINT_MAX})
+#endif
+#define OP(a, b)                                                               \
+  ((BETTER(b, a) || ((b).value == (a).value && (b).index < (a).index)) ? (b) : (a))
+#define LOAD_INPUT(in, i) ((R){(in)[i], (uint)(i)})
+#else
+#define LOAD_INPUT(in, i) ((in)[i])
+#endif
+#define LOAD_PARTIAL(in, i) ((in)[i])
+
+/* Tile of this group into local memory, IDENTITY past n */
+#define LOAD_TILE(LOAD)                                                        \
+  const uint lid = get_local_id(0);                                            \
+  const size_t base = get_group_id(0) * (size_t)TILE;                          \
+  for (uint k = 0; k < ITEMS; ++k) {                                           \
+    size_t i = base + k * WG + lid;                                            \
+    tile[k * WG + lid] = i < n ? LOAD(in, i) : IDENTITY;                       \
+  }                                                                            \
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+/* The group's total, valid in work-item 0 */
+R groupReduce(R v, __local R *scratch) {
+  const uint lid = get_local_id(0);
+#ifdef SUBGROUP_OP
+  v = SUBGROUP_REDUCE(SUBGROUP_OP, v);
+  if (get_sub_group_local_id() == 0)
+    scratch[get_sub_group_id()] = v;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (lid == 0)
+    for (uint s = 1; s < get_num_sub_groups(); ++s)
+      v = OP(v, scratch[s]);
+  return v;
+#else
+  // neighbours are combined in order, OP need not commute
+  scratch[lid] = v;
+  for (uint s = 1; s < WG; s <<= 1) {
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if ((lid & (2 * s - 1)) == 0)
+      scratch[lid] = OP(scratch[lid], scratch[lid + s]);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  return scratch[0];
+#endif
+}
+
+/* OP over the items before this work-item (Hillis-Steele, double buffered) */
+R groupScanExclusive(R v, __local R *scratch) {
+  const uint lid = get_local_id(0);
+  uint out = 0, in;
+  scratch[lid] = v;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint s = 1; s < WG; s <<= 1) {
+    out = 1 - out;
+    in = 1 - out;
+    scratch[out * WG + lid] = lid >= s ? OP(scratch[in * WG + lid - s], scratch[in * WG + lid])
+                                       : scratch[in * WG + lid];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  return lid ? scratch[out * WG + lid - 1] : IDENTITY;
+}
+
+R reduceTile(__local R *tile, __local R *scratch) {
+  const uint lid = get_local_id(0);
+  R v = tile[lid * ITEMS];
+  for (uint j = 1; j < ITEMS; ++j)
+    v = OP(v, tile[lid * ITEMS + j]);
+  return groupReduce(v, scratch);
+}
+
+/* partial[g] = OP over tile g of the input */
+__kernel void reduceInput(__global const T *in, ulong n, __global R *partial) {
+  __local R tile[TILE], scratch[WG];
+  LOAD_TILE(LOAD_INPUT)
+  R v = reduceTile(tile, scratch);
+  if (lid == 0)
+    partial[get_group_id(0)] = v;
+}
+
+/* Same over the partials of the previous level */
+__kernel void reducePartial(__global const R *in, ulong n, __global R *partial) {
+  __local R tile[TILE], scratch[WG];
+  LOAD_TILE(LOAD_PARTIAL)
+  R v = reduceTile(tile, scratch);
+  if (lid == 0)
+    partial[get_group_id(0)] = v;
+}
+
+#if !defined(ARGMIN) && !defined(ARGMAX)
+/*
+ * out[i] = OP over in[base .. i) of the tile, preceded by offsets[g] (the
+ * exclusive scan of the tile totals) when useOffsets is set. in and out
+ * may be the same buffer.
+ */
+__kernel void scanTile(__global const T *in, __global T *out, ulong n,
+                       __global const R *offsets, uint useOffsets) {
+  __local R tile[TILE], scratch[2 * WG];
+  LOAD_TILE(LOAD_INPUT)
+
+  R sum = tile[lid * ITEMS];
+  for (uint j = 1; j < ITEMS; ++j)
+    sum = OP(sum, tile[lid * ITEMS + j]);
+  R run = groupScanExclusive(sum, scratch);
+  if (useOffsets)
+    run = OP(offsets[get_group_id(0)], run);
+
+  for (uint j = 0; j < ITEMS; ++j) {
+    R x = tile[lid * ITEMS + j];
+    tile[lid * ITEMS + j] = run;
+    run = OP(run, x);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint k = 0; k < ITEMS; ++k) {
+    size_t i = base + k * WG + lid;
+    if (i < n)
+      out[i] = tile[k * WG + lid];
+  }
+}
+#endif
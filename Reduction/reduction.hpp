@@ -0,0 +1,280 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "../runtime.hpp"
+
+/* Operators with a built-in definition; Custom takes an OpenCL expression */
+enum class ReduceOp { Sum, Min, Max, ArgMin, ArgMax, Custom };
+
+/* Result of ArgMin / ArgMax, laid out like ArgValue in reduction.cl */
+template <class T> struct ArgValue {
+  T value;
+  cl_uint index;
+};
+
+/* OpenCL spelling of the element types the kernels take */
+template <class T> struct ClType;
+template <> struct ClType<cl_int> {
+  static const char *name() { return "int"; }
+  static const char *lowest() { return "INT_MIN"; }
+  static const char *highest() { return "INT_MAX"; }
+};
+template <> struct ClType<cl_uint> {
+  static const char *name() { return "uint"; }
+  static const char *lowest() { return "0u"; }
+  static const char *highest() { return "UINT_MAX"; }
+};
+template <> struct ClType<cl_float> {
+  static const char *name() { return "float"; }
+  static const char *lowest() { return "-INFINITY"; }
+  static const char *highest() { return "INFINITY"; }
+};
+template <> struct ClType<cl_double> {
+  static const char *name() { return "double"; }
+  static const char *lowest() { return "-INFINITY"; }
+  static const char *highest() { return "INFINITY"; }
+};
+
+/*
+ * Work-group tree reduction and reduce-then-scan exclusive scan
+ * (reduction.cl) for int, uint, float and double. A group reduces a tile
+ * of WG x ITEMS elements; reductions repeat over the tile totals until one
+ * is left, scans scan the totals recursively and add them back as tile
+ * offsets. Sum, Min and Max use cl_khr_subgroups reductions where the
+ * device has them; a custom operator is any associative OpenCL expression
+ * of a (earlier) and b (later) with its identity, commutative or not.
+ */
+template <class T> class Reduction {
+public:
+  Reduction(Runtime &rt, ReduceOp op = ReduceOp::Sum) : rt_(rt), op_(op) {
+    switch (op_) {
+    case ReduceOp::Sum:
+      configure("a + b", "0", "add");
+      break;
+    case ReduceOp::Min:
+      configure("min(a, b)", ClType<T>::highest(), "min");
+      break;
+    case ReduceOp::Max:
+      configure("max(a, b)", ClType<T>::lowest(), "max");
+      break;
+    case ReduceOp::ArgMin:
+    case ReduceOp::ArgMax:
+      configure("", "", "");
+      break;
+    default:
+      throw cl::Error(CL_INVALID_VALUE, "Reduction: custom operators need an expression");
+    }
+  }
+
+  Reduction(Runtime &rt, const std::string &op, T identity) : rt_(rt), op_(ReduceOp::Custom) {
+    configure(op, literal(identity), "");
+  }
+
+  bool arg() const { return op_ == ReduceOp::ArgMin || op_ == ReduceOp::ArgMax; }
+  size_t localSize() const { return wg_; }
+  size_t tile() const { return wg_ * ITEMS; }
+
+  /* Tuning entry: work-group size, a power of two */
+  static const char *tuningName() { return "Reduction"; }
+  std::vector<size_t> tuning() const { return {wg_}; }
+
+  /* result[0] = OP over in[0, n); result holds one R (T, or ArgValue<T>) */
+  void operator()(const cl::CommandQueue &queue, const cl::Buffer &in, size_t n,
+                  const cl::Buffer &result, std::vector<cl::Event> *events = nullptr) {
+    if (n == 0)
+      throw cl::Error(CL_INVALID_VALUE, "Reduction: empty input");
+    cl::Kernel *kernel = &input_;
+    cl::Buffer src = in;
+    for (size_t level = 0;; ++level) {
+      size_t groups = (n + tile() - 1) / tile();
+      cl::Buffer dst = groups == 1 ? result : levelBuffer(level, groups);
+      reduceLevel(queue, *kernel, src, n, dst, events);
+      if (groups == 1)
+        return;
+      kernel = &partial_;
+      src = dst;
+      n = groups;
+    }
+  }
+
+  /* Blocking convenience forms */
+  T reduce(const cl::CommandQueue &queue, const cl::Buffer &in, size_t n) {
+    T value;
+    (*this)(queue, in, n, resultBuffer());
+    queue.enqueueReadBuffer(result_, CL_TRUE, 0, sizeof(T), &value);
+    return value;
+  }
+
+  ArgValue<T> argReduce(const cl::CommandQueue &queue, const cl::Buffer &in, size_t n) {
+    ArgValue<T> value;
+    (*this)(queue, in, n, resultBuffer());
+    queue.enqueueReadBuffer(result_, CL_TRUE, 0, sizeof(value), &value);
+    return value;
+  }
+
+  /* out[i] = OP over in[0, i), out[0] = identity; in and out may alias */
+  void exclusiveScan(const cl::CommandQueue &queue, const cl::Buffer &in, const cl::Buffer &out,
+                     size_t n, std::vector<cl::Event> *events = nullptr) {
+    if (arg())
+      throw cl::Error(CL_INVALID_OPERATION, "Reduction: no scan for ArgMin / ArgMax");
+    if (n)
+      scanLevel(queue, in, out, n, 0, events);
+  }
+
+private:
+  static constexpr size_t ITEMS = 4;
+
+  size_t rSize() const { return arg() ? sizeof(ArgValue<T>) : sizeof(T); }
+
+  void configure(const std::string &op, const std::string &identity,
+                 const std::string &subgroupOp) {
+    std::ostringstream prelude;
+    if (std::is_same<T, cl_double>::value)
+      prelude << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+    prelude << "#define T " << ClType<T>::name() << '\n';
+    if (arg()) {
+      prelude << (op_ == ReduceOp::ArgMax ? "#define ARGMAX\n" : "#define ARGMIN\n")
+              << "#define R ArgValue\n"
+              << "#define LOWEST " << ClType<T>::lowest() << '\n'
+              << "#define HIGHEST " << ClType<T>::highest() << '\n';
+    } else {
+      prelude << "#define R T\n"
+              << "#define OP(a, b) (" << op << ")\n"
+              << "#define IDENTITY ((T)(" << identity << "))\n";
+    }
+
+    std::string options;
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+    // sub-group builtins only for operators they implement
+    if (!subgroupOp.empty() &&
+        rt_.device().getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_subgroups") != std::string::npos &&
+        rt_.device().getInfo<CL_DEVICE_VERSION>().find("OpenCL 1.") == std::string::npos) {
+      prelude << "#define SUBGROUP_OP " << subgroupOp << '\n';
+      options = "-cl-std=CL2.0";
+    }
+#else
+    (void)subgroupOp;
+#endif
+    prelude_ = prelude.str();
+    options_ = options;
+
+    // the largest power of two the kernels and local memory allow, from
+    // the tuned size when the device has one
+    std::vector<size_t> tuned;
+    if (tunedValues(rt_.tuning(), tuningName(), 1, tuned) && (tuned[0] & (tuned[0] - 1)) == 0)
+      wg_ = tuned[0];
+    size_t localMem = rt_.device().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    while (wg_ > 1 && (tile() + 2 * wg_) * rSize() > localMem)
+      wg_ /= 2;
+    compile();
+    size_t limit = std::min(input_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()),
+                            partial_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()));
+    if (!arg())
+      limit = std::min(limit, scan_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()));
+    if (wg_ > limit) {
+      while (wg_ > limit)
+        wg_ /= 2;
+      compile();
+    }
+  }
+
+  void compile() {
+    std::string source = ReadTextFile(Runtime::findKernelFile("Reduction/reduction.cl").c_str());
+    if (source.empty()) {
+      std::cerr << "[ERROR] cannot read kernel source Reduction/reduction.cl\n";
+      throw cl::Error(CL_INVALID_PROGRAM, "Reduction");
+    }
+    std::string config = prelude_ + "#define WG " + std::to_string(wg_) + "\n#define ITEMS " +
+                         std::to_string(ITEMS) + "\n";
+    cl::Program &program = rt_.programFromSource(config + source, options_);
+    input_ = cl::Kernel(program, "reduceInput");
+    partial_ = cl::Kernel(program, "reducePartial");
+    if (!arg())
+      scan_ = cl::Kernel(program, "scanTile");
+  }
+
+  void launch(const cl::CommandQueue &queue, cl::Kernel &kernel, size_t groups,
+              std::vector<cl::Event> *events) {
+    cl::Event ev;
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(groups * wg_),
+                               cl::NDRange(wg_), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  void reduceLevel(const cl::CommandQueue &queue, cl::Kernel &kernel, const cl::Buffer &in,
+                   size_t n, const cl::Buffer &out, std::vector<cl::Event> *events) {
+    kernel.setArg(0, in);
+    kernel.setArg(1, (cl_ulong)n);
+    kernel.setArg(2, out);
+    launch(queue, kernel, (n + tile() - 1) / tile(), events);
+  }
+
+  void scanTile(const cl::CommandQueue &queue, const cl::Buffer &in, const cl::Buffer &out,
+                size_t n, const cl::Buffer *offsets, std::vector<cl::Event> *events) {
+    scan_.setArg(0, in);
+    scan_.setArg(1, out);
+    scan_.setArg(2, (cl_ulong)n);
+    scan_.setArg(3, offsets ? *offsets : in); // unread without offsets
+    scan_.setArg(4, (cl_uint)(offsets != nullptr));
+    launch(queue, scan_, (n + tile() - 1) / tile(), events);
+  }
+
+  void scanLevel(const cl::CommandQueue &queue, const cl::Buffer &in, const cl::Buffer &out,
+                 size_t n, size_t level, std::vector<cl::Event> *events) {
+    size_t groups = (n + tile() - 1) / tile();
+    if (groups == 1) {
+      scanTile(queue, in, out, n, nullptr, events);
+      return;
+    }
+    cl::Buffer totals = levelBuffer(level, groups);
+    reduceLevel(queue, input_, in, n, totals, events);
+    scanLevel(queue, totals, totals, groups, level + 1, events);
+    scanTile(queue, in, out, n, &totals, events);
+  }
+
+  /* Tile totals of one level, kept between calls */
+  cl::Buffer levelBuffer(size_t level, size_t count) {
+    if (levels_.size() <= level)
+      levels_.resize(level + 1), levelCounts_.resize(level + 1, 0);
+    if (levelCounts_[level] < count) {
+      levels_[level] = cl::Buffer(rt_.context(), CL_MEM_READ_WRITE, count * rSize());
+      levelCounts_[level] = count;
+    }
+    return levels_[level];
+  }
+
+  const cl::Buffer &resultBuffer() {
+    if (!result_())
+      result_ = cl::Buffer(rt_.context(), CL_MEM_READ_WRITE, rSize());
+    return result_;
+  }
+
+  static std::string literal(T v) {
+    std::ostringstream s;
+    if (std::is_integral<T>::value)
+      s << +v << (std::is_unsigned<T>::value ? "u" : "");
+    else
+      s << std::hexfloat << v << (std::is_same<T, cl_float>::value ? "f" : "");
+    return s.str();
+  }
+
+  Runtime &rt_;
+  ReduceOp op_;
+  std::string prelude_, options_;
+  size_t wg_ = 256;
+  cl::Kernel input_, partial_, scan_;
+  std::vector<cl::Buffer> levels_;
+  std::vector<size_t> levelCounts_;
+  cl::Buffer result_;
+};
+
+#endif
@@ -1,116 +1,123 @@
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
-#define __CL_ENABLE_EXCEPTIONS
-#include <CL/cl.hpp>
-
 #include <boost/gil/extension/io/jpeg_io.hpp>
 
-#include "../utils.hpp"
+#include "../batch.hpp"
+#include "../cpu.hpp"
+#include "../runtime.hpp"
+#include "warp.hpp"
 
 namespace gil = boost::gil;
 using namespace std;
 
-#define THETA 0 /*(M_PI / -4.0f)*/
+int main(int argc, char *argv[]) {
+  // ./rotate [degrees [nearest|bilinear|bicubic [expand|keep [frames]]]]
+  const float theta = (argc > 1 ? atof(argv[1]) : 30.0f) * M_PI / 180.0f;
+  const string filter = argc > 2 ? argv[2] : "bilinear";
+  const bool expand = argc > 3 && string(argv[3]) == "expand";
+  const size_t frames = argc > 4 ? atol(argv[4]) : 64;
+  const Interp interp = filter == "nearest"  ? Interp::Nearest
+			: filter == "bicubic" ? Interp::Bicubic
+					      : Interp::Bilinear;
 
-int main() {
-  gil::rgb8_image_t gilImage;
-  gil::jpeg_read_image("../lena.small.jpg", gilImage);
+  // decoded straight into the rgba layout the device image uses
+  gil::rgba8_image_t gilImage;
+  gil::jpeg_read_and_convert_image("../lena.small.jpg", gilImage);
 
-  const int imgCols = gilImage.width(), imgRows = gilImage.height();
-  const int imageElements = imgCols * imgRows;
-  // imageElements * 4 because rgba
-  int *hImg = readImage(gilImage, new int[imageElements * 4]); // utils
+  const size_t imgCols = gilImage.width(), imgRows = gilImage.height();
 
-  gil::rgb8_image_t outGilImg(imgCols, imgRows);
+  // the expanded canvas keeps the corners
+  size_t outCols = imgCols, outRows = imgRows;
+  if (expand)
+    Affine::rotatedSize(theta, imgCols, imgRows, outCols, outRows);
+  gil::rgba8_image_t outGilImg(outCols, outRows);
 
   try {
-    // Query for platforms
-    std::vector<cl::Platform> platform;
-    cl::Platform::get(&platform);
-
-    // Get a list of devices on this platform
-    std::vector<cl::Device> devices;
-    cout << platform[1].getInfo<CL_PLATFORM_NAME>() << "  "  << platform.size() << endl;
-    platform[1].getDevices(CL_DEVICE_TYPE_GPU, &devices);
-
-    // Create a context for the devices
-    cl::Context context(devices[0]);
-
-    // Create a command-queue for the first device
-    cl::CommandQueue queue = cl::CommandQueue(context, devices[0]);
-
-    // Cerate the device memory buffers
-    cl::Image2D bufInputImage(context, CL_MEM_READ_ONLY,
-			      cl::ImageFormat(CL_RGBA, CL_SIGNED_INT32),
-			      imgCols, imgRows, 0, hImg);
-    cl::Image2D bufOutputImage(context, CL_MEM_WRITE_ONLY,
-			       cl::ImageFormat(CL_RGBA, CL_SIGNED_INT32),
-			       imgCols, imgRows);
-
-    // Offset within the image to copy
-    cl::size_t<3> origin;
-    origin[0] = origin[1] = origin[2] = 0;
-    // Region of image we want to pass
-    cl::size_t<3> region;
-    region[0] = (size_t)imgCols;
-    region[1] = (size_t)imgRows;
-    region[2] = 1;
-    queue.enqueueWriteImage(bufInputImage, CL_TRUE, origin, region, 0, 0, hImg);
-    // queue.enqueueFillImage(bufOutputImage, cl_int4({0,0,0,0}), origin,
-    // region);
-
-    // Read the program source
-    std::string sourceCode = ReadTextFile("./rotate.cl");
-    cl::Program::Sources source(
-	1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
-
-    // Create the program from the source code
-    cl::Program program = cl::Program(context, source);
-
-    // Build the program for the devices
-    try {
-      program.build(devices);
-    } catch (cl::Error error) {
-      cl::STRING_CLASS buildlog;
-      program.getBuildInfo(devices[0], CL_PROGRAM_BUILD_LOG, &buildlog);
-      std::cout << buildlog << std::endl;
+    // Shared context, queue and program registry for the selected device,
+    // without one the CPU backend rotates the image
+    Runtime *runtime = runtimeOrCpu();
+    if (!runtime) {
+      CpuWarp warp(interp);
+      warp(gil::interleaved_view_get_raw_data(const_view(gilImage)), imgCols, imgRows,
+           gil::interleaved_view_get_raw_data(view(outGilImg)), outCols, outRows, 4,
+           Affine::rotation(theta, imgCols, imgRows, outCols, outRows));
+    } else {
+      Runtime &rt = *runtime;
+      rt.printInfo();
+      cl::Context context = rt.context();
+      cl::CommandQueue &queue = rt.queue();
+
+      // Cerate the device memory buffers
+      // Device images alias the GIL pixels, no host side repacking
+      cl::Image2D bufInputImage =
+          wrapView(context, CL_MEM_READ_ONLY, const_view(gilImage)); // utils
+      cl::Image2D bufOutputImage =
+          wrapView(context, CL_MEM_WRITE_ONLY, view(outGilImg)); // utils
+
+      // The filter specialized program, built on first use
+      Warp warp(rt, interp);
+
+      // Trigonometry happens once, here, the kernel only gets the matrix;
+      // a one-off angle is not worth a program build (Warp::fixed)
+      warp(queue, bufInputImage, bufOutputImage,
+           Affine::rotation(theta, imgCols, imgRows, outCols, outRows));
+
+      // Make the output visible in outGilImg
+      downloadView(queue, bufOutputImage, view(outGilImg)); // utils
+
+      // A stream of frames, every one rotated a little further, as few
+      // launches as device memory allows; the last frame is the one above
+      const size_t capacity = batchCapacity(
+          rt.device(), 4 * (imgCols * imgRows + outCols * outRows), 1); // batch
+      const size_t layers = std::max<size_t>(1, std::min(capacity, frames));
+      cl::Image2DArray bufFrames(context, CL_MEM_READ_ONLY, deviceFormat<gil::rgba8_view_t>(),
+                                 layers, imgCols, imgRows);
+      cl::Image2DArray bufWarped(context, CL_MEM_WRITE_ONLY, deviceFormat<gil::rgba8_view_t>(),
+                                 layers, outCols, outRows);
+      gil::rgba8_image_t lastGilImg(outCols, outRows);
+      size_t batches = 0;
+
+      auto t1 = chrono::high_resolution_clock::now();
+      forEachBatch(frames, layers, [&](size_t first, size_t count) { // batch
+        vector<Affine> maps;
+        for (size_t i = 0; i < count; i++) {
+          uploadView(queue, bufFrames, const_view(gilImage), i); // utils
+          maps.push_back(Affine::rotation(theta * (first + i + 1) / frames, imgCols, imgRows,
+                                          outCols, outRows));
+        }
+        warp(queue, bufFrames, bufWarped, maps);
+        if (first + count == frames)
+          downloadView(queue, bufWarped, view(lastGilImg), count - 1); // utils
+        ++batches;
+      });
+      queue.finish();
+      auto t2 = chrono::high_resolution_clock::now();
+
+      // layers and single images sample alike, allow a rounding step
+      bool same = true;
+      auto a = const_view(outGilImg), b = const_view(lastGilImg);
+      for (int y = 0; y < a.height(); y++)
+        for (int x = 0; x < a.width(); x++)
+          for (int c = 0; c < 4; c++)
+            same = same && abs((int)a(x, y)[c] - (int)b(x, y)[c]) <= 1;
+      cout << "[INFO] " << frames << " frames in " << batches << " batches of up to " << layers
+           << ": " << chrono::duration<double, milli>(t2 - t1).count() << "ms "
+           << (same ? "Ok" : "Error") << '\n';
     }
-
-    // Create the kernel
-    cl::Kernel rotate_kernel(program, "rrotate");
-
-    // Set the kernel arguments
-    rotate_kernel.setArg(0, bufInputImage);
-    rotate_kernel.setArg(1, bufOutputImage);
-    rotate_kernel.setArg(2, (int)imgCols);
-    rotate_kernel.setArg(3, (int)imgRows);
-    rotate_kernel.setArg(4, (float)THETA);
-
-    // Execute the kernel
-    cl::NDRange global(imgCols, imgRows); // for each pixel
-    cl::NDRange local(4, 4);
-    queue.enqueueNDRangeKernel(rotate_kernel, cl::NullRange, global, local);
-
-    // Copy the output image back to the host
-    queue.enqueueReadImage(bufOutputImage, CL_TRUE, origin, region, 0, 0, hImg);
-    queue.flush();
-
   } catch (cl::Error error) {
     std::cout << error.what() << "(" << error.err() << ")" << std::endl;
-    goto clean_exit;
+    return 1;
   }
 
-  writeImage(outGilImg, hImg); // utils
-
-  gil::jpeg_write_view("./result.jpg", const_view(outGilImg)); // write image
-
-clean_exit:
-  delete[] hImg;
+  gil::jpeg_write_view("./result.jpg", // write image
+		       gil::color_converted_view<gil::rgb8_pixel_t>(
+			   const_view(outGilImg)));
 
   return 0;
 }
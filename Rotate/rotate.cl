@@ -1,28 +1,116 @@
+/*
+ * Affine warp. The host passes the 2x3 matrix that maps output pixel
+ * centres to input coordinates, (x, y) -> (m.s0 x + m.s1 y + m.s2,
+ * m.s3 x + m.s4 y + m.s5), so no work-item evaluates any trigonometry.
+ * INTERP picks the filter (-D, default bilinear). Input coordinates
+ * outside the image read as transparent black. LAYERED=1 builds
+ * warpAffineLayers instead, which warps every layer of an image array with
+ * its own matrix. -D MAP0..MAP5 compile one matrix into warpAffine, which
+ * then ignores m: right angles and unit scales fold away.
+ */
+#define INTERP_NEAREST 0
+#define INTERP_BILINEAR 1
+#define INTERP_BICUBIC 2
+
+#ifndef INTERP
+#define INTERP INTERP_BILINEAR
+#endif
+#ifndef LAYERED
+#define LAYERED 0
+#endif
+
+#if LAYERED
+#define IMAGE_T image2d_array_t
+#define AT(p, z) (int4)((p), (z), 0)
+#define AT_F(p, z) (float4)((p), (float)(z), 0.0f)
+#else
+#define IMAGE_T image2d_t
+#define AT(p, z) (p)
+#define AT_F(p, z) (p)
+#endif
+
+#if INTERP == INTERP_BILINEAR
 __constant sampler_t sampler =
     CLK_NORMALIZED_COORDS_FALSE | CLK_FILTER_LINEAR | CLK_ADDRESS_CLAMP;
+#else
+__constant sampler_t sampler =
+    CLK_NORMALIZED_COORDS_FALSE | CLK_FILTER_NEAREST | CLK_ADDRESS_CLAMP;
+#endif
 
-__kernel void rrotate(__read_only image2d_t inputImage,
-                      __write_only image2d_t outputImage, int imageWidth,
-                      int imageHieght, float theta) {
-  /* Get global id for output coordiantes */
-  int x = get_global_id(0), y = get_global_id(1);
+#if INTERP == INTERP_BICUBIC
+/* Keys cubic (a = -0.5) weights of the taps at -1, 0, 1, 2 */
+inline float4 cubicWeights(float t) {
+  float t2 = t * t, t3 = t2 * t;
+  return (float4)(-0.5f * t3 + t2 - 0.5f * t,
+                  1.5f * t3 - 2.5f * t2 + 1.0f,
+                  -1.5f * t3 + 2.0f * t2 + 0.5f * t,
+                  0.5f * t3 - 0.5f * t2);
+}
+#endif
 
-  /* Compute image center */
-  float x0 = imageWidth / 2, y0 = imageHieght / 2;
+/* Input colour at p of layer z, in pixel units (pixel centres at i + 0.5) */
+inline float4 sample(__read_only IMAGE_T img, float2 p, int z) {
+#if INTERP == INTERP_BICUBIC
+  p -= 0.5f;
+  float2 base = floor(p);
+  float4 wx = cubicWeights(p.x - base.x), wy = cubicWeights(p.y - base.y);
+  int2 i0 = convert_int2(base) - 1;
+  float wxs[4] = {wx.x, wx.y, wx.z, wx.w}, wys[4] = {wy.x, wy.y, wy.z, wy.w};
+  float4 sum = (float4)(0.0f);
+  for (int j = 0; j < 4; j++) {
+    float4 row = (float4)(0.0f);
+    for (int i = 0; i < 4; i++)
+      row += wxs[i] * read_imagef(img, sampler, AT(i0 + (int2)(i, j), z));
+    sum += wys[j] * row;
+  }
+  return clamp(sum, 0.0f, 1.0f);
+#else
+  return read_imagef(img, sampler, AT_F(p, z));
+#endif
+}
+
+inline float2 transform(float8 m, int x, int y) {
+  float2 d = (float2)(x + 0.5f, y + 0.5f);
+  return (float2)(m.s0 * d.x + m.s1 * d.y + m.s2, m.s3 * d.x + m.s4 * d.y + m.s5);
+}
 
-  /* Compute work-item's location relative to image's center */
-  int xprime = x - x0, yprime = y - y0;
+#if !LAYERED
+__kernel void warpAffine(__read_only image2d_t inputImage,
+                         __write_only image2d_t outputImage, float8 m) {
+  int x = get_global_id(0), y = get_global_id(1);
+  int2 size = get_image_dim(outputImage);
+  if (x >= size.x || y >= size.y)
+    return;
 
-  float sinTheta = sin(theta), cosTheta = cos(theta);
+#ifdef MAP0
+  m = (float8)(MAP0, MAP1, MAP2, MAP3, MAP4, MAP5, 0.0f, 0.0f);
+#endif
+  write_imagef(outputImage, (int2)(x, y), sample(inputImage, transform(m, x, y), 0));
+}
 
-  /* Compute *input* location */
-  float2 readCoord;
-  readCoord.x = xprime * cosTheta - yprime * sinTheta + x0;
-  readCoord.y = xprime * sinTheta + yprime * cosTheta + y0;
+/* Layer z of outputImages gets matrix m[z], one upload for the whole batch */
+__kernel void warpAffineBatch(__read_only image2d_t inputImage,
+                              __write_only image2d_array_t outputImages,
+                              __constant float8 *m) {
+  int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+  int2 size = (int2)(get_image_width(outputImages), get_image_height(outputImages));
+  if (x >= size.x || y >= size.y)
+    return;
 
-  /* Read the input image */
-  float3 c = read_imagef(inputImage, sampler, readCoord).xyz;
+  write_imagef(outputImages, (int4)(x, y, z, 0),
+               sample(inputImage, transform(m[z], x, y), 0));
+}
+#else
+/* Layer z of inputImages warped by m[z] into layer z of outputImages */
+__kernel void warpAffineLayers(__read_only image2d_array_t inputImages,
+                               __write_only image2d_array_t outputImages,
+                               __constant float8 *m) {
+  int x = get_global_id(0), y = get_global_id(1), z = get_global_id(2);
+  int2 size = get_image_dim(outputImages);
+  if (x >= size.x || y >= size.y)
+    return;
 
-  /* Write the ouput image */
-  write_imagef(outputImage, (int2)(x, y), (float4)(c.x, c.y, c.z, 0.0f));
+  write_imagef(outputImages, (int4)(x, y, z, 0),
+               sample(inputImages, transform(m[z], x, y), z));
 }
+#endif
@@ -0,0 +1,218 @@
+#ifndef WARP_H
+#define WARP_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+#include "../specialize.hpp"
+
+/* Values of INTERP in rotate.cl */
+enum class Interp { Nearest = 0, Bilinear = 1, Bicubic = 2 };
+
+/* 2x3 affine map (x, y) -> (m[0] x + m[1] y + m[2], m[3] x + m[4] y + m[5]) */
+struct Affine {
+  float m[6] = {1, 0, 0, 0, 1, 0};
+
+  Affine() = default;
+  Affine(float a, float b, float c, float d, float e, float f) : m{a, b, c, d, e, f} {}
+
+  Affine inverse() const {
+    float det = m[0] * m[4] - m[1] * m[3];
+    if (det == 0.0f)
+      throw cl::Error(CL_INVALID_VALUE, "Affine: singular matrix");
+    float a = m[4] / det, b = -m[1] / det, d = -m[3] / det, e = m[0] / det;
+    return Affine(a, b, -(a * m[2] + b * m[5]), d, e, -(d * m[2] + e * m[5]));
+  }
+
+  /* Output-to-input map of a rotation by theta radians (counterclockwise on
+   * screen) about the image centre, for an outWidth x outHeight canvas
+   * centred on it */
+  static Affine rotation(float theta, size_t width, size_t height, size_t outWidth,
+                         size_t outHeight) {
+    float c = std::cos(theta), s = std::sin(theta);
+    float cx = width / 2.0f, cy = height / 2.0f;
+    float ox = outWidth / 2.0f, oy = outHeight / 2.0f;
+    return Affine(c, -s, cx - c * ox + s * oy, s, c, cy - s * ox - c * oy);
+  }
+
+  /* Canvas holding the whole rotated image, so no corner is clipped */
+  static void rotatedSize(float theta, size_t width, size_t height, size_t &outWidth,
+                          size_t &outHeight) {
+    float c = std::fabs(std::cos(theta)), s = std::fabs(std::sin(theta));
+    // drop the float noise of right angles before rounding up
+    outWidth = (size_t)std::ceil(width * c + height * s - 1e-3f);
+    outHeight = (size_t)std::ceil(width * s + height * c - 1e-3f);
+  }
+
+  cl_float8 packed() const {
+    cl_float8 v = {};
+    std::copy(m, m + 6, v.s);
+    return v;
+  }
+};
+
+/*
+ * Affine warp of a device image (rotate.cl). Every call takes the
+ * output-to-input matrix as a plain kernel argument; the batch forms warp
+ * one uploaded image with many matrices, or every layer of an image array
+ * with its own matrix, in a single launch. The layered program is built on
+ * first use. fixed() runs a variant with the matrix compiled in. Work-groups
+ * are tileX x tileY, 16 x 16 unless the device has a tuned tile.
+ */
+class Warp {
+public:
+  explicit Warp(Runtime &rt, Interp interp = Interp::Bilinear)
+      : rt_(rt), interp_(interp),
+        fixed_(rt, "Rotate/rotate.cl", "warpAffine",
+               {"MAP0", "MAP1", "MAP2", "MAP3", "MAP4", "MAP5"},
+               "-D INTERP=" + std::to_string((int)interp)) {
+    cl::Program &program =
+        rt_.program("Rotate/rotate.cl", "-D INTERP=" + std::to_string((int)interp_));
+    single_ = cl::Kernel(program, "warpAffine");
+    batch_ = cl::Kernel(program, "warpAffineBatch");
+
+    std::vector<size_t> tuned;
+    if (tunedValues(rt_.tuning(), tuningName(), 2, tuned)) {
+      tileX_ = tuned[0];
+      tileY_ = tuned[1];
+    }
+    fitTile(single_);
+    fitTile(batch_);
+  }
+
+  Interp interp() const { return interp_; }
+  size_t localSize() const { return tileX_ * tileY_; }
+
+  /* Tuning entry: tile width, tile height */
+  static const char *tuningName() { return "Warp"; }
+  std::vector<size_t> tuning() const { return {tileX_, tileY_}; }
+
+  /* out(x, y) = in(map(x + 0.5, y + 0.5)), out may be any size */
+  void operator()(const cl::CommandQueue &queue, const cl::Image2D &in, const cl::Image2D &out,
+                  const Affine &map, std::vector<cl::Event> *events = nullptr) {
+    launch(queue, single_, in, out, map, events);
+  }
+
+  /* Same with map compiled into the kernel, for a map applied to many
+   * images: the first call with each map builds a program */
+  void fixed(const cl::CommandQueue &queue, const cl::Image2D &in, const cl::Image2D &out,
+             const Affine &map, std::vector<cl::Event> *events = nullptr) {
+    const float *m = map.m;
+    launch(queue, fixed_.get(m[0], m[1], m[2], m[3], m[4], m[5]), in, out, map, events);
+  }
+
+  /* Layer i of out = in warped by maps[i]; out needs maps.size() layers */
+  void operator()(const cl::CommandQueue &queue, const cl::Image2D &in,
+                  const cl::Image2DArray &out, const std::vector<Affine> &maps,
+                  std::vector<cl::Event> *events = nullptr) {
+    MapSlot &slot = uploadMaps(queue, maps);
+    batch_.setArg(0, in);
+    batch_.setArg(1, out);
+    batch_.setArg(2, slot.buffer);
+    launchLayers(queue, batch_, out, slot, events);
+  }
+
+  /* Layer i of out = layer i of in warped by maps[i], a batch of frames in
+   * one launch; both arrays need maps.size() layers */
+  void operator()(const cl::CommandQueue &queue, const cl::Image2DArray &in,
+                  const cl::Image2DArray &out, const std::vector<Affine> &maps,
+                  std::vector<cl::Event> *events = nullptr) {
+    if (!layers_()) {
+      cl::Program &program = rt_.program(
+          "Rotate/rotate.cl", "-D INTERP=" + std::to_string((int)interp_) + " -D LAYERED=1");
+      layers_ = cl::Kernel(program, "warpAffineLayers");
+      fitTile(layers_);
+    }
+    MapSlot &slot = uploadMaps(queue, maps);
+    layers_.setArg(0, in);
+    layers_.setArg(1, out);
+    layers_.setArg(2, slot.buffer);
+    launchLayers(queue, layers_, out, slot, events);
+  }
+
+  static size_t roundUp(size_t n, size_t m) { return (n + m - 1) / m * m; }
+
+private:
+  /* Halves the tile, y first, until kernel takes it; the tile is a launch
+   * parameter only, so no kernel needs rebuilding */
+  void fitTile(const cl::Kernel &kernel) {
+    size_t limit = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device());
+    while (tileX_ * tileY_ > limit)
+      (tileY_ > 1 ? tileY_ : tileX_) /= 2;
+  }
+
+  void launch(const cl::CommandQueue &queue, cl::Kernel &kernel, const cl::Image2D &in,
+              const cl::Image2D &out, const Affine &map, std::vector<cl::Event> *events) {
+    size_t width = out.getImageInfo<CL_IMAGE_WIDTH>();
+    size_t height = out.getImageInfo<CL_IMAGE_HEIGHT>();
+    cl::Event ev;
+
+    kernel.setArg(0, in);
+    kernel.setArg(1, out);
+    kernel.setArg(2, map.packed());
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                               cl::NDRange(roundUp(width, tileX_), roundUp(height, tileY_)),
+                               cl::NDRange(tileX_, tileY_), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  /* Matrices of one batch launch, the host copy kept until the launch that
+   * reads them is done so the write need not block */
+  struct MapSlot {
+    std::vector<cl_float8> packed;
+    cl::Buffer buffer;
+    size_t bytes = 0;
+    cl::Event written, done;
+  };
+
+  /* Next slot of the ring filled with maps; waits only when that slot's
+   * last launch is still running */
+  MapSlot &uploadMaps(const cl::CommandQueue &queue, const std::vector<Affine> &maps) {
+    size_t bytes = maps.size() * sizeof(cl_float8);
+    if (bytes > rt_.device().getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>())
+      throw cl::Error(CL_INVALID_VALUE, "Warp: too many matrices for one batch");
+
+    MapSlot &slot = slots_[next_];
+    next_ = (next_ + 1) % slots_.size();
+    if (slot.done())
+      slot.done.wait();
+    slot.packed.clear();
+    for (auto &map : maps)
+      slot.packed.push_back(map.packed());
+    if (bytes > slot.bytes) {
+      slot.buffer = cl::Buffer(rt_.context(), CL_MEM_READ_ONLY, bytes);
+      slot.bytes = bytes;
+    }
+    queue.enqueueWriteBuffer(slot.buffer, CL_FALSE, 0, bytes, slot.packed.data(), nullptr,
+                             &slot.written);
+    return slot;
+  }
+
+  void launchLayers(const cl::CommandQueue &queue, cl::Kernel &kernel, const cl::Image2DArray &out,
+                    MapSlot &slot, std::vector<cl::Event> *events) {
+    size_t width = out.getImageInfo<CL_IMAGE_WIDTH>();
+    size_t height = out.getImageInfo<CL_IMAGE_HEIGHT>();
+    std::vector<cl::Event> after = {slot.written};
+    queue.enqueueNDRangeKernel(
+        kernel, cl::NullRange,
+        cl::NDRange(roundUp(width, tileX_), roundUp(height, tileY_), slot.packed.size()),
+        cl::NDRange(tileX_, tileY_, 1), &after, &slot.done);
+    if (events)
+      events->push_back(slot.done);
+  }
+
+  Runtime &rt_;
+  Interp interp_;
+  size_t tileX_ = 16, tileY_ = 16;
+  cl::Kernel single_, batch_, layers_;
+  KernelVariants<float, float, float, float, float, float> fixed_;
+  std::array<MapSlot, 3> slots_;
+  size_t next_ = 0;
+};
+
+#endif
@@ -1,3 +1,11 @@
+/* -D PER_ROW_N=n compiles the side in, n is then ignored and the row and
+ * column offsets fold to constants */
+#ifdef PER_ROW_N
+#define ROW_N PER_ROW_N
+#else
+#define ROW_N n
+#endif
+
 __kernel void
 transpose_parallel_per_row
 (
@@ -8,8 +16,8 @@ transpose_parallel_per_row
 {
     int gidx = get_global_id(0);
 
-    for (int i = 0; i < n; ++i)
-        trgt[gidx * n + i] = src[i * n + gidx];
+    for (int i = 0; i < ROW_N; ++i)
+        trgt[gidx * ROW_N + i] = src[i * ROW_N + gidx];
         //trgt[i * n + gidx] = src[gidx * n + i];
 }
 
@@ -26,27 +34,89 @@ transpose_parallel_per_element
         //trgt[i * n + gidx] = src[gidx * n + i];
 }
 
+/*
+ * Tiled transpose of a rows x cols row-major matrix into cols x rows.
+ * A (TILE_DIM, BLOCK_ROWS) work-group moves one TILE_DIM x TILE_DIM block,
+ * every work-item handling TILE_DIM / BLOCK_ROWS elements. Reads and writes
+ * both walk rows with get_local_id(0), so they coalesce; the tile is one
+ * column wider than the block so its column reads hit distinct banks.
+ * Global size (roundup(cols, TILE_DIM), roundup(rows, TILE_DIM) / TILE_DIM
+ * * BLOCK_ROWS); edge tiles are bounds checked.
+ */
+#ifndef TILE_DIM
+#define TILE_DIM 32
+#endif
+#ifndef BLOCK_ROWS
+#define BLOCK_ROWS 8
+#endif
+
 __kernel void
-transpose_parallel_per_element_tiled
+transpose_tiled
 (__global const float *src,
  __global       float *trgt,
- __local        float *tile
+ int rows,
+ int cols
+ )
+{
+    __local float tile[TILE_DIM][TILE_DIM + 1];
+    int lx = get_local_id(0), ly = get_local_id(1);
+    int bx = get_group_id(0) * TILE_DIM, by = get_group_id(1) * TILE_DIM;
+
+    /* block (by, bx) of src, row by row */
+    int x = bx + lx;
+    for (int j = ly; j < TILE_DIM; j += BLOCK_ROWS)
+        if (x < cols && by + j < rows)
+            tile[j][lx] = src[(by + j) * cols + x];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /* becomes block (bx, by) of trgt, again row by row */
+    x = by + lx;
+    for (int j = ly; j < TILE_DIM; j += BLOCK_ROWS)
+        if (x < rows && bx + j < cols)
+            trgt[(bx + j) * rows + x] = tile[lx][j];
+}
+
+/*
+ * In-place transpose of an n x n matrix. Group k of a 1D launch owns the
+ * tile pair (bx, by), bx <= by, k = by * (by + 1) / 2 + bx, and swaps the
+ * two blocks through local memory. Launch T (T + 1) / 2 groups of
+ * (TILE_DIM, BLOCK_ROWS), T = ceil(n / TILE_DIM), as a 2D range of
+ * (TILE_DIM * groups, BLOCK_ROWS).
+ */
+__kernel void
+transpose_inplace
+(__global float *mat,
+ int n
  )
 {
-    int2 gid         = (int2)(get_global_id(0), get_global_id(1));
-    int2 lid         = (int2)(get_local_id(0), get_local_id(1));
-    /* int2 group_id    = (int2)(get_group_id(0), get_group_id(1)); */
-    int2 global_size = (int2)(get_global_size(0), get_global_size(1));
-    int2 local_size = (int2)(get_local_size(0), get_local_size(1));
-    /* int2 num_groups  = (int2)(get_num_groups(0), get_num_groups(1)); */
-
-    tile[lid.y * local_size.x + lid.x] = src[gid.y * global_size.x + gid.x];
+    __local float lower[TILE_DIM][TILE_DIM + 1];
+    __local float upper[TILE_DIM][TILE_DIM + 1];
+    int lx = get_local_id(0), ly = get_local_id(1);
+
+    int k  = get_group_id(0);
+    int by = (int)((sqrt(8.0f * k + 1.0f) - 1.0f) / 2.0f);
+    /* fix the float rounding of large k */
+    while (by * (by + 1) / 2 > k)
+        --by;
+    while ((by + 1) * (by + 2) / 2 <= k)
+        ++by;
+    int bx = k - by * (by + 1) / 2;
+    bx *= TILE_DIM;
+    by *= TILE_DIM;
+
+    /* lower = block (by, bx), upper = block (bx, by) */
+    for (int j = ly; j < TILE_DIM; j += BLOCK_ROWS) {
+        if (bx + lx < n && by + j < n)
+            lower[j][lx] = mat[(by + j) * n + bx + lx];
+        if (by + lx < n && bx + j < n)
+            upper[j][lx] = mat[(bx + j) * n + by + lx];
+    }
     barrier(CLK_LOCAL_MEM_FENCE);
-    trgt[gid.x * global_size.y + gid.y] = tile[lid.y * local_size.x + lid.x];
+
+    for (int j = ly; j < TILE_DIM; j += BLOCK_ROWS) {
+        if (by + lx < n && bx + j < n)
+            mat[(bx + j) * n + by + lx] = lower[lx][j];
+        if (bx != by && bx + lx < n && by + j < n)
+            mat[(by + j) * n + bx + lx] = upper[lx][j];
+    }
 }
-    /* int2 globalId = (int2)(get_global_id(0), get_global_id(1)); */
-    /* int2 localId = (int2)(get_local_id(0), get_local_id(1)); */
-    /* int2 groupId = (int2)(get_group_id (0), get_group_id (1)); */
-    /* int2 globalSize = (int2)(get_global_size(0), get_global_size(1)); */
-    /* int2 locallSize = (int2)(get_local_size(0), get_local_size(1)); */
-    /* int2 numberOfGrp = (int2)(get_num_groups (0), get_num_groups (1)); */
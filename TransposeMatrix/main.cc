@@ -9,29 +9,16 @@
 #include <string>
 #include <vector>
 
-#define CL_HPP_ENABLE_EXCEPTIONS
-#ifdef OPENCL_1
-#define CL_HPP_TARGET_OPENCL_VERSION 120
-#include <CL/cl.hpp>
-#else
-#define CL_HPP_TARGET_OPENCL_VERSION 200
-#include <CL/cl2.hpp>
-#endif
+#include "../cpu.hpp"
+#include "../host_buffer.hpp"
+#include "../runtime.hpp"
+#include "transpose.hpp"
 
 // #include "./h/ocl.err.h"
 // #include "./h/ocl.query.h"
 
 #define RANDOM_NUMBER_MAX 1000
 
-static inline auto ReadTextFile(const char *s)
-{
-  std::ifstream mfile(s);
-  std::string content((std::istreambuf_iterator<char>(mfile)),
-                      (std::istreambuf_iterator<char>()));
-  mfile.close();
-  return content;
-}
-
 static inline auto rand_gen()
 {
   std::random_device rd;
@@ -39,12 +26,13 @@ static inline auto rand_gen()
   return mt;
 }
 
+// in is rows x cols, out cols x rows
 void
-transpose_Host(float in[], float out[], int n)
+transpose_Host(float in[], float out[], int rows, int cols)
 {
-  for (int i = 0; i < n; i++)
-    for (int j = 0; j < n; j++)
-      out[i * n +j] = in[j * n + i];
+  for (int i = 0; i < cols; i++)
+    for (int j = 0; j < rows; j++)
+      out[i * rows + j] = in[j * cols + i];
 }
 
 int main(int argc, char* argv[])
@@ -53,24 +41,30 @@ int main(int argc, char* argv[])
 
   ios_base::sync_with_stdio(false);
 
-  if (argc != 4) {
+  if (argc < 4 || argc > 6) {
     cerr << R"(Correct way to execute this program is:
-./transpose platform-num data_size workgroup_size
-For example: ./transpose 0 1024 32 )";
+./transpose platform-num data_size workgroup_size [columns [stream_block]]
+For example: ./transpose 0 1024 32
+columns != data_size transposes a data_size x columns matrix with the tiled kernel only,
+stream_block also runs the out-of-core transpose with stream_block x stream_block tiles )";
     return 1;
   }
 
   size_t plat_num = atoi(argv[1]);
   int n_elem = atoi(argv[2]);
   int local_work_size = atoi(argv[3]);
+  int n_cols = argc >= 5 ? atoi(argv[4]) : n_elem;
+  size_t stream_block = argc == 6 ? atoi(argv[5]) : 0;
+  bool square = n_cols == n_elem;
 
-  cl_int d1_err, d2_err;
+  cl_int d1_err = CL_SUCCESS, d2_err, d3_err = CL_SUCCESS;
 
-  vector<float> h_data(n_elem * n_elem); // host, data
-  vector<float> h_output(n_elem * n_elem); // host, output
-  vector<float> d1_output(n_elem * n_elem); // device, output
-  vector<float> d2_output(n_elem * n_elem); // device, output
-  // vector<float> d3_output(n_elem * n_elem); // device, output
+  vector<float> h_data(n_elem * n_cols); // host, data
+  vector<float> h_output(n_elem * n_cols); // host, output
+  vector<float> d1_output(n_elem * n_cols); // device, output
+  vector<float> d2_output(n_elem * n_cols); // device, output
+  vector<float> d3_output(n_elem * n_cols); // device, output
+  vector<float> d4_output(n_elem * n_cols); // streamed, output
 
   // fill A with random doubles
   uniform_real_distribution<> dis(0, RANDOM_NUMBER_MAX);
@@ -79,47 +73,56 @@ For example: ./transpose 0 1024 32 )";
 
   // copy(A.begin(), A.end(), ostream_iterator<double>(cout, " "));  // print all elements
   auto t1_serial = chrono::high_resolution_clock::now();
-  transpose_Host(h_data.data(), h_output.data(), n_elem);
+  transpose_Host(h_data.data(), h_output.data(), n_elem, n_cols);
   auto t2_serial = chrono::high_resolution_clock::now();
 
+  // cache blocked, SIMD, all cores: the fair baseline
+  vector<float> c_output(n_elem * n_cols); // cpu backend, output
+  auto t1_cpu = chrono::high_resolution_clock::now();
+  CpuTranspose()(h_data.data(), c_output.data(), n_elem, n_cols);
+  auto t2_cpu = chrono::high_resolution_clock::now();
 
-  // Initialize OpenCL
-  std::vector<cl::Platform> platforms;
-  cl::Platform::get(&platforms);
-  assert(plat_num < platforms.size());
-  auto platform = platforms[plat_num]; // here you can select between Intel, AMD or Nvidia
-  std::vector<cl::Device> devices;
-  platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-  auto device = devices.front(); // here you can select between different Accelerators
-  auto context = cl::Context(device);
 
-  // Read the program source
-  cl::Program program = cl::Program(context, ReadTextFile("./kernel.cl"), CL_FALSE);
+  // Initialize OpenCL, the platform index comes from the command line;
+  // without a device only the host and CPU backend times are reported
+  DeviceSelector selector = DeviceSelector::fromEnv();
+  selector.platform = (int)plat_num;
+  unique_ptr<Runtime> runtime;
   try {
+    runtime.reset(new Runtime(selectDevice(selector)));
+  } catch (cl::Error &error) {
+    cout << "[WARN] no OpenCL device (" << error.what() << "), CPU backend only\n";
+    cout << fixed << showpoint;
+    cout.precision(6);
+    cout << "[INFO] Serial time:\t" << chrono::duration<double, milli>(t2_serial - t1_serial).count()
+         << "ms\n[INFO] CPU time:\t" << chrono::duration<double, milli>(t2_cpu - t1_cpu).count()
+         << "ms (" << cpuIsaName() << ", " << cpuThreads() << " threads) "
+         << (h_output == c_output ? "Ok" : "Error") << endl;
+    return h_output == c_output ? 0 : 1;
+  }
+  Runtime &rt = *runtime;
+  rt.printInfo();
+  auto context = rt.context();
+
+  // Build the program
 #ifndef OPENCL_1
-    program.build("-cl-std=CL2.0 -cl-mad-enable -cl-fast-relaxed-math");
+  const char *build_options = "-cl-std=CL2.0 -cl-mad-enable -cl-fast-relaxed-math";
 #else
-    cout << "[WARN] operating in OpenCL 1.x mode\n";
-    program.build("-cl-mad-enable  -cl-fast-relaxed-math");
+  cout << "[WARN] operating in OpenCL 1.x mode\n";
+  const char *build_options = "-cl-mad-enable  -cl-fast-relaxed-math";
 #endif
+  try {
+    rt.program("./kernel.cl", build_options);
   } catch (...) {
-#ifndef OPENCL_1
-    // Print build info for all devices
-    cl_int buildErr = CL_SUCCESS;
-    auto buildInfo = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(&buildErr);
-    for (auto &pair : buildInfo) {
-      cerr << pair.second << endl << endl;
-    }
-#else
     cerr << "building program failed" << endl;
-#endif
     return 1;
   }
 
   // Select kernel
-  auto ker_trans_per_elem = cl::Kernel(program, "transpose_parallel_per_element");
-  // auto ker = cl::Kernel(program, "transpose_parallel_per_element");
-  auto ker_trans_per_elem_tiled = cl::Kernel(program, "transpose_parallel_per_element_tiled");
+  auto ker_trans_per_elem = rt.kernel("./kernel.cl", "transpose_parallel_per_element", build_options);
+  // auto ker = rt.kernel("./kernel.cl", "transpose_parallel_per_element", build_options);
+  // tiled and in-place, block shape picked for the device
+  Transpose transpose(rt, build_options);
 
   // Cerate the device memory buffers
   auto buf_src = cl::Buffer
@@ -127,17 +130,28 @@ For example: ./transpose 0 1024 32 )";
   auto buf_target = cl::Buffer
     (context, CL_MEM_WRITE_ONLY, d1_output.size() * sizeof(d1_output[0]));
 
-  auto queue = cl::CommandQueue(context, device);
+  auto &queue = rt.queue();
 
   chrono::time_point<chrono::high_resolution_clock> ti_trans_per_elem, te_trans_per_elem;
-  {  //
+  if (square) {  // the naive kernel only handles n x n
     ker_trans_per_elem.setArg(0, buf_src);
     ker_trans_per_elem.setArg(1, buf_target);
 
     ti_trans_per_elem = chrono::high_resolution_clock::now();
 
+    // the kernel has no bounds check, so the work-group side must divide
+    // n, and side x side must fit the kernel
+    size_t limit = ker_trans_per_elem.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt.device());
+    size_t side = max(local_work_size, 0);
+    while (side * side > limit)
+      --side;
+    side = fitLocal(n_elem, side);
+    if (local_work_size > 0 && side != (size_t)local_work_size)
+      cerr << "[WARN] workgroup_size " << local_work_size << " does not fit " << n_elem
+           << " x " << n_elem << ", "
+           << (side ? "using " + to_string(side) : string("the runtime picks one")) << '\n';
     cl::NDRange global(n_elem, n_elem);
-    cl::NDRange local(local_work_size, local_work_size);
+    cl::NDRange local = side ? cl::NDRange(side, side) : cl::NullRange;
 
     d1_err =  queue.enqueueWriteBuffer
       (buf_src, CL_TRUE, 0, h_data.size() * sizeof(float), h_data.data());
@@ -151,49 +165,113 @@ For example: ./transpose 0 1024 32 )";
 
   chrono::time_point<chrono::high_resolution_clock> ti_trans_per_elem_tiled, te_trans_per_elem_tiled;
   {  //
-    ker_trans_per_elem_tiled.setArg(0, buf_src);
-    ker_trans_per_elem_tiled.setArg(1, buf_target);
-    ker_trans_per_elem_tiled.setArg(2, local_work_size * local_work_size * sizeof(float), nullptr);
-
     ti_trans_per_elem_tiled = chrono::high_resolution_clock::now();
 
-    cl::NDRange global(n_elem, n_elem);
-    cl::NDRange local(local_work_size, local_work_size);
-
     d2_err =  queue.enqueueWriteBuffer
       (buf_src, CL_TRUE, 0, h_data.size() * sizeof(float), h_data.data());
-    d2_err |= queue.enqueueNDRangeKernel
-      (ker_trans_per_elem_tiled, cl::NullRange, global, local);
+    transpose(queue, buf_src, buf_target, n_elem, n_cols);
     d2_err |= queue.enqueueReadBuffer
       (buf_target, CL_TRUE, 0, d2_output.size() * sizeof(float), d2_output.data());
     d2_err |= queue.finish();
     te_trans_per_elem_tiled = chrono::high_resolution_clock::now();
   }
 
+  chrono::time_point<chrono::high_resolution_clock> ti_trans_inplace, te_trans_inplace;
+  if (square) {  //
+    auto buf_mat = cl::Buffer
+      (context, CL_MEM_READ_WRITE, h_data.size() * sizeof(float));
+
+    ti_trans_inplace = chrono::high_resolution_clock::now();
+
+    d3_err =  queue.enqueueWriteBuffer
+      (buf_mat, CL_TRUE, 0, h_data.size() * sizeof(float), h_data.data());
+    transpose.inPlace(queue, buf_mat, n_elem);
+    d3_err |= queue.enqueueReadBuffer
+      (buf_mat, CL_TRUE, 0, d3_output.size() * sizeof(float), d3_output.data());
+    d3_err |= queue.finish();
+    te_trans_inplace = chrono::high_resolution_clock::now();
+  }
+
+  // the tiled kernel straight on host-visible memory, no copies where the
+  // device allows, in every memory mode it runs
+  struct SharedRun { MemMode mode; double ms; bool ok; };
+  vector<SharedRun> shared_runs;
+  for (MemMode mode : memModes(rt.device())) {
+    HostBuffer<float> shared_src(rt, h_data.size(), mode, CL_MEM_READ_ONLY);
+    HostBuffer<float> shared_dst(rt, h_data.size(), mode, CL_MEM_WRITE_ONLY);
+    copy(h_data.begin(), h_data.end(), shared_src.data());
+
+    auto ti_trans_shared = chrono::high_resolution_clock::now();
+    shared_src.toDevice(queue);
+    shared_dst.toDevice(queue);
+    transpose(queue, shared_src.buffer(), shared_dst.buffer(), n_elem, n_cols);
+    shared_dst.toHost(queue);
+    auto te_trans_shared = chrono::high_resolution_clock::now();
+
+    shared_runs.push_back({mode, chrono::duration<double, milli>(te_trans_shared - ti_trans_shared).count(),
+                           equal(h_output.begin(), h_output.end(), shared_dst.data())});
+  }
+
+  chrono::time_point<chrono::high_resolution_clock> ti_trans_stream, te_trans_stream;
+  if (stream_block) {  // host to host, tile by tile
+    StreamingTranspose stream(rt, build_options, stream_block);
+
+    ti_trans_stream = chrono::high_resolution_clock::now();
+    stream(h_data.data(), d4_output.data(), n_elem, n_cols);
+    te_trans_stream = chrono::high_resolution_clock::now();
+  }
+
   double
     serial_time                = chrono::duration<double, milli>(t2_serial - t1_serial).count(),
+    cpu_time                   = chrono::duration<double, milli>(t2_cpu - t1_cpu).count(),
     ocl_per_elem_time          = chrono::duration<double, milli>(te_trans_per_elem - ti_trans_per_elem).count(),
-    ocl_per_elem_tiled_time    = chrono::duration<double, milli>(te_trans_per_elem_tiled - ti_trans_per_elem_tiled).count();
+    ocl_per_elem_tiled_time    = chrono::duration<double, milli>(te_trans_per_elem_tiled - ti_trans_per_elem_tiled).count(),
+    ocl_inplace_time           = chrono::duration<double, milli>(te_trans_inplace - ti_trans_inplace).count(),
+    ocl_stream_time            = chrono::duration<double, milli>(te_trans_stream - ti_trans_stream).count();
   // copy(h_data.begin(), h_data.end(), ostream_iterator<float>(cout , " ")); cout << endl;
 
   cout << fixed << showpoint;
   cout.precision(6);
-  cout << "[INFO] Serial time:\t"   << serial_time << "ms\n\n";
+  cout << "[INFO] Serial time:\t"   << serial_time << "ms\n";
+  cout << "[INFO] CPU time:\t"      << cpu_time << "ms (" << cpuIsaName() << ", "
+       << cpuThreads() << " threads) "
+       << ((const char* []){"Error","Ok"})[h_output == c_output] << "\n\n";
   // copy(h_output.begin(), h_output.end(), ostream_iterator<float>(cout , " ")); cout << endl;
 
-  cout << "Transpose_per_element: " << ocl_per_elem_time << "\n";
-  cout << "Verifiying transpose_per_element... "
-       << ((const char* []){"Error","Ok"})[mismatch(h_output.begin(), h_output.end(), d1_output.begin()).first == h_output.end()]
-       << "\ncl_err status = " << d1_err
-       << "\n";
-  // copy(d1_output.begin(), d1_output.end(), ostream_iterator<float>(cout , " ")); cout << endl;
+  if (square) {
+    cout << "Transpose_per_element: " << ocl_per_elem_time << "\n";
+    cout << "Verifiying transpose_per_element... "
+         << ((const char* []){"Error","Ok"})[mismatch(h_output.begin(), h_output.end(), d1_output.begin()).first == h_output.end()]
+         << "\ncl_err status = " << d1_err
+         << "\n";
+    // copy(d1_output.begin(), d1_output.end(), ostream_iterator<float>(cout , " ")); cout << endl;
+  }
 
-  cout << "Transpose_per_element_tiled: " << ocl_per_elem_tiled_time << "\n";
-  cout << "Verifiying transpose_per_element_tiled... "
+  cout << "Transpose_tiled: " << ocl_per_elem_tiled_time << "\n";
+  cout << "Verifiying transpose_tiled... "
        << ((const char* []){"Error","Ok"})[mismatch(h_output.begin(), h_output.end(), d2_output.begin()).first == h_output.end()]
        << "\ncl_err status = " << d2_err
        << "\n";
   // copy(d2_output.begin(), d2_output.end(), ostream_iterator<float>(cout , " ")); cout << endl;
+
+  if (square) {
+    cout << "Transpose_inplace: " << ocl_inplace_time << "\n";
+    cout << "Verifiying transpose_inplace... "
+         << ((const char* []){"Error","Ok"})[mismatch(h_output.begin(), h_output.end(), d3_output.begin()).first == h_output.end()]
+         << "\ncl_err status = " << d3_err
+         << "\n";
+  }
+
+  for (auto &shared : shared_runs)
+    cout << "Transpose_shared (" << memModeName(shared.mode) << "): " << shared.ms << "\n"
+         << "Verifiying transpose_shared... " << (shared.ok ? "Ok" : "Error") << "\n";
+
+  if (stream_block) {
+    cout << "Transpose_stream: " << ocl_stream_time << "\n";
+    cout << "Verifiying transpose_stream... "
+         << ((const char* []){"Error","Ok"})[mismatch(h_output.begin(), h_output.end(), d4_output.begin()).first == h_output.end()]
+         << "\n";
+  }
   cout << endl;
 
 
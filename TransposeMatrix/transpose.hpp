@@ -0,0 +1,171 @@
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+
+/*
+ * Tiled float matrix transpose (transpose_tiled / transpose_inplace in
+ * kernel.cl): any rows x cols out of place, square matrices in place.
+ * The block is TILE_DIM square, moved by TILE_DIM x BLOCK_ROWS work-items:
+ * the tuned (tile, rows) of the device when there are some, shrunk until
+ * the kernels accept the work-group.
+ */
+class Transpose {
+public:
+  explicit Transpose(Runtime &rt, const std::string &options = "") : rt_(rt), options_(options) {
+    std::vector<size_t> tuned;
+    if (tunedValues(rt_.tuning(), tuningName(), 2, tuned)) {
+      tile_ = tuned[0];
+      rows_ = std::min(tuned[1], tile_);
+    }
+    compile();
+
+    size_t limit = std::min(tiled_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()),
+                            inplace_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()));
+    if (localSize() > limit) {
+      while (tile_ * rows_ > limit)
+        (rows_ > 1 ? rows_ : tile_) /= 2;
+      compile();
+    }
+  }
+
+  size_t tile() const { return tile_; }
+  size_t localSize() const { return tile_ * rows_; }
+
+  /* Tuning entry: tile, rows */
+  static const char *tuningName() { return "Transpose"; }
+  std::vector<size_t> tuning() const { return {tile_, rows_}; }
+
+  /* dst (cols x rows) = transpose of src (rows x cols), both row-major */
+  void operator()(const cl::CommandQueue &queue, const cl::Buffer &src, const cl::Buffer &dst,
+                  size_t rows, size_t cols, std::vector<cl::Event> *events = nullptr) {
+    cl::Event ev;
+    tiled_.setArg(0, src);
+    tiled_.setArg(1, dst);
+    tiled_.setArg(2, (int)rows);
+    tiled_.setArg(3, (int)cols);
+    queue.enqueueNDRangeKernel(tiled_, cl::NullRange,
+                               cl::NDRange(blocks(cols) * tile_, blocks(rows) * rows_),
+                               cl::NDRange(tile_, rows_), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+  /* mat (n x n) = its transpose */
+  void inPlace(const cl::CommandQueue &queue, const cl::Buffer &mat, size_t n,
+               std::vector<cl::Event> *events = nullptr) {
+    size_t t = blocks(n), pairs = t * (t + 1) / 2;
+    cl::Event ev;
+    inplace_.setArg(0, mat);
+    inplace_.setArg(1, (int)n);
+    queue.enqueueNDRangeKernel(inplace_, cl::NullRange, cl::NDRange(pairs * tile_, rows_),
+                               cl::NDRange(tile_, rows_), nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+private:
+  size_t blocks(size_t n) const { return (n + tile_ - 1) / tile_; }
+
+  void compile() {
+    cl::Program &program =
+        rt_.program("TransposeMatrix/kernel.cl", options_ + " -D TILE_DIM=" + std::to_string(tile_) +
+                                                     " -D BLOCK_ROWS=" + std::to_string(rows_));
+    tiled_ = cl::Kernel(program, "transpose_tiled");
+    inplace_ = cl::Kernel(program, "transpose_inplace");
+  }
+
+  Runtime &rt_;
+  std::string options_;
+  size_t tile_ = 32, rows_ = 8;
+  cl::Kernel tiled_, inplace_;
+};
+
+/*
+ * Out-of-core transpose of a host matrix of any size. The matrix is cut
+ * into block x block tiles; tile (i, j) is uploaded with a rect copy,
+ * transposed on the device and written back as tile (j, i). Tiles rotate
+ * over `slots` buffer pairs, each with its own in-order queue, so one
+ * slot's transfers overlap the other slots' kernels and transfers. Tiles
+ * go in (i, j), (j, i) pairs so both halves of a swap are in flight
+ * together.
+ */
+class StreamingTranspose {
+public:
+  /* block = 0 sizes tiles to a quarter of device memory over all slots */
+  StreamingTranspose(Runtime &rt, const std::string &options = "", size_t block = 0,
+                     size_t slots = 2)
+      : transpose_(rt, options), block_(block ? block : defaultBlock(rt, slots)) {
+    size_t bytes = block_ * block_ * sizeof(float);
+    for (size_t i = 0; i < slots; ++i)
+      slots_.push_back({rt.createQueue(), cl::Buffer(rt.context(), CL_MEM_READ_ONLY, bytes),
+                        cl::Buffer(rt.context(), CL_MEM_WRITE_ONLY, bytes)});
+  }
+
+  size_t block() const { return block_; }
+
+  /* dst (cols x rows) = transpose of src (rows x cols), both row-major host
+   * memory; returns once dst is complete */
+  void operator()(const float *src, float *dst, size_t rows, size_t cols) {
+    const size_t tr = (rows + block_ - 1) / block_, tc = (cols + block_ - 1) / block_;
+    size_t next = 0;
+
+    auto tile = [&](size_t i, size_t j) {
+      Slot &slot = slots_[next++ % slots_.size()];
+      size_t r0 = i * block_, c0 = j * block_;
+      size_t h = std::min(block_, rows - r0), w = std::min(block_, cols - c0);
+      cl::array<cl::size_type, 3> zero = {0, 0, 0};
+
+      // rows r0.. / cols c0.. of src, packed w wide on the device
+      cl::array<cl::size_type, 3> from = {c0 * sizeof(float), r0, 0};
+      cl::array<cl::size_type, 3> inRegion = {w * sizeof(float), h, 1};
+      slot.queue.enqueueWriteBufferRect(slot.in, CL_FALSE, zero, from, inRegion,
+                                        w * sizeof(float), 0, cols * sizeof(float), 0, src);
+      transpose_(slot.queue, slot.in, slot.out, h, w);
+
+      // lands at rows c0.. / cols r0.. of dst
+      cl::array<cl::size_type, 3> to = {r0 * sizeof(float), c0, 0};
+      cl::array<cl::size_type, 3> outRegion = {h * sizeof(float), w, 1};
+      slot.queue.enqueueReadBufferRect(slot.out, CL_FALSE, zero, to, outRegion,
+                                       h * sizeof(float), 0, rows * sizeof(float), 0, dst);
+      slot.queue.flush();
+    };
+
+    for (size_t i = 0; i < std::max(tr, tc); ++i)
+      for (size_t j = i; j < std::max(tr, tc); ++j) {
+        if (i < tr && j < tc)
+          tile(i, j);
+        if (i != j && j < tr && i < tc)
+          tile(j, i);
+      }
+
+    for (auto &slot : slots_)
+      slot.queue.finish();
+  }
+
+private:
+  struct Slot {
+    cl::CommandQueue queue;
+    cl::Buffer in, out;
+  };
+
+  static size_t defaultBlock(Runtime &rt, size_t slots) {
+    size_t memory = rt.device().getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 4;
+    size_t alloc = rt.device().getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    size_t block = 16384;
+    while (block > 256 && (2 * slots * block * block * sizeof(float) > memory ||
+                           block * block * sizeof(float) > alloc))
+      block /= 2;
+    return block;
+  }
+
+  Transpose transpose_;
+  size_t block_;
+  std::vector<Slot> slots_;
+};
+
+#endif
@@ -1,19 +1,11 @@
-#define __CL_ENABLE_EXCEPTIONS
-
-#include <CL/cl.hpp>
-
-#include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
 
-std::string ReadTextFile(const char *s) {
-  std::ifstream mfile(s);
-  std::string content((std::istreambuf_iterator<char>(mfile)),
-		      (std::istreambuf_iterator<char>()));
-  mfile.close();
-  return content;
-}
+#include "../cpu.hpp"
+#include "../runtime.hpp"
+#include "map.hpp"
 
 int main() {
   const int elements = 2048 * 16;
@@ -26,64 +18,64 @@ int main() {
   for (int i = 0; i < elements; i++)
     A[i] = B[i] = i;
 
-  try {
-  // Query for platforms
-  std::vector<cl::Platform> platform;
-  cl::Platform::get(&platform);
-
-  // Get a list of devices on this platform
-  std::vector<cl::Device> devices;
-  platform[0].getDevices(CL_DEVICE_TYPE_ALL, &devices);
-
-  // Create a context for the devices
-  cl::Context context(devices);
-
-  // Create a command-queue for the first device
-  cl::CommandQueue queue = cl::CommandQueue(context, devices[0]);
+  // Shared context, queue and program registry for the selected device,
+  // none means the CPU backend does the add
+  Runtime *runtime = runtimeOrCpu();
+  if (!runtime) {
+    cpuVecadd(A, B, C, elements);
+    int wrong = 0;
+    for (int i = 0; i < elements; i++)
+      wrong += C[i] != A[i] + B[i];
+    std::cout << "[INFO] cpu vecadd (" << cpuIsaName() << "): " << (wrong ? "Error" : "Ok")
+              << std::endl;
+  } else try {
+  Runtime &rt = *runtime;
+  cl::CommandQueue &queue = rt.queue();
 
   // Cerate the device memory buffers
-  cl::Buffer bufferA = cl::Buffer(context, CL_MEM_READ_ONLY, datasize);
-  cl::Buffer bufferB = cl::Buffer(context, CL_MEM_READ_ONLY, datasize);
-  cl::Buffer bufferC = cl::Buffer(context, CL_MEM_WRITE_ONLY, datasize);
+  cl::Buffer bufferA = cl::Buffer(rt.context(), CL_MEM_READ_ONLY, datasize);
+  cl::Buffer bufferB = cl::Buffer(rt.context(), CL_MEM_READ_ONLY, datasize);
+  cl::Buffer bufferC = cl::Buffer(rt.context(), CL_MEM_WRITE_ONLY, datasize);
 
   // Copy the input data to the input buffers using command-queue for first
   // deivce
   queue.enqueueWriteBuffer(bufferA, CL_TRUE, 0, datasize, A);
   queue.enqueueWriteBuffer(bufferB, CL_TRUE, 0, datasize, B);
 
-  // Read the program source
-  std::string sourceCode = ReadTextFile("./adder.cl");
-  cl::Program::Sources source(
-      1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
-
-  // Create the program from the source code
-  cl::Program program = cl::Program(context, source);
-
-  // Build the program for the devices
-  try {
-    program.build(devices);
-  } catch (cl::Error error) {
-    cl::STRING_CLASS buildlog;
-    program.getBuildInfo(devices[0], CL_PROGRAM_BUILD_LOG, &buildlog);
-    std::cout << buildlog << std::endl;
-  }
-
-  // Create the kernel
-  cl::Kernel vecadd_kernel(program, "vecadd");
+  // Fetch the kernel, the program is built on first use
+  cl::Kernel &vecadd_kernel = rt.kernel("./adder.cl", "vecadd");
 
   // Set the kernel arguments
   vecadd_kernel.setArg(0, bufferA);
   vecadd_kernel.setArg(1, bufferB);
   vecadd_kernel.setArg(2, bufferC);
 
-  // Execute the kernel
+  // Execute the kernel with the device's tuned work-group size, fitted to
+  // elements as the kernel has no bounds check; untuned, the runtime picks
+  std::vector<size_t> tuned;
+  size_t fit = 0;
+  if (tunedValues(rt.tuning(), "vecadd", 1, tuned))
+    fit = fitLocal(elements, std::min<size_t>(
+        tuned[0], vecadd_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt.device())));
   cl::NDRange global(elements);
-  cl::NDRange local(256);
+  cl::NDRange local = fit ? cl::NDRange(fit) : cl::NullRange;
   queue.enqueueNDRangeKernel(vecadd_kernel, cl::NullRange, global, local);
   // Copy the output data back to the host
   queue.enqueueReadBuffer(bufferC, CL_TRUE, 0, datasize, C);
   queue.flush();
 
+  // The same add with two more stages fused in, one pass and no temporaries
+  Map fused(rt, "int", 2);
+  fused.then("a + b").then("x * 3").then("x - a");
+  fused(queue, {bufferA, bufferB}, bufferC, elements);
+  queue.enqueueReadBuffer(bufferC, CL_TRUE, 0, datasize, C);
+
+  int wrong = 0;
+  for (int i = 0; i < elements; i++)
+    wrong += C[i] != (A[i] + B[i]) * 3 - A[i];
+  std::cout << "[INFO] fused map (" << fused.width() << " wide): "
+            << (wrong ? "Error" : "Ok") << std::endl;
+
   // for (size_t i = 0; i < elements; i++)
     // std::cout << C[i] << ' ' ;
   // std::cout << std::endl;
@@ -0,0 +1,146 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../runtime.hpp"
+
+/*
+ * Element-wise map generated from OpenCL C snippets. Inputs are named a,
+ * b, c, d; every stage added with then() assigns x, which starts as a, so
+ *
+ *   Map(rt, "float", 2).then("a + b").then("x * 2.0f").then("sin(x)")
+ *
+ * runs add -> scale -> sin as one kernel pass with no intermediate
+ * buffers. The body is compiled twice, for a vector of width() elements
+ * (vloadN/vstoreN) and for the scalar tail, so snippets must be valid for
+ * both: arithmetic, builtins and literals are, and CONVERT_T(v) /
+ * CONVERT_FLOAT(v) convert to the element / float type of either width.
+ * Programs go through Runtime::programFromSource, so equal chains share
+ * one build and the on-disk cache. The width and work-group size are the
+ * device's tuned ones for the element type when it has some.
+ */
+class Map {
+public:
+  Map(Runtime &rt, const std::string &type, unsigned arity = 1)
+      : rt_(rt), type_(type), arity_(arity) {
+    if (arity_ < 1 || arity_ > 4)
+      throw cl::Error(CL_INVALID_VALUE, "Map: 1 to 4 inputs");
+    static const std::map<std::string, size_t> sizes = {
+        {"char", 1}, {"uchar", 1}, {"short", 2}, {"ushort", 2}, {"int", 4},
+        {"uint", 4}, {"float", 4}, {"long", 8},  {"ulong", 8},  {"double", 8}};
+    auto it = sizes.find(type_);
+    if (it == sizes.end())
+      throw cl::Error(CL_INVALID_VALUE, "Map: unsupported element type");
+    // 32 byte accesses where the CPU has AVX-wide lanes, 16 byte elsewhere
+    bool cpu = rt_.device().getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU;
+    width_ = std::min<size_t>((cpu ? 32 : 16) / it->second, 16);
+    std::vector<size_t> tuned;
+    // vloadN exists for N = 2, 4, 8, 16
+    if (tunedValues(rt_.tuning(), tuningName(type_), 2, tuned) && tuned[0] >= 2 &&
+        tuned[0] <= 16 && (tuned[0] & (tuned[0] - 1)) == 0) {
+      width_ = tuned[0];
+      local_ = tuned[1];
+    }
+  }
+
+  /* Appends a fused stage: x = (expr) */
+  Map &then(const std::string &expr) {
+    stages_.push_back(expr);
+    kernel_ = cl::Kernel();
+    return *this;
+  }
+
+  size_t width() const { return width_; }
+
+  /* Tuning entry per element type: vector width, work-group size */
+  static std::string tuningName(const std::string &type) { return "Map." + type; }
+  std::vector<size_t> tuning() const { return {width_, local_}; }
+
+  std::string source() const {
+    const std::string vec = type_ + std::to_string(width_), w = std::to_string(width_);
+    std::ostringstream src;
+    if (type_ == "double")
+      src << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+
+    // the same body for both widths
+    auto function = [&](const std::string &name, const std::string &t, const std::string &f) {
+      src << "#define CONVERT_T(v) convert_" << t << "(v)\n"
+          << "#define CONVERT_FLOAT(v) convert_" << f << "(v)\n"
+          << t << ' ' << name << '(' << params(t) << ") {\n"
+          << "  " << t << " x = a;\n";
+      for (auto &stage : stages_)
+        src << "  x = (" << stage << ");\n";
+      src << "  return x;\n}\n"
+          << "#undef CONVERT_T\n#undef CONVERT_FLOAT\n";
+    };
+    function("map_vector", vec, "float" + w);
+    function("map_scalar", type_, "float");
+
+    src << "__kernel void map(";
+    for (unsigned i = 0; i < arity_; ++i)
+      src << "__global const " << type_ << " *in" << i << ", ";
+    src << "__global " << type_ << " *out, ulong n) {\n"
+        << "  size_t i = get_global_id(0) * " << w << ";\n"
+        << "  if (i + " << w << " <= n) {\n"
+        << "    vstore" << w << "(map_vector(" << args("vload" + w + "(0, in", " + i)")
+        << "), 0, out + i);\n"
+        << "  } else {\n"
+        << "    for (; i < n; ++i)\n"
+        << "      out[i] = map_scalar(" << args("in", "[i]") << ");\n"
+        << "  }\n}\n";
+    return src.str();
+  }
+
+  /* out[i] = chain(inputs[0][i], ...) for i < n */
+  void operator()(const cl::CommandQueue &queue, const std::vector<cl::Buffer> &inputs,
+                  const cl::Buffer &out, size_t n, std::vector<cl::Event> *events = nullptr) {
+    if (inputs.size() != arity_)
+      throw cl::Error(CL_INVALID_VALUE, "Map: wrong number of inputs");
+    if (!kernel_())
+      kernel_ = cl::Kernel(rt_.programFromSource(source()), "map");
+
+    cl::Event ev;
+    for (unsigned i = 0; i < arity_; ++i)
+      kernel_.setArg(i, inputs[i]);
+    kernel_.setArg(arity_, out);
+    kernel_.setArg(arity_ + 1, (cl_ulong)n);
+    // items past the end skip the scalar tail, so the range may round up
+    size_t items = (n + width_ - 1) / width_;
+    if (local_ && local_ > kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()))
+      local_ = 0;
+    queue.enqueueNDRangeKernel(kernel_, cl::NullRange,
+                               cl::NDRange(local_ ? (items + local_ - 1) / local_ * local_ : items),
+                               local_ ? cl::NDRange(local_) : cl::NullRange, nullptr, &ev);
+    if (events)
+      events->push_back(ev);
+  }
+
+private:
+  std::string params(const std::string &t) const {
+    std::string s;
+    for (unsigned i = 0; i < arity_; ++i)
+      s += (i ? ", " : "") + t + ' ' + char('a' + i);
+    return s;
+  }
+
+  std::string args(const std::string &prefix, const std::string &suffix) const {
+    std::string s;
+    for (unsigned i = 0; i < arity_; ++i)
+      s += (i ? ", " : "") + prefix + std::to_string(i) + suffix;
+    return s;
+  }
+
+  Runtime &rt_;
+  std::string type_;
+  unsigned arity_;
+  size_t width_, local_ = 0; // 0: the runtime picks the work-group
+  std::vector<std::string> stages_;
+  cl::Kernel kernel_;
+};
+
+#endif
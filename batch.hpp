@@ -0,0 +1,31 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <algorithm>
+
+#include "runtime.hpp"
+
+/*
+ * Images of itemBytes a device batch may hold when `copies` arrays of the
+ * whole batch (input, output, intermediates) are resident at once: half of
+ * global memory between them, every array within the allocation limit and,
+ * for image arrays, within the device's layer limit. At least 1.
+ */
+inline size_t batchCapacity(const cl::Device &device, size_t itemBytes, size_t copies = 2,
+                            bool layered = true) {
+  size_t global = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 2;
+  size_t alloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+  size_t n = std::min(global / std::max<size_t>(copies, 1), alloc) / std::max<size_t>(itemBytes, 1);
+  if (layered)
+    n = std::min(n, (size_t)device.getInfo<CL_DEVICE_IMAGE_MAX_ARRAY_SIZE>());
+  return std::max<size_t>(n, 1);
+}
+
+/* fn(first, count) over [0, n) in batches of at most capacity */
+template <class Fn> inline void forEachBatch(size_t n, size_t capacity, Fn fn) {
+  capacity = std::max<size_t>(capacity, 1);
+  for (size_t first = 0; first < n; first += capacity)
+    fn(first, std::min(capacity, n - first));
+}
+
+#endif
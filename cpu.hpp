@@ -0,0 +1,718 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLP_X86 1
+#endif
+
+#include "GaussianBlurFilter/blur.hpp"
+#include "GaussianBlurFilter/convolution.hpp"
+#include "Rotate/warp.hpp"
+
+/*
+ * CPU reference backend. Every primitive mirrors its OpenCL class (same
+ * constructor parameters minus the Runtime, same methods) over host
+ * pointers in the same packed layouts, and gives the same results up to
+ * float rounding. Work is split over cpuThreads() threads and image
+ * filters run on cache sized row strips. The convolution (axpy) and vecadd
+ * inner loops use AVX-512 or AVX2/FMA when the CPU has them, transpose
+ * blocks and nearest / bilinear warps of 4 channel images AVX2; everything
+ * else is plain C++: histogram counting is a scatter of increments, and
+ * libm has no vector sin/cos for the vector operation.
+ *
+ * CLP_CPU_THREADS caps the thread count, CLP_CPU_ISA (scalar|avx2|avx512)
+ * the instruction set.
+ */
+
+enum class CpuIsa { Scalar = 0, Avx2 = 1, Avx512 = 2 };
+
+inline CpuIsa detectCpuIsa() {
+  CpuIsa isa = CpuIsa::Scalar;
+#ifdef CLP_X86
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    isa = CpuIsa::Avx2;
+  if (isa == CpuIsa::Avx2 && __builtin_cpu_supports("avx512f"))
+    isa = CpuIsa::Avx512;
+#endif
+  if (const char *s = std::getenv("CLP_CPU_ISA")) {
+    std::string want = s;
+    CpuIsa cap = want == "scalar" ? CpuIsa::Scalar : want == "avx2" ? CpuIsa::Avx2 : isa;
+    isa = std::min(isa, cap);
+  }
+  return isa;
+}
+
+inline CpuIsa cpuIsa() {
+  static const CpuIsa isa = detectCpuIsa();
+  return isa;
+}
+
+inline const char *cpuIsaName(CpuIsa isa = cpuIsa()) {
+  return isa == CpuIsa::Avx512 ? "avx512" : isa == CpuIsa::Avx2 ? "avx2" : "scalar";
+}
+
+inline size_t cpuThreads() {
+  size_t n = std::max(1u, std::thread::hardware_concurrency());
+  if (const char *s = std::getenv("CLP_CPU_THREADS"))
+    n = std::max(1, std::atoi(s));
+  return n;
+}
+
+/* fn(begin, end) over contiguous chunks of [0, n), at least grain items
+ * each, the calling thread takes the first chunk */
+template <class Fn> inline void parallelFor(size_t n, Fn fn, size_t grain = 1) {
+  size_t threads = std::min(cpuThreads(), (n + grain - 1) / std::max<size_t>(grain, 1));
+  if (threads <= 1) {
+    fn(0, n);
+    return;
+  }
+  size_t chunk = (n + threads - 1) / threads;
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t)
+    pool.emplace_back(fn, std::min(n, t * chunk), std::min(n, (t + 1) * chunk));
+  fn(0, std::min(n, chunk));
+  for (auto &t : pool)
+    t.join();
+}
+
+/* y[i] += w * x[i] */
+inline void axpyScalar(float w, const float *x, float *y, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    y[i] += w * x[i];
+}
+
+/* c[i] = a[i] + b[i] */
+inline void addScalar(const int *a, const int *b, int *c, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    c[i] = a[i] + b[i];
+}
+
+#ifdef CLP_X86
+__attribute__((target("avx2,fma"))) inline void axpyAvx2(float w, const float *x, float *y,
+                                                           size_t n) {
+  __m256 vw = _mm256_set1_ps(w);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(vw, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  axpyScalar(w, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f"))) inline void axpyAvx512(float w, const float *x, float *y,
+                                                          size_t n) {
+  __m512 vw = _mm512_set1_ps(w);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(vw, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+  axpyScalar(w, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline void addAvx2(const int *a, const int *b, int *c,
+                                                     size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_si256((__m256i *)(c + i),
+                        _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                         _mm256_loadu_si256((const __m256i *)(b + i))));
+  addScalar(a + i, b + i, c + i, n - i);
+}
+
+__attribute__((target("avx512f"))) inline void addAvx512(const int *a, const int *b, int *c,
+                                                         size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm512_storeu_si512(c + i, _mm512_add_epi32(_mm512_loadu_si512(a + i),
+                                                _mm512_loadu_si512(b + i)));
+  addScalar(a + i, b + i, c + i, n - i);
+}
+
+/* 8x8 float block, rows of src become columns of dst */
+__attribute__((target("avx2"))) inline void transpose8x8Avx2(const float *src, size_t srcStride,
+                                                              float *dst, size_t dstStride) {
+  __m256 r[8], t[8], s[8];
+  for (int i = 0; i < 8; ++i)
+    r[i] = _mm256_loadu_ps(src + i * srcStride);
+  for (int i = 0; i < 8; i += 2) {
+    t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+    t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+  }
+  for (int i = 0; i < 8; i += 4) {
+    s[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+    s[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+    s[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+    s[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+  }
+  for (int i = 0; i < 4; ++i) {
+    _mm256_storeu_ps(dst + i * dstStride, _mm256_permute2f128_ps(s[i], s[i + 4], 0x20));
+    _mm256_storeu_ps(dst + (i + 4) * dstStride, _mm256_permute2f128_ps(s[i], s[i + 4], 0x31));
+  }
+}
+
+/* Pixels of src at (x, y), 0 outside the width x height image like
+ * CpuWarp's texel() */
+__attribute__((target("avx2"))) inline __m256i gatherTexels(const int *src, __m256i x, __m256i y,
+                                                            __m256i width, __m256i height) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i inside = _mm256_and_si256(
+      _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(zero, x), _mm256_cmpgt_epi32(zero, y)),
+                          _mm256_cmpgt_epi32(width, x)),
+      _mm256_cmpgt_epi32(height, y));
+  __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(y, width), x);
+  return _mm256_mask_i32gather_epi32(zero, src, idx, inside, 4);
+}
+
+/* Byte k of every packed pixel as float */
+__attribute__((target("avx2"))) inline __m256 texelChannel(__m256i p, int k) {
+  return _mm256_cvtepi32_ps(
+      _mm256_and_si256(_mm256_srl_epi32(p, _mm_cvtsi32_si128(8 * k)), _mm256_set1_epi32(0xff)));
+}
+
+/* Pixels [0, 8k) of output row y of a 4 channel warp, nearest or bilinear,
+ * in the same operations as CpuWarp's scalar path (no FMA), so both round
+ * alike; returns how many pixels it did */
+__attribute__((target("avx2"))) inline size_t warpRowAvx2(const unsigned char *in, int width,
+                                                           int height, unsigned char *out,
+                                                           size_t outWidth, size_t y,
+                                                           const float *m, bool bilinear) {
+  const int *src = (const int *)in;
+  const float dy = y + 0.5f, rowX = m[1] * dy, rowY = m[4] * dy;
+  const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+  const __m256i w = _mm256_set1_epi32(width), h = _mm256_set1_epi32(height);
+
+  size_t x = 0;
+  for (; x + 8 <= outWidth; x += 8) {
+    __m256 dx = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+    __m256 px = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0]), dx),
+                                            _mm256_set1_ps(rowX)),
+                              _mm256_set1_ps(m[2]));
+    __m256 py = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[3]), dx),
+                                            _mm256_set1_ps(rowY)),
+                              _mm256_set1_ps(m[5]));
+    __m256i result;
+    if (!bilinear) {
+      result = gatherTexels(src, _mm256_cvttps_epi32(_mm256_floor_ps(px)),
+                            _mm256_cvttps_epi32(_mm256_floor_ps(py)), w, h);
+    } else {
+      px = _mm256_sub_ps(px, half);
+      py = _mm256_sub_ps(py, half);
+      __m256 fx0 = _mm256_floor_ps(px), fy0 = _mm256_floor_ps(py);
+      __m256 fx = _mm256_sub_ps(px, fx0), fy = _mm256_sub_ps(py, fy0);
+      __m256 gx = _mm256_sub_ps(one, fx), gy = _mm256_sub_ps(one, fy);
+      __m256i x0 = _mm256_cvttps_epi32(fx0), y0 = _mm256_cvttps_epi32(fy0);
+      __m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(1));
+      __m256i y1 = _mm256_add_epi32(y0, _mm256_set1_epi32(1));
+      __m256i p00 = gatherTexels(src, x0, y0, w, h), p10 = gatherTexels(src, x1, y0, w, h);
+      __m256i p01 = gatherTexels(src, x0, y1, w, h), p11 = gatherTexels(src, x1, y1, w, h);
+      result = _mm256_setzero_si256();
+      for (int k = 0; k < 4; ++k) {
+        __m256 top = _mm256_add_ps(_mm256_mul_ps(gx, texelChannel(p00, k)),
+                                   _mm256_mul_ps(fx, texelChannel(p10, k)));
+        __m256 bottom = _mm256_add_ps(_mm256_mul_ps(gx, texelChannel(p01, k)),
+                                      _mm256_mul_ps(fx, texelChannel(p11, k)));
+        __m256 c = _mm256_add_ps(_mm256_mul_ps(gy, top), _mm256_mul_ps(fy, bottom));
+        c = _mm256_round_ps(c, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        c = _mm256_min_ps(_mm256_set1_ps(255.0f), _mm256_max_ps(_mm256_setzero_ps(), c));
+        result = _mm256_or_si256(result,
+                                 _mm256_sll_epi32(_mm256_cvtps_epi32(c), _mm_cvtsi32_si128(8 * k)));
+      }
+    }
+    _mm256_storeu_si256((__m256i *)(out + (y * outWidth + x) * 4), result);
+  }
+  return x;
+}
+#endif
+
+inline void axpy(float w, const float *x, float *y, size_t n) {
+#ifdef CLP_X86
+  if (cpuIsa() == CpuIsa::Avx512)
+    return axpyAvx512(w, x, y, n);
+  if (cpuIsa() == CpuIsa::Avx2)
+    return axpyAvx2(w, x, y, n);
+#endif
+  axpyScalar(w, x, y, n);
+}
+
+/* adder.cl */
+inline void cpuVecadd(const int *a, const int *b, int *c, size_t n) {
+  parallelFor(n, [&](size_t beg, size_t end) {
+#ifdef CLP_X86
+    if (cpuIsa() == CpuIsa::Avx512)
+      return addAvx512(a + beg, b + beg, c + beg, end - beg);
+    if (cpuIsa() == CpuIsa::Avx2)
+      return addAvx2(a + beg, b + beg, c + beg, end - beg);
+#endif
+    addScalar(a + beg, b + beg, c + beg, end - beg);
+  }, 1 << 14);
+}
+
+/* MultiCommandQueue/kernel.cl, libm has no vector sin/cos to call here */
+inline void cpuVectorOperation(const int *src, int *dst, size_t n) {
+  parallelFor(n, [&](size_t beg, size_t end) {
+    for (size_t i = beg; i < end; ++i) {
+      float x = src[i];
+      dst[i] = (int)(sinf(x) / 1319 + cosf(x) / 1317 + cosf(x + 13) * sinf(x - 13));
+    }
+  }, 1 << 12);
+}
+
+/* TransposeMatrix/kernel.cl, 8x8 register blocks inside cache blocks */
+class CpuTranspose {
+public:
+  explicit CpuTranspose(size_t block = 64) : block_(block) {}
+
+  size_t tile() const { return block_; }
+
+  /* dst (cols x rows) = transpose of src (rows x cols), both row-major */
+  void operator()(const float *src, float *dst, size_t rows, size_t cols) const {
+    size_t tr = blocks(rows), tc = blocks(cols);
+    parallelFor(tr * tc, [&](size_t beg, size_t end) {
+      for (size_t k = beg; k < end; ++k) {
+        size_t r0 = k / tc * block_, c0 = k % tc * block_;
+        transposeBlock(src + r0 * cols + c0, cols, dst + c0 * rows + r0, rows,
+                       std::min(block_, rows - r0), std::min(block_, cols - c0));
+      }
+    });
+  }
+
+  /* mat (n x n) = its transpose, blocks (i, j) and (j, i) swap together */
+  void inPlace(float *mat, size_t n) const {
+    size_t t = blocks(n);
+    std::vector<std::pair<size_t, size_t>> pairs;
+    for (size_t i = 0; i < t; ++i)
+      for (size_t j = i; j < t; ++j)
+        pairs.push_back({i * block_, j * block_});
+
+    parallelFor(pairs.size(), [&](size_t beg, size_t end) {
+      for (size_t k = beg; k < end; ++k) {
+        size_t r0 = pairs[k].first, c0 = pairs[k].second;
+        size_t r1 = std::min(n, r0 + block_), c1 = std::min(n, c0 + block_);
+        for (size_t r = r0; r < r1; ++r)
+          for (size_t c = r0 == c0 ? r + 1 : c0; c < c1; ++c)
+            std::swap(mat[r * n + c], mat[c * n + r]);
+      }
+    });
+  }
+
+private:
+  size_t blocks(size_t n) const { return (n + block_ - 1) / block_; }
+
+  static void transposeBlock(const float *src, size_t srcStride, float *dst, size_t dstStride,
+                             size_t h, size_t w) {
+    for (size_t i = 0; i < h; i += 8)
+      for (size_t j = 0; j < w; j += 8) {
+#ifdef CLP_X86
+        if (cpuIsa() != CpuIsa::Scalar && i + 8 <= h && j + 8 <= w) {
+          transpose8x8Avx2(src + i * srcStride + j, srcStride, dst + j * dstStride + i, dstStride);
+          continue;
+        }
+#endif
+        for (size_t y = i; y < std::min(h, i + 8); ++y)
+          for (size_t x = j; x < std::min(w, j + 8); ++x)
+            dst[x * dstStride + y] = src[y * srcStride + x];
+      }
+  }
+
+  size_t block_;
+};
+
+/* Histogram/histogram.cl, including the equalization and Otsu chain */
+class CpuHistogram {
+public:
+  CpuHistogram(int channels = 1, int bins = 256, int lo = 0, int hi = 256)
+      : channels_(channels), bins_(bins), lo_(lo), hi_(hi) {
+    if (channels != 1 && channels != 4)
+      throw cl::Error(CL_INVALID_VALUE, "CpuHistogram: channels must be 1 or 4");
+    if (bins < 1 || lo < 0 || hi > 256 || lo >= hi)
+      throw cl::Error(CL_INVALID_VALUE, "CpuHistogram: bad bins or range");
+    hist_.resize(histograms() * bins_);
+    scan_.resize(histograms() * bins_);
+    lut_.resize(histograms() * 256);
+  }
+
+  int channels() const { return channels_; }
+  int bins() const { return bins_; }
+  int histograms() const { return channels_ == 4 ? 4 : 1; }
+  size_t resultSize() const { return histograms() * bins_ * sizeof(int); }
+
+  /* Every thread counts into its own copy, the copies are summed */
+  void operator()(const unsigned char *data, size_t pixels, int *hist) const {
+    size_t size = histograms() * bins_;
+    std::vector<std::vector<int>> partial(cpuThreads(), std::vector<int>(size));
+    size_t chunk = (pixels + partial.size() - 1) / partial.size();
+
+    parallelFor(partial.size(), [&](size_t beg, size_t end) {
+      for (size_t t = beg; t < end; ++t) {
+        int *h = partial[t].data();
+        for (size_t i = t * chunk; i < std::min(pixels, (t + 1) * chunk); ++i) {
+          const unsigned char *p = data + i * channels_;
+          if (channels_ == 4) {
+            count(h, 0, p[0]);
+            count(h, 1, p[1]);
+            count(h, 2, p[2]);
+            count(h, 3, luma(p));
+          } else {
+            count(h, 0, p[0]);
+          }
+        }
+      }
+    });
+
+    std::fill(hist, hist + size, 0);
+    for (auto &h : partial)
+      for (size_t i = 0; i < size; ++i)
+        hist[i] += h[i];
+  }
+
+  void cdf(const int *hist) {
+    for (int k = 0; k < histograms(); ++k) {
+      const int *h = hist + k * bins_;
+      int *scan = scan_.data() + k * bins_;
+      unsigned char *lut = lut_.data() + k * 256;
+
+      int run = 0, first = bins_;
+      for (int i = 0; i < bins_; ++i) {
+        scan[i] = run;
+        if (h[i] && first == bins_)
+          first = i;
+        run += h[i];
+      }
+      int cdfMin = first < bins_ ? h[first] : 0;
+      float scale = run > cdfMin ? 255.0f / (run - cdfMin) : 0.0f;
+      for (int v = 0; v < 256; ++v) {
+        if (v >= lo_ && v < hi_ && run > cdfMin) {
+          int b = bin(v);
+          lut[v] = saturate(std::nearbyint((scan[b] + h[b] - cdfMin) * scale));
+        } else {
+          lut[v] = v;
+        }
+      }
+    }
+  }
+
+  void otsu(const int *hist) {
+    const int *h = hist + (histograms() - 1) * bins_;
+    float total = 0, totalSum = 0;
+    for (int i = 0; i < bins_; ++i) {
+      total += h[i];
+      totalSum += (float)i * h[i];
+    }
+
+    float best = -1.0f, w0 = 0, sum0 = 0;
+    int bestBin = 0;
+    for (int i = 0; i < bins_; ++i) {
+      w0 += h[i];
+      sum0 += (float)i * h[i];
+      float w1 = total - w0;
+      if (w0 > 0 && w1 > 0) {
+        float d = sum0 / w0 - (totalSum - sum0) / w1;
+        float v = w0 * w1 * d * d;
+        if (v > best) {
+          best = v;
+          bestBin = i;
+        }
+      }
+    }
+    threshold_[0] = lo_ + ((bestBin + 1) * (hi_ - lo_) + bins_ - 1) / bins_;
+    threshold_[1] = bestBin;
+  }
+
+  void equalize(const unsigned char *data, size_t pixels, unsigned char *out) {
+    (*this)(data, pixels, hist_.data());
+    cdf(hist_.data());
+    parallelFor(pixels, [&](size_t beg, size_t end) {
+      for (size_t i = beg * channels_; i < end * channels_; ++i) {
+        size_t k = channels_ == 4 ? i % 4 : 0;
+        out[i] = k == 3 ? data[i] : lut_[k * 256 + data[i]];
+      }
+    }, 1 << 14);
+  }
+
+  void threshold(const unsigned char *data, size_t pixels, unsigned char *out) {
+    (*this)(data, pixels, hist_.data());
+    otsu(hist_.data());
+    parallelFor(pixels, [&](size_t beg, size_t end) {
+      for (size_t i = beg; i < end; ++i) {
+        const unsigned char *p = data + i * channels_;
+        out[i] = (channels_ == 4 ? luma(p) : p[0]) >= threshold_[0] ? 255 : 0;
+      }
+    }, 1 << 14);
+  }
+
+  const int *histogramData() const { return hist_.data(); }
+  const int *cdfData() const { return scan_.data(); }
+  const unsigned char *lutData() const { return lut_.data(); }
+  const int *thresholdData() const { return threshold_; }
+
+private:
+  int bin(int v) const { return (v - lo_) * bins_ / (hi_ - lo_); }
+  static int luma(const unsigned char *p) { return (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8; }
+  static unsigned char saturate(float v) { return (unsigned char)std::min(255.0f, std::max(0.0f, v)); }
+
+  void count(int *h, int k, int v) const {
+    if (v >= lo_ && v < hi_)
+      ++h[k * bins_ + bin(v)];
+  }
+
+  int channels_, bins_, lo_, hi_;
+  std::vector<int> hist_, scan_;
+  std::vector<unsigned char> lut_;
+  int threshold_[2] = {0, 0};
+};
+
+/* GaussianBlurFilter/convolve.cl over packed 8-bit pixels, alpha copied */
+class CpuConvolution {
+public:
+  CpuConvolution(const Filter2D &filter, Border border = Border::Clamp)
+      : border_(border), rx_(filter.width / 2), ry_(filter.height / 2) {
+    separable_ = factorize(filter, row_, col_);
+    if (!separable_)
+      taps_ = filter.taps;
+  }
+
+  CpuConvolution(const std::vector<float> &row, const std::vector<float> &col,
+                 Border border = Border::Clamp)
+      : border_(border), rx_((int)row.size() / 2), ry_((int)col.size() / 2), separable_(true),
+        row_(row), col_(col) {
+    if (row.size() % 2 == 0 || col.size() % 2 == 0)
+      throw cl::Error(CL_INVALID_VALUE, "CpuConvolution: filter must be odd sized");
+  }
+
+  bool separable() const { return separable_; }
+  int radiusX() const { return rx_; }
+  int radiusY() const { return ry_; }
+
+  /* in and out are width x height pixels of channels (1 or 4) bytes. Rows
+   * are handled in strips of STRIP_ROWS, each thread filtering whole strips. */
+  void operator()(const unsigned char *in, unsigned char *out, size_t width, size_t height,
+                  int channels) const {
+    const size_t strips = (height + STRIP_ROWS - 1) / STRIP_ROWS;
+    parallelFor(strips, [&](size_t beg, size_t end) {
+      const size_t rowLen = width * channels;
+      std::vector<float> padded((width + 2 * rx_) * channels), acc(rowLen);
+      std::vector<float> strip(separable_ ? (STRIP_ROWS + 2 * ry_) * rowLen : 0);
+
+      for (size_t s = beg; s < end; ++s) {
+        size_t y0 = s * STRIP_ROWS, y1 = std::min(height, y0 + STRIP_ROWS);
+
+        if (separable_) {
+          // horizontal pass of every row the strip's vertical pass reads
+          for (size_t r = 0; r < y1 - y0 + 2 * ry_; ++r) {
+            float *t = strip.data() + r * rowLen;
+            std::fill(t, t + rowLen, 0.0f);
+            if (loadRow(in, width, height, channels, (int)(y0 + r) - ry_, padded.data()))
+              for (int k = 0; k <= 2 * rx_; ++k)
+                axpy(row_[k], padded.data() + k * channels, t, rowLen);
+          }
+          for (size_t y = y0; y < y1; ++y) {
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (int k = 0; k <= 2 * ry_; ++k)
+              axpy(col_[k], strip.data() + (y - y0 + k) * rowLen, acc.data(), rowLen);
+            store(acc.data(), in, out, y, width, channels);
+          }
+        } else {
+          const int w = 2 * rx_ + 1;
+          for (size_t y = y0; y < y1; ++y) {
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (int j = 0; j <= 2 * ry_; ++j)
+              if (loadRow(in, width, height, channels, (int)y + j - ry_, padded.data()))
+                for (int i = 0; i < w; ++i)
+                  axpy(taps_[j * w + i], padded.data() + i * channels, acc.data(), rowLen);
+            store(acc.data(), in, out, y, width, channels);
+          }
+        }
+      }
+    });
+  }
+
+private:
+  static constexpr size_t STRIP_ROWS = 32;
+
+  /* same as remap in convolve.cl, -1 for a BORDER_ZERO miss */
+  int remap(int i, int n) const {
+    if (i >= 0 && i < n)
+      return i;
+    switch (border_) {
+    case Border::Clamp:
+      return std::min(std::max(i, 0), n - 1);
+    case Border::Wrap:
+      return (i % n + n) % n;
+    case Border::Mirror: {
+      if (n == 1)
+        return 0;
+      int period = 2 * (n - 1);
+      i = (i % period + period) % period;
+      return i < n ? i : period - i;
+    }
+    default:
+      return -1;
+    }
+  }
+
+  /* Row y as floats with rx_ border pixels on both sides; false when the
+   * whole row is border zeros */
+  bool loadRow(const unsigned char *in, size_t width, size_t height, int channels, int y,
+               float *padded) const {
+    y = remap(y, (int)height);
+    if (y < 0)
+      return false;
+    const unsigned char *src = in + y * width * channels;
+    for (int x = -rx_; x < (int)width + rx_; ++x) {
+      int sx = remap(x, (int)width);
+      for (int c = 0; c < channels; ++c)
+        padded[(x + rx_) * channels + c] = sx < 0 ? 0.0f : src[sx * channels + c];
+    }
+    return true;
+  }
+
+  static void store(const float *acc, const unsigned char *in, unsigned char *out, size_t y,
+                    size_t width, int channels) {
+    size_t base = y * width * channels;
+    for (size_t i = 0; i < width * channels; ++i)
+      out[base + i] = channels == 4 && i % 4 == 3
+                          ? in[base + i]
+                          : (unsigned char)std::min(255.0f, std::max(0.0f, std::nearbyint(acc[i])));
+  }
+
+  Border border_;
+  int rx_, ry_;
+  bool separable_ = false;
+  std::vector<float> row_, col_, taps_;
+};
+
+class CpuGaussianBlur : public CpuConvolution {
+public:
+  CpuGaussianBlur(float sigma, int radius = -1, Border border = Border::Clamp)
+      : CpuGaussianBlur(sigma, gaussianWeights(sigma, gaussianRadius(sigma, radius)), border) {}
+
+  float sigma() const { return sigma_; }
+  int radius() const { return radiusX(); }
+
+private:
+  CpuGaussianBlur(float sigma, const std::vector<float> &weights, Border border)
+      : CpuConvolution(weights, weights, border), sigma_(sigma) {}
+
+  float sigma_;
+};
+
+/* Rotate/rotate.cl: out of range reads are transparent black */
+class CpuWarp {
+public:
+  explicit CpuWarp(Interp interp = Interp::Bilinear) : interp_(interp) {}
+
+  Interp interp() const { return interp_; }
+
+  /* out (outWidth x outHeight) = in (width x height) through map */
+  void operator()(const unsigned char *in, size_t width, size_t height, unsigned char *out,
+                  size_t outWidth, size_t outHeight, int channels, const Affine &map) const {
+    parallelFor(outHeight, [&](size_t beg, size_t end) {
+      float c[4];
+      for (size_t y = beg; y < end; ++y)
+        for (size_t x = vectorRow(in, width, height, out, outWidth, y, channels, map);
+             x < outWidth; ++x) {
+          float dx = x + 0.5f, dy = y + 0.5f;
+          sample(in, width, height, channels, map.m[0] * dx + map.m[1] * dy + map.m[2],
+                 map.m[3] * dx + map.m[4] * dy + map.m[5], c);
+          for (int k = 0; k < channels; ++k)
+            out[(y * outWidth + x) * channels + k] =
+                (unsigned char)std::min(255.0f, std::max(0.0f, std::nearbyint(c[k])));
+        }
+    }, 8);
+  }
+
+  /* Layer i of out (outWidth x outHeight each, back to back) via maps[i] */
+  void operator()(const unsigned char *in, size_t width, size_t height, unsigned char *out,
+                  size_t outWidth, size_t outHeight, int channels,
+                  const std::vector<Affine> &maps) const {
+    for (size_t i = 0; i < maps.size(); ++i)
+      (*this)(in, width, height, out + i * outWidth * outHeight * channels, outWidth, outHeight,
+              channels, maps[i]);
+  }
+
+private:
+  /* Leading pixels of row y done with SIMD, 0 where there is no such path */
+  size_t vectorRow(const unsigned char *in, size_t width, size_t height, unsigned char *out,
+                   size_t outWidth, size_t y, int channels, const Affine &map) const {
+#ifdef CLP_X86
+    if (channels == 4 && interp_ != Interp::Bicubic && cpuIsa() != CpuIsa::Scalar)
+      return warpRowAvx2(in, (int)width, (int)height, out, outWidth, y, map.m,
+                         interp_ == Interp::Bilinear);
+#else
+    (void)in, (void)width, (void)height, (void)out, (void)outWidth, (void)y, (void)channels,
+        (void)map;
+#endif
+    return 0;
+  }
+
+  static float texel(const unsigned char *in, int width, int height, int channels, int x, int y,
+                     int k) {
+    return x < 0 || y < 0 || x >= width || y >= height ? 0.0f
+                                                       : in[(y * width + x) * channels + k];
+  }
+
+  static void cubic(float t, float w[4]) {
+    float t2 = t * t, t3 = t2 * t;
+    w[0] = -0.5f * t3 + t2 - 0.5f * t;
+    w[1] = 1.5f * t3 - 2.5f * t2 + 1.0f;
+    w[2] = -1.5f * t3 + 2.0f * t2 + 0.5f * t;
+    w[3] = 0.5f * t3 - 0.5f * t2;
+  }
+
+  void sample(const unsigned char *in, int width, int height, int channels, float px, float py,
+              float *c) const {
+    if (interp_ == Interp::Nearest) {
+      int x = (int)std::floor(px), y = (int)std::floor(py);
+      for (int k = 0; k < channels; ++k)
+        c[k] = texel(in, width, height, channels, x, y, k);
+      return;
+    }
+
+    px -= 0.5f;
+    py -= 0.5f;
+    int x0 = (int)std::floor(px), y0 = (int)std::floor(py);
+    float fx = px - x0, fy = py - y0;
+    if (interp_ == Interp::Bilinear) {
+      for (int k = 0; k < channels; ++k)
+        c[k] = (1 - fy) * ((1 - fx) * texel(in, width, height, channels, x0, y0, k) +
+                           fx * texel(in, width, height, channels, x0 + 1, y0, k)) +
+               fy * ((1 - fx) * texel(in, width, height, channels, x0, y0 + 1, k) +
+                     fx * texel(in, width, height, channels, x0 + 1, y0 + 1, k));
+      return;
+    }
+
+    float wx[4], wy[4];
+    cubic(fx, wx);
+    cubic(fy, wy);
+    for (int k = 0; k < channels; ++k) {
+      float sum = 0;
+      for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 4; ++i)
+          sum += wy[j] * wx[i] * texel(in, width, height, channels, x0 - 1 + i, y0 - 1 + j, k);
+      c[k] = sum;
+    }
+  }
+
+  Interp interp_;
+};
+
+/* The shared Runtime, or nullptr after a warning on log when there is no
+ * OpenCL device, for programs that fall back to this backend */
+inline Runtime *runtimeOrCpu(std::ostream &log = std::cout) {
+  try {
+    return &Runtime::get();
+  } catch (cl::Error &error) {
+    log << "[WARN] no OpenCL device (" << error.what() << "), CPU backend only\n";
+    return nullptr;
+  }
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef HOST_BUFFER_H
+#define HOST_BUFFER_H
+
+#include <string>
+#include <vector>
+
+#include "runtime.hpp"
+
+/*
+ * Where the data of a HostBuffer lives and how it reaches the device:
+ *  Copy      host vector, enqueueWrite/ReadBuffer into a device buffer
+ *  HostPtr   CL_MEM_ALLOC_HOST_PTR buffer, mapped for the host
+ *  SvmCoarse clSVMAlloc, mapped for the host (OpenCL 2.0)
+ *  SvmFine   fine-grained clSVMAlloc, shared without any map (OpenCL 2.0)
+ */
+enum class MemMode { Copy, HostPtr, SvmCoarse, SvmFine };
+
+inline const char *memModeName(MemMode mode) {
+  switch (mode) {
+  case MemMode::HostPtr:
+    return "host_ptr";
+  case MemMode::SvmCoarse:
+    return "svm_coarse";
+  case MemMode::SvmFine:
+    return "svm_fine";
+  default:
+    return "copy";
+  }
+}
+
+/* Devices sharing memory with the host (CPUs, integrated GPUs) skip the
+ * copies: fine-grained SVM, else coarse SVM, else a mapped host buffer.
+ * Discrete devices keep explicit copies into their own memory. */
+inline MemMode bestMemMode(const cl::Device &device) {
+  bool unified = (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) ||
+                 device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+  if (!unified)
+    return MemMode::Copy;
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+  // 1.x devices reject the query
+  if (device.getInfo<CL_DEVICE_VERSION>().find("OpenCL 1.") == std::string::npos) {
+    cl_device_svm_capabilities svm = device.getInfo<CL_DEVICE_SVM_CAPABILITIES>();
+    if (svm & CL_DEVICE_SVM_FINE_GRAIN_BUFFER)
+      return MemMode::SvmFine;
+    if (svm & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER)
+      return MemMode::SvmCoarse;
+  }
+#endif
+  return MemMode::HostPtr;
+}
+
+/* Every mode the device runs, Copy first; the SVM ones need the 2.0 API
+ * (CL_HPP_TARGET_OPENCL_VERSION 200) and a device that offers them */
+inline std::vector<MemMode> memModes(const cl::Device &device) {
+  std::vector<MemMode> modes = {MemMode::Copy, MemMode::HostPtr};
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+  if (device.getInfo<CL_DEVICE_VERSION>().find("OpenCL 1.") == std::string::npos) {
+    cl_device_svm_capabilities svm = device.getInfo<CL_DEVICE_SVM_CAPABILITIES>();
+    if (svm & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER)
+      modes.push_back(MemMode::SvmCoarse);
+    if (svm & CL_DEVICE_SVM_FINE_GRAIN_BUFFER)
+      modes.push_back(MemMode::SvmFine);
+  }
+#else
+  (void)device;
+#endif
+  return modes;
+}
+
+/*
+ * n elements the host and the device take turns on, without copies where
+ * the device allows it. buffer() is what primitives get (SVM memory is
+ * wrapped in a CL_MEM_USE_HOST_PTR buffer, so every cl::Buffer primitive
+ * runs on it unchanged). data() is valid while the array is on the host:
+ * after construction and after toHost(); toDevice() hands it over before
+ * kernels are enqueued. data() may move across toHost() calls.
+ */
+template <class T> class HostBuffer {
+public:
+  HostBuffer(Runtime &rt, size_t n, MemMode mode, cl_mem_flags access = CL_MEM_READ_WRITE)
+      : rt_(rt), n_(n), mode_(mode) {
+    const size_t bytes = n_ * sizeof(T);
+    switch (mode_) {
+    case MemMode::Copy:
+      host_.resize(n_);
+      buffer_ = cl::Buffer(rt_.context(), access, bytes);
+      data_ = host_.data();
+      onHost_ = true;
+      return;
+    case MemMode::HostPtr:
+      buffer_ = cl::Buffer(rt_.context(), access | CL_MEM_ALLOC_HOST_PTR, bytes);
+      break;
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+    case MemMode::SvmCoarse:
+    case MemMode::SvmFine:
+      svm_ = clSVMAlloc(rt_.context()(),
+                        CL_MEM_READ_WRITE |
+                            (mode_ == MemMode::SvmFine ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0),
+                        bytes, 0);
+      if (!svm_)
+        throw cl::Error(CL_MEM_OBJECT_ALLOCATION_FAILURE, "clSVMAlloc");
+      buffer_ = cl::Buffer(rt_.context(), access | CL_MEM_USE_HOST_PTR, bytes, svm_);
+      break;
+#endif
+    default:
+      throw cl::Error(CL_INVALID_VALUE, "HostBuffer: SVM needs OpenCL 2.0");
+    }
+    toHost(rt_.queue());
+  }
+
+  HostBuffer(Runtime &rt, size_t n, cl_mem_flags access = CL_MEM_READ_WRITE)
+      : HostBuffer(rt, n, bestMemMode(rt.device()), access) {}
+
+  ~HostBuffer() {
+    try { // unmapped before release
+      if (mode_ != MemMode::Copy)
+        toDevice(rt_.queue());
+      rt_.queue().finish();
+    } catch (cl::Error &) { // nothing sensible to do while unwinding
+    }
+    buffer_ = cl::Buffer();
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+    if (svm_)
+      clSVMFree(rt_.context()(), svm_);
+#endif
+  }
+
+  HostBuffer(const HostBuffer &) = delete;
+  HostBuffer &operator=(const HostBuffer &) = delete;
+
+  MemMode mode() const { return mode_; }
+  size_t size() const { return n_; }
+  const cl::Buffer &buffer() const { return buffer_; }
+
+  T *data() { return data_; }
+  T &operator[](size_t i) { return data_[i]; }
+
+  /* Host writes become visible to commands enqueued after this */
+  void toDevice(const cl::CommandQueue &queue) {
+    if (!onHost_)
+      return;
+    onHost_ = false;
+    switch (mode_) {
+    case MemMode::Copy:
+      queue.enqueueWriteBuffer(buffer_, CL_FALSE, 0, n_ * sizeof(T), data_);
+      break;
+    case MemMode::HostPtr:
+      queue.enqueueUnmapMemObject(buffer_, data_);
+      break;
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+    case MemMode::SvmCoarse:
+      queue.enqueueUnmapSVM(static_cast<T *>(svm_));
+      break;
+#endif
+    default: // fine-grained: already shared
+      break;
+    }
+  }
+
+  /* Blocks until every command on queue is done and the data is readable */
+  void toHost(const cl::CommandQueue &queue) {
+    if (onHost_)
+      return;
+    onHost_ = true;
+    const cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE;
+    switch (mode_) {
+    case MemMode::Copy:
+      queue.enqueueReadBuffer(buffer_, CL_TRUE, 0, n_ * sizeof(T), host_.data());
+      data_ = host_.data();
+      break;
+    case MemMode::HostPtr:
+      data_ = static_cast<T *>(queue.enqueueMapBuffer(buffer_, CL_TRUE, flags, 0, n_ * sizeof(T)));
+      break;
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+    case MemMode::SvmCoarse:
+      queue.enqueueMapSVM(static_cast<T *>(svm_), CL_TRUE, flags, n_ * sizeof(T));
+      data_ = static_cast<T *>(svm_);
+      break;
+#endif
+    default:
+      queue.finish();
+      data_ = static_cast<T *>(svm_);
+      break;
+    }
+  }
+
+private:
+  Runtime &rt_;
+  size_t n_;
+  MemMode mode_;
+  cl::Buffer buffer_;
+  std::vector<T> host_;
+  void *svm_ = nullptr;
+  T *data_ = nullptr;
+  bool onHost_ = false;
+};
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef OPENCL_H
+#define OPENCL_H
+
+/* Every sample goes through cl2.hpp; OPENCL_1 limits it to the 1.2 API
+ * unless CL_HPP_TARGET_OPENCL_VERSION is given as well */
+#ifndef CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_ENABLE_EXCEPTIONS
+#endif
+#ifndef CL_HPP_TARGET_OPENCL_VERSION
+#ifdef OPENCL_1
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#else
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#endif
+#endif
+#ifndef CL_HPP_MINIMUM_OPENCL_VERSION
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#endif
+#include <CL/cl2.hpp>
+
+#endif
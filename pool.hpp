@@ -0,0 +1,332 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "opencl.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <tuple>
+#include <utility>
+
+/* Counters of a MemoryPool; bytes are what the pool holds, rounded up to
+ * the size classes */
+struct PoolStats {
+  size_t allocations = 0; // CL objects created
+  size_t reuses = 0;      // requests served without creating one
+  size_t evictions = 0;   // idle objects released to stay under the limits
+  size_t inUse = 0;       // bytes leased out
+  size_t cached = 0;      // bytes idle in the pool
+  size_t peak = 0;        // high-water mark of inUse + cached
+
+  void print(std::ostream &os) const {
+    os << "[INFO] pool: " << allocations << " allocations, " << reuses << " reuses, "
+       << evictions << " evictions, " << inUse << " B in use, " << cached << " B cached, "
+       << peak << " B peak\n";
+  }
+};
+
+/*
+ * Size-class pool of device buffers, 2D images and pinned host staging
+ * buffers for one context. Requests are served from idle objects with the
+ * same key (size class and flags; exact size, format and flags for
+ * images) before anything is created, so a steady stream of same-shaped
+ * requests stops allocating after the first one.
+ *
+ * Every request returns a lease that gives the object back when it is
+ * destroyed. Commands already enqueued on it still complete, and the next
+ * holder may enqueue on the same in-order queue right away; a holder on
+ * another queue must first wait for those commands.
+ *
+ * Idle objects are released oldest first once they exceed maxCached bytes.
+ * A request that would take the pool past maxTotal bytes releases idle
+ * objects first and fails with CL_MEM_OBJECT_ALLOCATION_FAILURE if that is
+ * not enough (0: no limit).
+ */
+class MemoryPool {
+  enum Kind { BufferKind, ImageKind, PinnedKind };
+
+  struct Key {
+    int kind = BufferKind;
+    cl_mem_flags flags = 0;
+    size_t bytes = 0, width = 0, height = 0;
+    cl_channel_order order = 0;
+    cl_channel_type type = 0;
+
+    bool operator==(const Key &o) const {
+      return std::tie(kind, flags, bytes, width, height, order, type) ==
+             std::tie(o.kind, o.flags, o.bytes, o.width, o.height, o.order, o.type);
+    }
+  };
+
+  struct Entry {
+    Key key;
+    cl::Buffer buffer;
+    cl::Image2D image;
+    void *host = nullptr; // pinned buffers stay mapped while pooled
+  };
+
+  /* Shared with the leases, so a lease may outlive the pool */
+  struct State {
+    cl::Context context;
+    cl::Device device;
+    cl::CommandQueue queue; // maps and unmaps pinned buffers, made on first use
+    size_t maxCached, maxTotal;
+    std::mutex mutex;
+    std::list<Entry> idle; // oldest first
+    PoolStats stats;
+
+    ~State() {
+      for (auto &e : idle)
+        unmap(e);
+    }
+
+    void unmap(Entry &e) {
+      if (e.host) {
+        try {
+          queue.enqueueUnmapMemObject(e.buffer, e.host);
+          queue.finish();
+        } catch (cl::Error &) { // released with the buffer anyway
+        }
+        e.host = nullptr;
+      }
+    }
+
+    /* Drops idle objects, oldest first, until at most keep bytes are idle */
+    void evict(size_t keep) {
+      while (stats.cached > keep && !idle.empty()) {
+        stats.cached -= idle.front().key.bytes;
+        unmap(idle.front());
+        idle.pop_front();
+        ++stats.evictions;
+      }
+    }
+
+    void giveBack(Entry e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.inUse -= e.key.bytes;
+      stats.cached += e.key.bytes;
+      idle.push_back(std::move(e));
+      evict(maxCached);
+    }
+  };
+
+public:
+  /* Leased object; converts to the cl::Buffer / cl::Image2D it holds. Pass
+   * get() to Kernel::setArg, which would take the lease itself as bytes */
+  template <class T> class Lease {
+  public:
+    Lease() = default;
+    Lease(Lease &&o) noexcept { *this = std::move(o); }
+    Lease &operator=(Lease &&o) noexcept {
+      if (this != &o) {
+        release();
+        std::swap(state_, o.state_);
+        std::swap(entry_, o.entry_);
+      }
+      return *this;
+    }
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    ~Lease() { release(); }
+
+    const T &get() const { return object(); }
+    operator const T &() const { return object(); }
+    explicit operator bool() const { return state_ != nullptr; }
+
+    /* Usable bytes, at least what was asked for */
+    size_t bytes() const { return entry_.key.bytes; }
+    /* Host address of a pinned buffer, nullptr otherwise */
+    void *data() const { return entry_.host; }
+
+    /* Back to the pool now instead of at destruction */
+    void release() {
+      if (state_) {
+        state_->giveBack(std::move(entry_));
+        state_.reset();
+        entry_ = Entry();
+      }
+    }
+
+  private:
+    friend class MemoryPool;
+    Lease(std::shared_ptr<State> state, Entry entry)
+        : state_(std::move(state)), entry_(std::move(entry)) {}
+
+    const cl::Buffer &object(cl::Buffer *) const { return entry_.buffer; }
+    const cl::Image2D &object(cl::Image2D *) const { return entry_.image; }
+    const T &object() const { return object((T *)nullptr); }
+
+    std::shared_ptr<State> state_;
+    Entry entry_;
+  };
+
+  using Buffer = Lease<cl::Buffer>;
+  using Image = Lease<cl::Image2D>;
+
+  /* maxCached defaults to CLP_POOL_MB (megabytes) when set, else a quarter
+   * of the device's global memory */
+  MemoryPool(const cl::Context &context, const cl::Device &device, size_t maxCached = 0,
+             size_t maxTotal = 0)
+      : state_(std::make_shared<State>()) {
+    state_->context = context;
+    state_->device = device;
+    state_->maxCached = maxCached ? maxCached : defaultCached(device);
+    state_->maxTotal = maxTotal;
+  }
+
+  static size_t defaultCached(const cl::Device &device) {
+    if (const char *s = std::getenv("CLP_POOL_MB"))
+      return (size_t)std::atoll(s) << 20;
+    return device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 4;
+  }
+
+  /* Buffer of at least bytes */
+  Buffer buffer(size_t bytes, cl_mem_flags flags = CL_MEM_READ_WRITE) {
+    Key key;
+    key.kind = BufferKind;
+    key.flags = flags;
+    key.bytes = sizeClass(bytes);
+    return Buffer(state_, acquire(key));
+  }
+
+  /* width x height image of format */
+  Image image(const cl::ImageFormat &format, size_t width, size_t height,
+              cl_mem_flags flags = CL_MEM_READ_WRITE) {
+    Key key;
+    key.kind = ImageKind;
+    key.flags = flags;
+    key.width = width;
+    key.height = height;
+    key.order = format.image_channel_order;
+    key.type = format.image_channel_data_type;
+    key.bytes = width * height * pixelBytes(format);
+    return Image(state_, acquire(key));
+  }
+
+  /* CL_MEM_ALLOC_HOST_PTR buffer of at least bytes, mapped for the host
+   * (data()) for as long as it lives in the pool: staging memory for
+   * enqueueRead/WriteBuffer at full transfer rate */
+  Buffer pinned(size_t bytes) {
+    Key key;
+    key.kind = PinnedKind;
+    key.flags = CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+    key.bytes = sizeClass(bytes);
+    return Buffer(state_, acquire(key));
+  }
+
+  PoolStats stats() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->stats;
+  }
+
+  /* Releases idle objects until at most keep bytes are idle */
+  void trim(size_t keep = 0) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->evict(keep);
+  }
+
+  /* Classes grow by a quarter of the power of two above 64 KiB, so a
+   * request wastes under 25%, and by powers of two below */
+  static size_t sizeClass(size_t bytes) {
+    size_t c = 256;
+    while (c < bytes)
+      c <<= 1;
+    if (c <= (64 << 10))
+      return c;
+    size_t step = c / 8;
+    return (bytes + step - 1) / step * step;
+  }
+
+  static size_t pixelBytes(const cl::ImageFormat &format) {
+    size_t channels = 4, size = 1;
+    switch (format.image_channel_order) {
+    case CL_R:
+    case CL_A:
+    case CL_INTENSITY:
+    case CL_LUMINANCE:
+      channels = 1;
+      break;
+    case CL_RG:
+    case CL_RA:
+      channels = 2;
+      break;
+    }
+    switch (format.image_channel_data_type) {
+    case CL_SNORM_INT16:
+    case CL_UNORM_INT16:
+    case CL_SIGNED_INT16:
+    case CL_UNSIGNED_INT16:
+    case CL_HALF_FLOAT:
+      size = 2;
+      break;
+    case CL_SIGNED_INT32:
+    case CL_UNSIGNED_INT32:
+    case CL_FLOAT:
+      size = 4;
+      break;
+    }
+    return channels * size;
+  }
+
+private:
+  Entry acquire(const Key &key) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    State &s = *state_;
+
+    // most recently returned first, it is the likeliest to be in cache
+    for (auto it = s.idle.rbegin(); it != s.idle.rend(); ++it)
+      if (it->key == key) {
+        Entry e = std::move(*it);
+        s.idle.erase(std::next(it).base());
+        s.stats.cached -= key.bytes;
+        s.stats.inUse += key.bytes;
+        ++s.stats.reuses;
+        return e;
+      }
+
+    if (s.maxTotal && s.stats.inUse + s.stats.cached + key.bytes > s.maxTotal) {
+      s.evict(s.maxTotal > s.stats.inUse + key.bytes ? s.maxTotal - s.stats.inUse - key.bytes
+                                                     : 0);
+      if (s.stats.inUse + s.stats.cached + key.bytes > s.maxTotal)
+        throw cl::Error(CL_MEM_OBJECT_ALLOCATION_FAILURE, "MemoryPool: over the limit");
+    }
+
+    Entry e;
+    e.key = key;
+    try {
+      create(e);
+    } catch (cl::Error &) {
+      // idle objects may be what the device is short of
+      s.evict(0);
+      create(e);
+    }
+    s.stats.inUse += key.bytes;
+    s.stats.peak = std::max(s.stats.peak, s.stats.inUse + s.stats.cached);
+    ++s.stats.allocations;
+    return e;
+  }
+
+  void create(Entry &e) {
+    const Key &k = e.key;
+    if (k.kind == ImageKind) {
+      e.image = cl::Image2D(state_->context, k.flags, cl::ImageFormat(k.order, k.type), k.width,
+                            k.height);
+      return;
+    }
+    e.buffer = cl::Buffer(state_->context, k.flags, k.bytes);
+    if (k.kind != PinnedKind)
+      return;
+    if (!state_->queue())
+      state_->queue = cl::CommandQueue(state_->context, state_->device);
+    e.host = state_->queue.enqueueMapBuffer(e.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+                                            k.bytes);
+  }
+
+  std::shared_ptr<State> state_;
+};
+
+#endif
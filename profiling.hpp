@@ -0,0 +1,183 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+#include "opencl.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Device-side timing from CL_QUEUE_PROFILING_ENABLE events. Every
+ * benchmark step files the events it enqueues under the transfer phase
+ * they belong to, so host-to-device copies, kernels and device-to-host
+ * copies are reported separately instead of as one wall-clock number.
+ */
+
+inline double eventMillis(const cl::Event &event) {
+  cl_ulong beg = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+  cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+  return (end - beg) * 1e-6;
+}
+
+inline double eventsMillis(const std::vector<cl::Event> &events) {
+  double ms = 0;
+  for (auto &e : events)
+    ms += eventMillis(e);
+  return ms;
+}
+
+struct PhaseEvents {
+  std::vector<cl::Event> h2d, kernel, d2h;
+
+  void wait() const {
+    for (auto *v : {&h2d, &kernel, &d2h})
+      if (!v->empty())
+        cl::Event::waitForEvents(*v);
+  }
+};
+
+struct PhaseTimes {
+  double h2d = 0, kernel = 0, d2h = 0; // milli seconds
+
+  double total() const { return h2d + kernel + d2h; }
+};
+
+/* Runs a step `warmup` times untimed, then `reps` times and keeps the
+ * median of every phase */
+class Bench {
+public:
+  Bench(int warmup = 2, int reps = 10) : warmup_(warmup), reps_(std::max(reps, 1)) {}
+
+  int reps() const { return reps_; }
+
+  template <class Step> PhaseTimes run(Step step) const {
+    for (int i = 0; i < warmup_; ++i) {
+      PhaseEvents ev;
+      step(ev);
+      ev.wait();
+    }
+
+    std::vector<double> h2d, kernel, d2h;
+    for (int i = 0; i < reps_; ++i) {
+      PhaseEvents ev;
+      step(ev);
+      ev.wait();
+      h2d.push_back(eventsMillis(ev.h2d));
+      kernel.push_back(eventsMillis(ev.kernel));
+      d2h.push_back(eventsMillis(ev.d2h));
+    }
+
+    PhaseTimes t;
+    t.h2d = median(h2d);
+    t.kernel = median(kernel);
+    t.d2h = median(d2h);
+    return t;
+  }
+
+  /* Same for host code: the wall-clock time of step() is its kernel time */
+  template <class Step> PhaseTimes runHost(Step step) const {
+    for (int i = 0; i < warmup_; ++i)
+      step();
+
+    std::vector<double> kernel;
+    for (int i = 0; i < reps_; ++i) {
+      auto beg = std::chrono::steady_clock::now();
+      step();
+      auto end = std::chrono::steady_clock::now();
+      kernel.push_back(std::chrono::duration<double, std::milli>(end - beg).count());
+    }
+
+    PhaseTimes t;
+    t.kernel = median(kernel);
+    return t;
+  }
+
+  static double median(std::vector<double> v) {
+    if (v.empty())
+      return 0;
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+  }
+
+private:
+  int warmup_, reps_;
+};
+
+struct BenchRecord {
+  std::string primitive, variant;
+  size_t size = 0;     // problem size as the primitive defines it
+  size_t local = 0;    // work-group size (items per work-group)
+  size_t elements = 0; // elements processed by one launch
+  size_t bytesIn = 0, bytesOut = 0; // bytes uploaded / downloaded
+  size_t bytesKernel = 0;           // global memory traffic of the kernel
+  int reps = 0;
+  PhaseTimes time;
+
+  static double gbps(size_t bytes, double ms) { return ms > 0 ? bytes / ms * 1e-6 : 0; }
+
+  double kernelGBps() const { return gbps(bytesKernel, time.kernel); }
+  double h2dGBps() const { return gbps(bytesIn, time.h2d); }
+  double d2hGBps() const { return gbps(bytesOut, time.d2h); }
+  double elementsPerSec() const {
+    return time.kernel > 0 ? elements / time.kernel * 1e3 : 0;
+  }
+};
+
+class BenchReport {
+public:
+  explicit BenchReport(std::string device = "") : device_(std::move(device)) {}
+
+  void add(const BenchRecord &r) { records_.push_back(r); }
+  const std::vector<BenchRecord> &records() const { return records_; }
+
+  void writeCsv(std::ostream &os) const {
+    os << "device,primitive,variant,size,local,elements,reps,h2d_ms,kernel_ms,"
+          "d2h_ms,h2d_gbps,kernel_gbps,d2h_gbps,elements_per_s\n";
+    os << std::setprecision(6);
+    for (auto &r : records_)
+      os << '"' << device_ << "\"," << r.primitive << ',' << r.variant << ','
+         << r.size << ',' << r.local << ',' << r.elements << ',' << r.reps
+         << ',' << r.time.h2d << ',' << r.time.kernel << ',' << r.time.d2h
+         << ',' << r.h2dGBps() << ',' << r.kernelGBps() << ','
+         << r.d2hGBps() << ',' << r.elementsPerSec() << '\n';
+  }
+
+  void writeJson(std::ostream &os) const {
+    os << std::setprecision(6);
+    os << "{\n  \"device\": \"" << escape(device_) << "\",\n  \"results\": [";
+    for (size_t i = 0; i < records_.size(); ++i) {
+      auto &r = records_[i];
+      os << (i ? ",\n" : "\n") << "    {\"primitive\": \"" << escape(r.primitive)
+         << "\", \"variant\": \"" << escape(r.variant) << "\", \"size\": "
+         << r.size << ", \"local\": " << r.local << ", \"elements\": "
+         << r.elements << ", \"reps\": " << r.reps
+         << ", \"h2d_ms\": " << r.time.h2d << ", \"kernel_ms\": " << r.time.kernel
+         << ", \"d2h_ms\": " << r.time.d2h << ", \"h2d_gbps\": " << r.h2dGBps()
+         << ", \"kernel_gbps\": " << r.kernelGBps()
+         << ", \"d2h_gbps\": " << r.d2hGBps()
+         << ", \"elements_per_s\": " << r.elementsPerSec() << "}";
+    }
+    os << "\n  ]\n}\n";
+  }
+
+private:
+  static std::string escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+      if (c == '"' || c == '\\')
+        out += '\\';
+      if ((unsigned char)c >= 0x20)
+        out += c;
+    }
+    return out;
+  }
+
+  std::string device_;
+  std::vector<BenchRecord> records_;
+};
+
+#endif
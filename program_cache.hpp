@@ -0,0 +1,150 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include "opencl.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Persistent store of compiled program binaries. Entries are keyed on a
+ * hash of the source, the build options and everything identifying the
+ * compiler (device, driver and platform versions), so a changed kernel or
+ * an upgraded driver simply misses and the stale file is never read.
+ *
+ * The cache lives in $CLP_CACHE_DIR, else $XDG_CACHE_HOME/clPrimitives,
+ * else ~/.cache/clPrimitives. CLP_NO_CACHE=1 disables it.
+ */
+class ProgramCache {
+public:
+  /* Bump when the on-disk layout or key composition changes */
+  static constexpr unsigned FORMAT_VERSION = 1;
+
+  explicit ProgramCache(std::string dir = defaultDir()) : dir_(std::move(dir)) {}
+
+  static std::string defaultDir() {
+    const char *off = std::getenv("CLP_NO_CACHE");
+    if (off && *off && std::string(off) != "0")
+      return "";
+    if (const char *s = std::getenv("CLP_CACHE_DIR"))
+      return s;
+    if (const char *s = std::getenv("XDG_CACHE_HOME"))
+      return std::string(s) + "/clPrimitives";
+    if (const char *s = std::getenv("HOME"))
+      return std::string(s) + "/.cache/clPrimitives";
+    return "";
+  }
+
+  bool enabled() const { return !dir_.empty(); }
+  const std::string &dir() const { return dir_; }
+
+  /* Load a built program for device, compiling and storing it on a miss */
+  cl::Program build(const cl::Context &context, const cl::Device &device,
+                    const std::string &source, const std::string &options) {
+    std::string path;
+    if (enabled()) {
+      path = dir_ + '/' + key(device, source, options) + ".bin";
+
+      cl::Program::Binaries binaries(1);
+      if (load(path, binaries[0])) {
+        try {
+          cl::Program program(context, {device}, binaries);
+          program.build({device}, options.c_str());
+          return program;
+        } catch (cl::Error &) { // corrupt or rejected, rebuild from source
+          std::remove(path.c_str());
+        }
+      }
+    }
+
+    cl::Program program(context, source, false);
+    try {
+      program.build({device}, options.c_str());
+    } catch (cl::Error &) {
+      std::cerr << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << '\n';
+      throw;
+    }
+
+    if (enabled()) {
+      auto binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+      if (!binaries.empty() && !binaries[0].empty())
+        store(path, binaries[0]);
+    }
+    return program;
+  }
+
+  static std::string key(const cl::Device &device, const std::string &source,
+                         const std::string &options) {
+    cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+
+    std::ostringstream id;
+    id << FORMAT_VERSION << '\0' << source << '\0' << options << '\0'
+       << device.getInfo<CL_DEVICE_NAME>() << '\0'
+       << device.getInfo<CL_DEVICE_VENDOR>() << '\0'
+       << device.getInfo<CL_DEVICE_VERSION>() << '\0'
+       << device.getInfo<CL_DRIVER_VERSION>() << '\0'
+       << platform.getInfo<CL_PLATFORM_NAME>() << '\0'
+       << platform.getInfo<CL_PLATFORM_VERSION>();
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx",
+                  (unsigned long long)fnv1a(id.str()));
+    return hex;
+  }
+
+  static uint64_t fnv1a(const std::string &data) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : data) {
+      hash ^= c;
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+private:
+  static bool load(const std::string &path, std::vector<unsigned char> &binary) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      return false;
+    binary.assign(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+    return !binary.empty();
+  }
+
+  /* Write to a temporary file first so concurrent readers never see a
+   * partially written binary */
+  static void store(const std::string &path,
+                    const std::vector<unsigned char> &binary) {
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(path).parent_path(), ec);
+    if (ec)
+      return;
+
+    std::string tmp = path + ".tmp" + std::to_string(std::random_device{}());
+    {
+      std::ofstream out(tmp, std::ios::binary);
+      out.write(reinterpret_cast<const char *>(binary.data()), binary.size());
+      if (!out) {
+        std::remove(tmp.c_str());
+        return;
+      }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+      std::remove(tmp.c_str());
+  }
+
+  std::string dir_;
+};
+
+#endif
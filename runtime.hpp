@@ -0,0 +1,292 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include "opencl.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pool.hpp"
+#include "program_cache.hpp"
+#include "tuner.hpp"
+#include "utils.hpp"
+
+/*
+ * Which device to run on. Every field is optional; an empty selector picks
+ * the first device of the first platform. When nothing matches the
+ * requested type/name the first CPU device is used instead, so samples keep
+ * working on CPU-only (pocl) machines.
+ */
+struct DeviceSelector {
+  int platform = -1;                     // platform index, -1 = any
+  int device = 0;                        // index among the matching devices
+  cl_device_type type = CL_DEVICE_TYPE_ALL;
+  std::string name;                      // substring of device/platform name
+  bool cpuFallback = true;
+
+  /* CLP_PLATFORM, CLP_DEVICE, CLP_DEVICE_TYPE (cpu|gpu|accelerator|all) and
+   * CLP_DEVICE_NAME override the defaults */
+  static DeviceSelector fromEnv() {
+    DeviceSelector sel;
+    if (const char *s = std::getenv("CLP_PLATFORM"))
+      sel.platform = std::atoi(s);
+    if (const char *s = std::getenv("CLP_DEVICE"))
+      sel.device = std::atoi(s);
+    if (const char *s = std::getenv("CLP_DEVICE_TYPE"))
+      sel.type = parseDeviceType(s);
+    if (const char *s = std::getenv("CLP_DEVICE_NAME"))
+      sel.name = s;
+    return sel;
+  }
+
+  static cl_device_type parseDeviceType(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    if (s == "cpu")
+      return CL_DEVICE_TYPE_CPU;
+    if (s == "gpu")
+      return CL_DEVICE_TYPE_GPU;
+    if (s == "accelerator")
+      return CL_DEVICE_TYPE_ACCELERATOR;
+    if (s == "default")
+      return CL_DEVICE_TYPE_DEFAULT;
+    return CL_DEVICE_TYPE_ALL;
+  }
+};
+
+inline bool containsNoCase(std::string haystack, std::string needle) {
+  std::transform(haystack.begin(), haystack.end(), haystack.begin(), ::tolower);
+  std::transform(needle.begin(), needle.end(), needle.begin(), ::tolower);
+  return haystack.find(needle) != std::string::npos;
+}
+
+inline std::vector<cl::Device> listDevices(int platformIdx, cl_device_type type,
+                                           const std::string &name = "") {
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+
+  std::vector<cl::Device> found;
+  for (int p = 0; p < (int)platforms.size(); ++p) {
+    if (platformIdx >= 0 && p != platformIdx)
+      continue;
+
+    std::vector<cl::Device> devices;
+    try {
+      platforms[p].getDevices(type, &devices);
+    } catch (cl::Error &) { // CL_DEVICE_NOT_FOUND is reported as an error
+      continue;
+    }
+    for (auto &d : devices)
+      if (name.empty() || containsNoCase(d.getInfo<CL_DEVICE_NAME>(), name) ||
+          containsNoCase(platforms[p].getInfo<CL_PLATFORM_NAME>(), name))
+        found.push_back(d);
+  }
+  return found;
+}
+
+inline cl::Device selectDevice(const DeviceSelector &sel) {
+  auto devices = listDevices(sel.platform, sel.type, sel.name);
+
+  if (devices.empty() && sel.cpuFallback) {
+    std::cerr << "[WARN] no device matches the selector, falling back to CPU\n";
+    devices = listDevices(-1, CL_DEVICE_TYPE_CPU);
+    if (devices.empty())
+      devices = listDevices(-1, CL_DEVICE_TYPE_ALL);
+  }
+  if (devices.empty())
+    throw cl::Error(CL_DEVICE_NOT_FOUND, "selectDevice");
+
+  if (sel.device < 0 || sel.device >= (int)devices.size()) {
+    std::cerr << "[WARN] device index " << sel.device << " out of range, using 0\n";
+    return devices.front();
+  }
+  return devices[sel.device];
+}
+
+/*
+ * Sub-devices of a device (clCreateSubDevices): one per NUMA node when
+ * computeUnits is 0, else parts of computeUnits compute units each. A
+ * device that cannot be split that way comes back alone.
+ */
+inline std::vector<cl::Device> partitionDevice(cl::Device device, unsigned computeUnits = 0) {
+  std::vector<cl::Device> parts;
+  try {
+    auto supported = device.getInfo<CL_DEVICE_PARTITION_PROPERTIES>();
+    auto supports = [&](cl_device_partition_property p) {
+      return std::find(supported.begin(), supported.end(), p) != supported.end();
+    };
+
+    if (computeUnits == 0 && supports(CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN)) {
+      // drivers without a NUMA domain still split at the outermost cache level
+      cl_device_affinity_domain domains = device.getInfo<CL_DEVICE_PARTITION_AFFINITY_DOMAIN>();
+      const cl_device_partition_property props[] = {
+          CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+          (domains & CL_DEVICE_AFFINITY_DOMAIN_NUMA) ? CL_DEVICE_AFFINITY_DOMAIN_NUMA
+                                                     : CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE,
+          0};
+      device.createSubDevices(props, &parts);
+    } else if (computeUnits > 0 && supports(CL_DEVICE_PARTITION_EQUALLY)) {
+      const cl_device_partition_property props[] = {CL_DEVICE_PARTITION_EQUALLY,
+                                                    (cl_device_partition_property)computeUnits, 0};
+      device.createSubDevices(props, &parts);
+    }
+  } catch (cl::Error &) { // CL_DEVICE_PARTITION_FAILED, single-node machines
+    parts.clear();
+  }
+  if (parts.size() < 2)
+    return {device};
+  return parts;
+}
+
+/* CPU devices are split per CLP_FISSION: numa (default), off, or the
+ * compute units of each part; other devices are left whole */
+inline std::vector<cl::Device> partitionFromEnv(const cl::Device &device) {
+  std::string mode = std::getenv("CLP_FISSION") ? std::getenv("CLP_FISSION") : "numa";
+  if (!(device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) || mode == "off" || mode == "0")
+    return {device};
+  return partitionDevice(device, mode == "numa" ? 0 : std::atoi(mode.c_str()));
+}
+
+/*
+ * Long-lived context, in-order queue and kernel registry for one device.
+ * Programs are built once per (file, options) pair, going through the
+ * on-disk ProgramCache, and kernels are handed out ready for
+ * setArg/enqueue, so repeated calls pay no setup cost. pool() recycles
+ * device memory the same way, and tuning() holds the launch parameters the
+ * autotuner stored for this device.
+ *
+ * Programs and kernels stay registered for the Runtime's lifetime, since
+ * callers keep references to them; the registry grows with every distinct
+ * options string. Code that generates options per call (KernelVariants)
+ * bounds itself and drops what it evicts with release().
+ */
+class Runtime {
+public:
+  explicit Runtime(const cl::Device &device)
+      : device_(device), context_(device), queue_(context_, device_), pool_(context_, device_),
+        tuning_(device_) {}
+
+  /* Process-wide runtime on the device picked by DeviceSelector::fromEnv() */
+  static Runtime &get() {
+    static Runtime runtime(selectDevice(DeviceSelector::fromEnv()));
+    return runtime;
+  }
+
+  const cl::Device &device() const { return device_; }
+  const cl::Context &context() const { return context_; }
+  cl::CommandQueue &queue() { return queue_; }
+  MemoryPool &pool() { return pool_; }
+  TuningTable &tuning() { return tuning_; }
+
+  cl::CommandQueue createQueue(cl_command_queue_properties props = 0) const {
+    return cl::CommandQueue(context_, device_, props);
+  }
+
+  /* Build (or fetch the already built) program from a .cl file */
+  cl::Program &program(const std::string &file, const std::string &options = "") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = file + '\0' + options;
+
+    auto it = programs_.find(key);
+    if (it != programs_.end())
+      return it->second;
+
+    std::string source = ReadTextFile(findKernelFile(file).c_str());
+    if (source.empty()) {
+      std::cerr << "[ERROR] cannot read kernel source " << file << '\n';
+      throw cl::Error(CL_INVALID_PROGRAM, "Runtime::program");
+    }
+
+    cl::Program program = cache_.build(context_, device_, source, options);
+    return programs_.emplace(key, program).first->second;
+  }
+
+  /* Same for generated source, keyed by the text itself */
+  cl::Program &programFromSource(const std::string &source, const std::string &options = "") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = '\1' + source + '\0' + options;
+
+    auto it = programs_.find(key);
+    if (it != programs_.end())
+      return it->second;
+
+    cl::Program program = cache_.build(context_, device_, source, options);
+    return programs_.emplace(key, program).first->second;
+  }
+
+  /* Kernels are shared between callers; set every argument before enqueue */
+  cl::Kernel &kernel(const std::string &file, const std::string &name,
+                     const std::string &options = "") {
+    cl::Program &prog = program(file, options);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = file + '\0' + options + '\0' + name;
+
+    auto it = kernels_.find(key);
+    if (it != kernels_.end())
+      return it->second;
+    return kernels_.emplace(key, cl::Kernel(prog, name.c_str())).first->second;
+  }
+
+  /* Forgets program(file, options) and its kernels; only for callers that
+   * own that key, references handed out for it dangle. Kernels created
+   * from the program keep it alive. */
+  void release(const std::string &file, const std::string &options = "") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = file + '\0' + options;
+    programs_.erase(key);
+    key += '\0';
+    auto it = kernels_.lower_bound(key);
+    while (it != kernels_.end() && it->first.compare(0, key.size(), key) == 0)
+      it = kernels_.erase(it);
+  }
+
+  /* Look for a kernel file as given, then in CLP_KERNEL_PATH, then in ".." */
+  static std::string findKernelFile(const std::string &file) {
+    std::vector<std::string> dirs;
+    if (const char *env = std::getenv("CLP_KERNEL_PATH")) {
+      std::string path(env);
+      for (size_t beg = 0, end; beg <= path.size(); beg = end + 1) {
+        end = std::min(path.find(':', beg), path.size());
+        if (end > beg)
+          dirs.push_back(path.substr(beg, end - beg));
+      }
+    }
+    dirs.push_back("..");
+
+    if (std::ifstream(file).good())
+      return file;
+    for (auto &dir : dirs) {
+      std::string candidate = dir + '/' + file;
+      if (std::ifstream(candidate).good())
+        return candidate;
+    }
+    return file;
+  }
+
+  void printInfo(std::ostream &os = std::cout) const {
+    cl::Platform platform(device_.getInfo<CL_DEVICE_PLATFORM>());
+    os << "[INFO] Using " << device_.getInfo<CL_DEVICE_NAME>() << " on "
+       << platform.getInfo<CL_PLATFORM_NAME>() << '\n';
+  }
+
+private:
+  cl::Device device_;
+  cl::Context context_;
+  cl::CommandQueue queue_;
+  MemoryPool pool_;
+  ProgramCache cache_;
+  TuningTable tuning_;
+
+  std::mutex mutex_;
+  std::map<std::string, cl::Program> programs_;
+  std::map<std::string, cl::Kernel> kernels_;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "runtime.hpp"
+
+/* Writes a fresh buffer from the queue's device, so a CPU driver that
+ * places pages on first touch puts them on the node of the (sub-)device
+ * that will use them rather than on the allocating thread's node */
+inline void firstTouch(const cl::CommandQueue &queue, const cl::Buffer &buffer, size_t bytes) {
+  queue.enqueueFillBuffer(buffer, (cl_uchar)0, 0, bytes);
+}
+
+/*
+ * Splits a 1D range [0, n) over several lanes, a lane being one
+ * profiling-enabled queue on one of the given runtimes (devices, possibly
+ * on different platforms). Chunks are proportional to each lane's share
+ * and aligned to `align`; the leftover of the division goes to the
+ * fastest lane, so nothing is dropped. After every run the shares move
+ * towards the throughput the lanes actually reached.
+ */
+class WorkSplitter {
+public:
+  struct Lane {
+    Runtime *rt;
+    cl::CommandQueue queue;
+    double share = 0;   // fraction of the range
+    double rate = 0;    // items per ms in the last run
+    double millis = 0;  // first command start to last command end
+  };
+
+  struct Chunk {
+    size_t lane, offset, count;
+  };
+
+  /* queuesPerDevice lanes per runtime; initial shares follow compute units */
+  explicit WorkSplitter(const std::vector<Runtime *> &runtimes, size_t queuesPerDevice = 1,
+                        double smoothing = 0.5)
+      : smoothing_(smoothing) {
+    for (Runtime *rt : runtimes)
+      for (size_t q = 0; q < std::max<size_t>(queuesPerDevice, 1); ++q) {
+        Lane lane{rt, rt->createQueue(CL_QUEUE_PROFILING_ENABLE)};
+        lane.share = rt->device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        lanes_.push_back(lane);
+      }
+    if (lanes_.empty())
+      throw cl::Error(CL_INVALID_VALUE, "WorkSplitter: no devices");
+    normalize();
+  }
+
+  const std::vector<Lane> &lanes() const { return lanes_; }
+
+  /* One chunk per lane (empty ones left out) covering [0, n) */
+  std::vector<Chunk> split(size_t n, size_t align = 1) const {
+    align = std::max<size_t>(align, 1);
+    size_t units = n / align, given = 0, fastest = 0;
+    std::vector<size_t> counts(lanes_.size());
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+      counts[i] = (size_t)(lanes_[i].share * units) * align;
+      given += counts[i];
+      if (lanes_[i].share > lanes_[fastest].share)
+        fastest = i;
+    }
+    counts[fastest] += n - given;
+
+    std::vector<Chunk> chunks;
+    size_t offset = 0;
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+      if (counts[i])
+        chunks.push_back({i, offset, counts[i]});
+      offset += counts[i];
+    }
+    return chunks;
+  }
+
+  /*
+   * enqueue(lane, chunk, events) enqueues the whole job for a chunk on
+   * lane.queue and appends its events. Blocks until every lane is done,
+   * then rebalances.
+   */
+  template <class Enqueue> void run(size_t n, Enqueue enqueue, size_t align = 1) {
+    auto chunks = split(n, align);
+    std::vector<std::vector<cl::Event>> events(chunks.size());
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      enqueue(lanes_[chunks[c].lane], chunks[c], events[c]);
+      lanes_[chunks[c].lane].queue.flush();
+    }
+    for (size_t c = 0; c < chunks.size(); ++c)
+      if (!events[c].empty())
+        cl::Event::waitForEvents(events[c]);
+
+    for (auto &lane : lanes_)
+      lane.rate = lane.millis = 0;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+      if (events[c].empty())
+        continue;
+      cl_ulong beg = events[c].front().getProfilingInfo<CL_PROFILING_COMMAND_START>();
+      cl_ulong end = events[c].back().getProfilingInfo<CL_PROFILING_COMMAND_END>();
+      Lane &lane = lanes_[chunks[c].lane];
+      lane.millis = std::max((end - beg) * 1e-6, 1e-6);
+      lane.rate = chunks[c].count / lane.millis;
+    }
+    rebalance();
+  }
+
+private:
+  void normalize() {
+    double sum = 0;
+    for (auto &lane : lanes_)
+      sum += lane.share;
+    for (auto &lane : lanes_)
+      lane.share = sum > 0 ? lane.share / sum : 1.0 / lanes_.size();
+  }
+
+  /* Lanes that got no work keep their share, everybody else moves towards
+   * its share of the measured total rate */
+  void rebalance() {
+    double total = 0, measured = 0;
+    for (auto &lane : lanes_)
+      if (lane.rate > 0) {
+        total += lane.rate;
+        measured += lane.share;
+      }
+    if (total <= 0)
+      return;
+    for (auto &lane : lanes_)
+      if (lane.rate > 0)
+        lane.share = (1 - smoothing_) * lane.share + smoothing_ * measured * lane.rate / total;
+    normalize();
+  }
+
+  std::vector<Lane> lanes_;
+  double smoothing_;
+};
+
+#endif
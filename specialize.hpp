@@ -0,0 +1,110 @@
+#ifndef SPECIALIZE_H
+#define SPECIALIZE_H
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+#include "runtime.hpp"
+
+/* OpenCL C spelling of a value baked into a kernel; floats in hex, so the
+ * variant computes exactly what the runtime argument did */
+template <class T> std::string clLiteral(T v) {
+  static_assert(std::is_arithmetic<T>::value, "clLiteral: arithmetic values only");
+  std::ostringstream s;
+  if (std::is_integral<T>::value)
+    s << '(' << +v << (std::is_unsigned<T>::value ? "u" : "") << ')';
+  else
+    s << '(' << std::hexfloat << v << (std::is_same<T, float>::value ? "f" : "") << ')';
+  return s.str();
+}
+
+/*
+ * Variants of one kernel with per-call parameters compiled in as
+ * constants: get(values...) is kernel `name` of `file` built with
+ * -D names[i]=values[i], on first use, and the same kernel object on every
+ * later call with those values. The source keeps a runtime argument for
+ * each parameter and only swaps in the constant when its name is defined,
+ * so a variant takes the same arguments as the generic kernel and callers
+ * set them as before.
+ *
+ * Constant trip counts and operands let the compiler unroll and fold what
+ * the generic kernel evaluates per work-item, which shows most for small
+ * filters on CPU devices. Every distinct value is a program build, so bake
+ * values that repeat across many launches; integral ones can be named at
+ * compile time, get<5>().
+ *
+ * At most limit variants are kept: building one more evicts the least
+ * recently used, kernel and Runtime program both, so a returned reference
+ * holds until limit - 1 other variants have been built. Binaries already
+ * in the ProgramCache stay on disk.
+ */
+template <class... Params> class KernelVariants {
+public:
+  KernelVariants(Runtime &rt, std::string file, std::string name,
+                 std::array<std::string, sizeof...(Params)> names, std::string options = "",
+                 size_t limit = 32)
+      : rt_(rt), file_(std::move(file)), name_(std::move(name)), names_(std::move(names)),
+        options_(std::move(options)), limit_(std::max<size_t>(limit, 1)) {}
+
+  ~KernelVariants() {
+    for (auto &v : kernels_)
+      rt_.release(file_, v.second.options);
+  }
+
+  KernelVariants(const KernelVariants &) = delete;
+  KernelVariants &operator=(const KernelVariants &) = delete;
+
+  cl::Kernel &get(const Params &...values) {
+    auto key = std::make_tuple(values...);
+    auto it = kernels_.find(key);
+    if (it != kernels_.end()) {
+      used_.splice(used_.end(), used_, it->second.use);
+      return it->second.kernel;
+    }
+
+    std::string options = options_;
+    size_t i = 0;
+    ((options += " -D " + names_[i++] + '=' + clLiteral(values)), ...);
+    cl::Kernel kernel(rt_.program(file_, options), name_.c_str());
+
+    if (kernels_.size() >= limit_) {
+      auto oldest = kernels_.find(used_.front());
+      rt_.release(file_, oldest->second.options);
+      kernels_.erase(oldest);
+      used_.pop_front();
+    }
+    used_.push_back(key);
+    return kernels_.emplace(key, Variant{kernel, options, std::prev(used_.end())})
+        .first->second.kernel;
+  }
+
+  template <auto... Values> cl::Kernel &get() { return get(Values...); }
+
+  size_t size() const { return kernels_.size(); }
+  size_t limit() const { return limit_; }
+
+private:
+  using Key = std::tuple<Params...>;
+  struct Variant {
+    cl::Kernel kernel;
+    std::string options;
+    typename std::list<Key>::iterator use; // position in used_
+  };
+
+  Runtime &rt_;
+  std::string file_, name_;
+  std::array<std::string, sizeof...(Params)> names_;
+  std::string options_;
+  size_t limit_;
+  std::map<Key, Variant> kernels_;
+  std::list<Key> used_; // least recently used first
+};
+
+#endif
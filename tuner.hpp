@@ -0,0 +1,221 @@
+#ifndef TUNER_H
+#define TUNER_H
+
+#include "opencl.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "program_cache.hpp"
+
+/*
+ * Per-device launch parameters picked by the autotuner: one line per
+ * primitive, its name followed by its values (tile sizes, work-group
+ * size, vector width, in the order the primitive documents).
+ *
+ * The file is read when the Runtime starts and primitives take their
+ * values from it in their constructors, still shrinking them to what the
+ * compiled kernels accept, so a stale entry costs speed, not correctness.
+ * It lives next to the ProgramCache binaries, named after a hash of the
+ * device and driver so an upgraded driver starts untuned; CLP_TUNING_FILE
+ * names it explicitly and CLP_NO_TUNING=1 ignores it.
+ */
+class TuningTable {
+public:
+  explicit TuningTable(const cl::Device &device) : path_(defaultPath(device)) {
+    const char *off = std::getenv("CLP_NO_TUNING");
+    if (!(off && *off && std::string(off) != "0"))
+      load();
+  }
+
+  static std::string defaultPath(const cl::Device &device) {
+    if (const char *s = std::getenv("CLP_TUNING_FILE"))
+      return s;
+    std::string dir = ProgramCache::defaultDir();
+    if (dir.empty())
+      return "";
+    return dir + "/tuning-" + ProgramCache::key(device, "tuning", "") + ".txt";
+  }
+
+  const std::string &path() const { return path_; }
+
+  /* Values stored for name, empty when it was never tuned */
+  std::vector<size_t> get(const std::string &name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(name);
+    return it == entries_.end() ? std::vector<size_t>() : it->second;
+  }
+
+  /* In memory only until save() */
+  void set(const std::string &name, const std::vector<size_t> &values) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (values.empty())
+      entries_.erase(name);
+    else
+      entries_[name] = values;
+  }
+
+  /* Rewrites the file through a temporary, like ProgramCache::store */
+  bool save() const {
+    if (path_.empty())
+      return false;
+    std::error_code ec;
+    std::filesystem::path parent = std::filesystem::path(path_).parent_path();
+    if (!parent.empty())
+      std::filesystem::create_directories(parent, ec);
+
+    std::string tmp = path_ + ".tmp" + std::to_string(std::random_device{}());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::ofstream out(tmp);
+      out << "# clPrimitives tuning: name values...\n";
+      for (auto &e : entries_) {
+        out << e.first;
+        for (size_t v : e.second)
+          out << ' ' << v;
+        out << '\n';
+      }
+      if (!out) {
+        std::remove(tmp.c_str());
+        return false;
+      }
+    }
+    std::filesystem::rename(tmp, path_, ec);
+    if (ec) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  void load() {
+    std::ifstream in(path_);
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.empty() || line[0] == '#')
+        continue;
+      std::istringstream fields(line);
+      std::string name;
+      std::vector<size_t> values;
+      size_t v;
+      fields >> name;
+      while (fields >> v)
+        values.push_back(v);
+      if (!name.empty() && !values.empty() && fields.eof())
+        entries_[name] = values;
+    }
+  }
+
+  std::string path_;
+  mutable std::mutex mutex_;
+  std::map<std::string, std::vector<size_t>> entries_;
+};
+
+/* Tuned values of name when there are exactly count of them, all non-zero */
+inline bool tunedValues(const TuningTable &table, const std::string &name, size_t count,
+                        std::vector<size_t> &values) {
+  std::vector<size_t> v = table.get(name);
+  if (v.size() != count || std::find(v.begin(), v.end(), 0) != v.end())
+    return false;
+  values = v;
+  return true;
+}
+
+/* Largest local size at most requested that divides global, for kernels
+ * without bounds checks. 0, asking the runtime to choose, when that is
+ * under half of requested: a prime global would otherwise launch global
+ * work-groups of one item */
+inline size_t fitLocal(size_t global, size_t requested) {
+  if (requested == 0 || global == 0)
+    return 0;
+  for (size_t l = std::min(requested, global); l > 1; --l)
+    if (global % l == 0)
+      return 2 * l >= std::min(requested, global) ? l : 0;
+  return 0;
+}
+
+/*
+ * Work-group sizes worth timing for kernel: powers of two times its
+ * CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE (the SIMD width) up to its
+ * work-group limit, smallest first. Sizes that are no multiple of it leave
+ * lanes idle and are not tried.
+ */
+inline std::vector<size_t> localSizes(const cl::Kernel &kernel, const cl::Device &device,
+                                      size_t limit = 1024) {
+  size_t multiple = 1;
+  try {
+    multiple = kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+  } catch (cl::Error &) { // OpenCL 1.0 devices
+  }
+  limit = std::min(limit, (size_t)kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+  std::vector<size_t> sizes;
+  for (size_t s = std::max<size_t>(multiple, 1); s <= limit; s *= 2)
+    sizes.push_back(s);
+  if (sizes.empty())
+    sizes.push_back(std::max<size_t>(limit, 1));
+  return sizes;
+}
+
+/* (x, y) power of two tiles of every size in sizes, x at least minX */
+inline std::vector<std::vector<size_t>> tileShapes(const std::vector<size_t> &sizes,
+                                                   size_t minX = 1) {
+  std::vector<std::vector<size_t>> shapes;
+  for (size_t s : sizes)
+    for (size_t x = 1; x <= s; x *= 2)
+      if (x >= minX && s % x == 0)
+        shapes.push_back({x, s / x});
+  return shapes;
+}
+
+/*
+ * Times every candidate for name and keeps the fastest in table (in memory;
+ * save() persists it). time(values) builds the primitive with values
+ * already set in the table, so it picks them up, and returns milliseconds;
+ * it may overwrite values with what the primitive actually settled on.
+ * Candidates the device rejects (cl::Error) are skipped. Returns the
+ * winner, or nothing when every candidate failed and the entry is left as
+ * it was.
+ */
+template <class Time>
+std::vector<size_t> autotune(TuningTable &table, const std::string &name,
+                             const std::vector<std::vector<size_t>> &candidates, Time time,
+                             std::ostream *log = nullptr) {
+  std::vector<size_t> previous = table.get(name), best;
+  double bestMs = std::numeric_limits<double>::infinity();
+  for (auto candidate : candidates) {
+    table.set(name, candidate);
+    double ms;
+    try {
+      ms = time(candidate);
+    } catch (cl::Error &e) {
+      if (log)
+        *log << "[INFO]   " << name << " skipped, " << e.what() << " (" << e.err() << ")\n";
+      continue;
+    }
+    if (log) {
+      *log << "[INFO]   " << name;
+      for (size_t v : candidate)
+        *log << ' ' << v;
+      *log << ": " << ms << " ms\n";
+    }
+    if (ms < bestMs) {
+      bestMs = ms;
+      best = candidate;
+    }
+  }
+  table.set(name, best.empty() ? previous : best);
+  return best;
+}
+
+#endif
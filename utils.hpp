@@ -4,34 +4,140 @@
 #include <boost/gil/extension/io/jpeg_io.hpp>
 #include <fstream>
 #include <iostream>
+#include <type_traits>
 
-inline int *readImage(const boost::gil::rgb8_image_t &gilImage, int *buf) {
-  int i = 0;
-
-  for (int x = 0; x < gilImage.width(); ++x) {
-    auto it = gilImage._view.col_begin(x);
-    for (int y = 0; y < gilImage.height(); ++y) {
-      buf[i++] = boost::gil::at_c<0>(it[y]);
-      buf[i++] = boost::gil::at_c<1>(it[y]);
-      buf[i++] = boost::gil::at_c<2>(it[y]);
-      buf[i++] = 0; // boost::gil::at_c<3>(it[y]);
-    }
-  }
+#include "opencl.hpp"
+
+/*
+ * Images travel as packed 8-bit channels, matching CL_RGBA/CL_UNORM_INT8
+ * (4 bytes per pixel, alpha = 255) and CL_R/CL_UNORM_INT8 (1 byte per pixel),
+ * row after row exactly like the kernels index them.
+ */
+inline unsigned char *readImage(const boost::gil::rgb8_image_t &gilImage,
+                                unsigned char *buf) {
+  boost::gil::copy_and_convert_pixels(
+      const_view(gilImage),
+      boost::gil::interleaved_view(gilImage.width(), gilImage.height(),
+                                   (boost::gil::rgba8_pixel_t *)buf,
+                                   gilImage.width() * 4));
+  return buf;
+}
+
+inline unsigned char *readImage(const boost::gil::gray8_image_t &gilImage,
+                                unsigned char *buf) {
+  boost::gil::copy_pixels(
+      const_view(gilImage),
+      boost::gil::interleaved_view(gilImage.width(), gilImage.height(),
+                                   (boost::gil::gray8_pixel_t *)buf,
+                                   gilImage.width()));
   return buf;
 }
 
-inline void writeImage(boost::gil::rgb8_image_t &gilImage, int *buf) {
-  int i = 0;
-  for (int x = 0; x < gilImage.width(); ++x) {
-    auto it = gilImage._view.col_begin(x);
-    for (int y = 0; y < gilImage.height(); ++y) {
-      boost::gil::at_c<0>(it[y]) = buf[i++];
-      boost::gil::at_c<1>(it[y]) = buf[i++];
-      boost::gil::at_c<2>(it[y]) = buf[i++];
-      i++;
-      // boost::gil::at_c<3>(it[y]) = 0;i++;
-    }
-  }
+/* Single channel C of an RGB image, in the CL_R layout */
+template <int C>
+inline unsigned char *readChannel(const boost::gil::rgb8_image_t &gilImage,
+                                  unsigned char *buf) {
+  boost::gil::copy_pixels(
+      boost::gil::nth_channel_view(const_view(gilImage), C),
+      boost::gil::interleaved_view(gilImage.width(), gilImage.height(),
+                                   (boost::gil::gray8_pixel_t *)buf,
+                                   gilImage.width()));
+  return buf;
+}
+
+inline void writeImage(boost::gil::rgb8_image_t &gilImage,
+                       const unsigned char *buf) {
+  boost::gil::copy_and_convert_pixels(
+      boost::gil::interleaved_view(gilImage.width(), gilImage.height(),
+                                   (const boost::gil::rgba8_pixel_t *)buf,
+                                   gilImage.width() * 4),
+      view(gilImage));
+}
+
+inline void writeImage(boost::gil::gray8_image_t &gilImage,
+                       const unsigned char *buf) {
+  boost::gil::copy_pixels(
+      boost::gil::interleaved_view(gilImage.width(), gilImage.height(),
+                                   (const boost::gil::gray8_pixel_t *)buf,
+                                   gilImage.width()),
+      view(gilImage));
+}
+
+/*
+ * Host <-> device image bridge. Single channel views map to CL_R, anything
+ * else to CL_RGBA, both CL_UNORM_INT8.
+ */
+template <class View>
+using DevicePixel =
+    typename std::conditional<boost::gil::num_channels<View>::value == 1,
+                              boost::gil::gray8_pixel_t,
+                              boost::gil::rgba8_pixel_t>::type;
+
+template <class View> inline cl::ImageFormat deviceFormat() {
+  return cl::ImageFormat(boost::gil::num_channels<View>::value == 1 ? CL_R : CL_RGBA,
+                         CL_UNORM_INT8);
+}
+
+/*
+ * Device image backed directly by the pixels of an interleaved rgba8/gray8
+ * view (CL_MEM_USE_HOST_PTR, GIL's row pitch), nothing is copied on the
+ * host. The view must outlive the image; read results back through
+ * downloadView, which only synchronizes in that case.
+ */
+template <class View>
+inline cl::Image2D wrapView(const cl::Context &context, cl_mem_flags flags,
+                            const View &view) {
+  static_assert(std::is_same<typename std::remove_const<
+                                 typename View::value_type>::type,
+                             DevicePixel<View>>::value,
+                "wrapView needs an rgba8 or gray8 view");
+
+  void *pixels = const_cast<void *>(
+      (const void *)boost::gil::interleaved_view_get_raw_data(view));
+  return cl::Image2D(context, flags | CL_MEM_USE_HOST_PTR, deviceFormat<View>(),
+                     view.width(), view.height(), view.pixels().row_size(),
+                     pixels);
+}
+
+/* Convert any 8-bit view straight into a mapped device image (or one layer
+ * of an image array), row by row */
+template <class View>
+inline void uploadView(const cl::CommandQueue &queue, const cl::Image &image,
+                       const View &src, size_t layer = 0) {
+  typedef DevicePixel<View> Pixel;
+  cl::array<cl::size_type, 3> origin = {0, 0, (cl::size_type)layer};
+  cl::array<cl::size_type, 3> region = {(cl::size_type)src.width(),
+                                        (cl::size_type)src.height(), 1};
+  cl::size_type rowPitch = 0, slicePitch = 0;
+
+  void *mapped = queue.enqueueMapImage(image, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                                       origin, region, &rowPitch, &slicePitch);
+  if (mapped != (const void *)boost::gil::interleaved_view_get_raw_data(src))
+    boost::gil::copy_and_convert_pixels(
+        src, boost::gil::interleaved_view(src.width(), src.height(),
+                                          (Pixel *)mapped, rowPitch));
+  queue.enqueueUnmapMemObject(image, mapped);
+}
+
+/* Inverse of uploadView; for a wrapView image this is only a sync point */
+template <class View>
+inline void downloadView(const cl::CommandQueue &queue, const cl::Image &image,
+                         const View &dst, size_t layer = 0) {
+  typedef DevicePixel<View> Pixel;
+  cl::array<cl::size_type, 3> origin = {0, 0, (cl::size_type)layer};
+  cl::array<cl::size_type, 3> region = {(cl::size_type)dst.width(),
+                                        (cl::size_type)dst.height(), 1};
+  cl::size_type rowPitch = 0, slicePitch = 0;
+
+  void *mapped = queue.enqueueMapImage(image, CL_TRUE, CL_MAP_READ, origin, region,
+                                       &rowPitch, &slicePitch);
+  if (mapped != (const void *)boost::gil::interleaved_view_get_raw_data(dst))
+    boost::gil::copy_and_convert_pixels(
+        boost::gil::interleaved_view(dst.width(), dst.height(),
+                                     (const Pixel *)mapped, rowPitch),
+        dst);
+  queue.enqueueUnmapMemObject(image, mapped);
+  queue.finish();
 }
 
 inline std::string ReadTextFile(const char *s) {